@@ -0,0 +1,134 @@
+#include "util.hh"
+
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+using Kernel = InternetChecksum::Kernel;
+
+//! How to feed the data to InternetChecksum
+enum class Mode { Add, CopyAndAdd };
+
+static const char *kernel_name(const Kernel kernel) {
+    switch (kernel) {
+        case Kernel::Bytewise:
+            return "bytewise";
+        case Kernel::Word:
+            return "word";
+        case Kernel::SSE2:
+            return "sse2";
+        case Kernel::AVX2:
+            return "avx2";
+    }
+    return "?";
+}
+
+//! Checksum `data` in pieces of `piece_size` bytes (all of it at once if zero); returns the checksum
+static uint16_t checksum(const Kernel kernel, const Mode mode, string_view data, const size_t piece_size, char *copy) {
+    InternetChecksum sum{0, kernel};
+    const size_t step = piece_size == 0 ? data.size() : piece_size;
+    for (size_t start = 0; start < data.size(); start += step) {
+        const string_view piece = data.substr(start, step);
+        if (mode == Mode::Add) {
+            sum.add(piece);
+        } else {
+            sum.copy_and_add(copy + start, piece);
+        }
+    }
+    return sum.value();
+}
+
+//! \returns GB/s, running for at least `min_ns`
+static double measure(const Kernel kernel,
+                      const Mode mode,
+                      const string_view data,
+                      const size_t piece_size,
+                      char *copy,
+                      const uint64_t min_ns,
+                      uint64_t &sink) {
+    uint64_t iterations = 0;
+    const uint64_t start = timestamp_ns();
+    uint64_t elapsed = 0;
+    do {
+        // (in batches, so that reading the clock doesn't dominate small sizes)
+        for (unsigned i = 0; i < 64; i++) {
+            sink += checksum(kernel, mode, data, piece_size, copy);
+        }
+        iterations += 64;
+        elapsed = timestamp_ns() - start;
+    } while (elapsed < min_ns);
+    return double(iterations) * double(data.size()) / double(elapsed);
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        if (argc > 2) {
+            cerr << "Usage: " << argv[0] << " [milliseconds per measurement]\n";
+            return EXIT_FAILURE;
+        }
+        const uint64_t min_ns = (argc == 2 ? stoull(argv[1]) : 50) * 1'000'000;
+
+        vector<Kernel> kernels;
+        for (const Kernel kernel : {Kernel::Bytewise, Kernel::Word, Kernel::SSE2, Kernel::AVX2}) {
+            if (InternetChecksum::supported(kernel)) {
+                kernels.push_back(kernel);
+            }
+        }
+
+        const vector<size_t> sizes{64, 576, 1500, 9000, 65536, 1 << 20};
+        const vector<size_t> alignments{0, 1, 8};
+        // (0 is one add() call; 7 is odd, so most calls continue a word the previous one started)
+        const vector<size_t> piece_sizes{0, 1500, 7};
+
+        auto rd = get_random_generator();
+        string buffer(sizes.back() + 64, '\0');
+        generate(buffer.begin(), buffer.end(), [&] { return char(rd()); });
+        string copy(buffer.size(), '\0');
+        uint64_t sink = 0;
+
+        cout << "InternetChecksum throughput in GB/s (fastest kernel: "
+             << kernel_name(InternetChecksum::fastest_kernel()) << ")\n\n";
+        cout << left << setw(12) << "mode" << setw(10) << "size" << setw(7) << "align" << setw(7) << "piece";
+        for (const Kernel kernel : kernels) {
+            cout << right << setw(10) << kernel_name(kernel);
+        }
+        cout << '\n' << fixed << setprecision(2);
+
+        for (const Mode mode : {Mode::Add, Mode::CopyAndAdd}) {
+            for (const size_t size : sizes) {
+                for (const size_t alignment : alignments) {
+                    for (const size_t piece_size : piece_sizes) {
+                        if (piece_size >= size) {
+                            continue;
+                        }
+                        const string_view data = string_view(buffer).substr(alignment, size);
+                        cout << left << setw(12) << (mode == Mode::Add ? "add" : "copy+add") << setw(10) << size
+                             << setw(7) << alignment << setw(7) << (piece_size == 0 ? "all" : to_string(piece_size));
+                        for (const Kernel kernel : kernels) {
+                            cout << right << setw(10)
+                                 << measure(kernel, mode, data, piece_size, copy.data() + alignment, min_ns, sink);
+                        }
+                        cout << endl;
+                    }
+                }
+            }
+        }
+
+        // (so that the compiler can't skip the work)
+        if (sink == 0) {
+            cout << "\n";
+        }
+    } catch (const exception &e) {
+        cerr << "Exception: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -8,7 +8,7 @@ using namespace std;
 
 void get_URL(const string &host, const string &path) {
     Address addr = Address(host, "http");
-    TCPSocket socket = TCPSocket();
+    TCPSocket socket{addr.family()};
 
     // After this line of code is executed,
     // the 3-way handshake is performed
@@ -34,6 +34,29 @@ add_test(NAME t_byte_stream_two_writes   COMMAND byte_stream_two_writes)
 add_test(NAME t_byte_stream_capacity     COMMAND byte_stream_capacity)
 add_test(NAME t_byte_stream_many_writes  COMMAND byte_stream_many_writes)
 
+add_test(NAME t_fd_io_stats        COMMAND fd_io_stats)
+add_test(NAME t_eventloop_backends COMMAND eventloop_backends)
+add_test(NAME t_timer_wheel        COMMAND timer_wheel)
+add_test(NAME t_eventloop_post     COMMAND eventloop_post)
+add_test(NAME t_sharded_runtime    COMMAND sharded_runtime)
+add_test(NAME t_eventloop_stats    COMMAND eventloop_stats)
+add_test(NAME t_eventloop_alloc    COMMAND eventloop_alloc)
+add_test(NAME t_eventloop_signals  COMMAND eventloop_signals)
+add_test(NAME t_udp_batch          COMMAND udp_batch)
+add_test(NAME t_tcp_connect_accept COMMAND tcp_connect_accept)
+add_test(NAME t_socket_tuning      COMMAND socket_tuning)
+add_test(NAME t_zerocopy_send      COMMAND zerocopy_send)
+add_test(NAME t_socket_timestamps  COMMAND socket_timestamps)
+add_test(NAME t_resolver           COMMAND resolver)
+add_test(NAME t_address_format     COMMAND address_format)
+add_test(NAME t_socket_ipv6        COMMAND socket_ipv6)
+add_test(NAME t_internet_checksum  COMMAND internet_checksum)
+add_test(NAME t_checksum_update    COMMAND checksum_update)
+add_test(NAME t_checksum_fuzz      COMMAND checksum_fuzz)
+if (TARGET eventloop_async)
+    add_test(NAME t_eventloop_async COMMAND eventloop_async)
+endif ()
+
 add_test(NAME t_webget               COMMAND "${PROJECT_SOURCE_DIR}/tests/webget_t.sh")
 
 add_test(NAME arp_network_interface    COMMAND net_interface)
@@ -3,11 +3,13 @@
 #include "util.hh"
 
 #include <arpa/inet.h>
+#include <array>
 #include <cstring>
 #include <memory>
 #include <netdb.h>
 #include <stdexcept>
 #include <system_error>
+#include <tuple>
 
 using namespace std;
 
@@ -19,13 +21,66 @@ Address::Raw::operator const sockaddr *() const { return reinterpret_cast<const
 
 //! \param[in] addr points to a raw socket address
 //! \param[in] size is `addr`'s length
+//! \details Throws std::runtime_error if the address is larger than a `sockaddr_storage`. An IP address
+//! is kept inline; a larger one (e.g., an `AF_UNIX` path) is copied to the heap.
 Address::Address(const sockaddr *addr, const size_t size) : _size(size) {
     // make sure proposed sockaddr can fit
-    if (size > sizeof(_address.storage)) {
+    if (size > sizeof(sockaddr_storage)) {
         throw runtime_error("invalid sockaddr size");
     }
 
-    memcpy(&_address.storage, addr, size);
+    if (not _external()) {
+        memcpy(&_address, addr, size);
+        return;
+    }
+
+    _address.external.family = addr->sa_family;
+    auto *heap = new sockaddr_storage{};
+    memcpy(heap, addr, size);
+    _set_heap(heap);
+}
+
+Address::Address(const Address &other) : _size(other._size), _address(other._address) {
+    if (_external()) {
+        _set_heap(new sockaddr_storage{*other._heap()});
+    }
+}
+
+Address::Address(Address &&other) noexcept : _size(other._size), _address(other._address) {
+    other._size = 0;
+    other._address = {};
+}
+
+Address &Address::operator=(const Address &other) {
+    if (this != &other) {
+        *this = Address(other);
+    }
+    return *this;
+}
+
+Address &Address::operator=(Address &&other) noexcept {
+    swap(_size, other._size);
+    swap(_address, other._address);
+    return *this;
+}
+
+Address::~Address() {
+    if (_external()) {
+        delete _heap();
+    }
+}
+
+sockaddr_storage *Address::_heap() const {
+    sockaddr_storage *heap = nullptr;
+    memcpy(&heap, _address.external.owner.data(), sizeof(heap));
+    return heap;
+}
+
+//! \param[in] heap is the address, which the Address now owns
+void Address::_set_heap(sockaddr_storage *heap) { memcpy(_address.external.owner.data(), &heap, sizeof(heap)); }
+
+const sockaddr *Address::_raw() const {
+    return _external() ? reinterpret_cast<const sockaddr *>(_heap()) : &_address.generic;
 }
 
 //! Error category for getaddrinfo and getnameinfo failures.
@@ -77,43 +132,199 @@ static inline addrinfo make_hints(const int ai_flags, const int ai_family) {
 
 //! \param[in] hostname to resolve
 //! \param[in] service name (from `/etc/services`, e.g., "http" is port 80)
+//! \details The address is IPv4 or IPv6, whichever getaddrinfo prefers among the families that this host
+//! has (non-loopback) addresses in.
 Address::Address(const string &hostname, const string &service)
-    : Address(hostname, service, make_hints(AI_ALL, AF_INET)) {}
+    : Address(hostname, service, make_hints(AI_ADDRCONFIG, AF_UNSPEC)) {}
+
+//! \param[in] hostname to resolve
+//! \param[in] service name (from `/etc/services`, e.g., "http" is port 80)
+//! \param[in] family is `AF_INET` or `AF_INET6`
+Address::Address(const string &hostname, const string &service, const int family)
+    : Address(hostname, service, make_hints(0, family)) {}
 
-//! \param[in] ip address as a dotted quad ("1.1.1.1")
+//! \param[in] ip address as a dotted quad ("1.1.1.1") or in IPv6 notation ("2001:db8::1", or
+//!               "fe80::1%eth0" with a scope)
 //! \param[in] port number
 Address::Address(const string &ip, const uint16_t port)
     // tell getaddrinfo that we don't want to resolve anything
-    : Address(ip, ::to_string(port), make_hints(AI_NUMERICHOST | AI_NUMERICSERV, AF_INET)) {}
+    : Address(ip, ::to_string(port), make_hints(AI_NUMERICHOST | AI_NUMERICSERV, AF_UNSPEC)) {}
 
-// accessors
-pair<string, uint16_t> Address::ip_port() const {
-    array<char, NI_MAXHOST> ip{};
-    array<char, NI_MAXSERV> port{};
+//! \brief Write `value` in decimal
+//! \param[in] out is where to write it
+//! \param[in] value is the number to write
+//! \returns the end of what was written
+static char *format_decimal(char *out, uint32_t value) {
+    char digits[10];
+    size_t count = 0;
+    do {
+        digits[count++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    while (count > 0) {
+        *out++ = digits[--count];
+    }
+    return out;
+}
+
+//! \brief Write an IPv4 address as a dotted quad ("18.243.0.1")
+//! \param[in] out is where to write it (at least 15 bytes)
+//! \param[in] bytes are the address's four bytes, in network order
+//! \returns the end of what was written
+static char *format_ipv4(char *out, const uint8_t *bytes) {
+    for (size_t i = 0; i < 4; i++) {
+        if (i > 0) {
+            *out++ = '.';
+        }
+        out = format_decimal(out, bytes[i]);
+    }
+    return out;
+}
+
+//! \brief Write an IPv6 address as [inet_ntop(3)](\ref man3::inet_ntop) would
+//! \param[in] out is where to write it (at least 45 bytes)
+//! \param[in] bytes are the address's sixteen bytes, in network order
+//! \returns the end of what was written
+//! \details As RFC 5952 recommends, groups are in lowercase hex without leading zeros, and the longest run
+//! of two or more zero groups (the first, if there is a tie) is shortened to "::". An IPv4-mapped
+//! (::ffff:0:0/96) or IPv4-compatible (::/96) address ends with its IPv4 address as a dotted quad.
+static char *format_ipv6(char *out, const uint8_t *bytes) {
+    static constexpr char hex_digits[] = "0123456789abcdef";
 
-    const int gni_ret =
-        getnameinfo(_address, _size, ip.data(), ip.size(), port.data(), port.size(), NI_NUMERICHOST | NI_NUMERICSERV);
-    if (gni_ret != 0) {
-        throw tagged_error(gai_error_category(), "getnameinfo", gni_ret);
+    array<uint16_t, 8> groups{};
+    for (size_t i = 0; i < groups.size(); i++) {
+        groups[i] = static_cast<uint16_t>(bytes[2 * i] << 8 | bytes[2 * i + 1]);
     }
 
-    return {ip.data(), stoi(port.data())};
+    // find the longest run of zero groups
+    size_t zeros_start = groups.size(), zeros_length = 0;
+    for (size_t i = 0; i < groups.size();) {
+        size_t end = i;
+        while (end < groups.size() and groups[end] == 0) {
+            end++;
+        }
+        if (end - i > zeros_length and end - i >= 2) {
+            zeros_start = i;
+            zeros_length = end - i;
+        }
+        i = end == i ? i + 1 : end;
+    }
+
+    const bool embeds_ipv4 = zeros_start == 0 and (zeros_length == 6 or (zeros_length == 5 and groups[5] == 0xffff));
+    const size_t hex_groups = embeds_ipv4 ? 6 : groups.size();
+    for (size_t i = 0; i < hex_groups; i++) {
+        if (i == zeros_start) {
+            *out++ = ':';
+            i += zeros_length - 1;
+            if (i + 1 == groups.size()) {
+                *out++ = ':';
+            }
+            continue;
+        }
+        if (i > 0) {
+            *out++ = ':';
+        }
+        bool leading = true;
+        for (int shift = 12; shift >= 0; shift -= 4) {
+            const unsigned digit = (groups[i] >> shift) & 0xf;
+            if (digit != 0 or shift == 0 or not leading) {
+                *out++ = hex_digits[digit];
+                leading = false;
+            }
+        }
+    }
+    if (embeds_ipv4) {
+        *out++ = ':';
+        out = format_ipv4(out, bytes + 12);
+    }
+    return out;
 }
 
-string Address::to_string() const {
-    const auto ip_and_port = ip_port();
-    return ip_and_port.first + ":" + ::to_string(ip_and_port.second);
+//! \param[in] out is where to write it (at least Address::max_formatted_size - 8 bytes)
+//! \returns the end of what was written
+//! \details An IPv6 address with a scope is followed by "%" and the scope id, in decimal.
+char *Address::_format_ip(char *out) const {
+    switch (family()) {
+        case AF_INET:
+            return format_ipv4(out, reinterpret_cast<const uint8_t *>(&_address.ipv4.sin_addr));
+        case AF_INET6:
+            out = format_ipv6(out, _address.ipv6.sin6_addr.s6_addr);
+            if (_address.ipv6.sin6_scope_id != 0) {
+                *out++ = '%';
+                out = format_decimal(out, _address.ipv6.sin6_scope_id);
+            }
+            return out;
+        default:
+            throw runtime_error("Address: not an IP address (family " + ::to_string(family()) + ")");
+    }
+}
+
+//! \param[in] buffer is where to write the address
+//! \param[in] size is `buffer`'s length (Address::max_formatted_size is always enough)
+//! \returns the number of bytes written
+size_t Address::format_ip(char *buffer, const size_t size) const {
+    array<char, max_formatted_size> text{};
+    const size_t length = _format_ip(text.data()) - text.data();
+    if (length > size) {
+        throw runtime_error("Address::format_ip: buffer too small");
+    }
+    memcpy(buffer, text.data(), length);
+    return length;
+}
+
+//! \param[in] buffer is where to write the address
+//! \param[in] size is `buffer`'s length (Address::max_formatted_size is always enough)
+//! \returns the number of bytes written
+//! \details An IPv6 address is in brackets, as in "[::1]:53".
+size_t Address::format(char *buffer, const size_t size) const {
+    array<char, max_formatted_size> text{};
+    char *out = text.data();
+    const bool bracket = family() == AF_INET6;
+    if (bracket) {
+        *out++ = '[';
+    }
+    out = _format_ip(out);
+    if (bracket) {
+        *out++ = ']';
+    }
+    *out++ = ':';
+    out = format_decimal(out, port());
+
+    const size_t length = out - text.data();
+    if (length > size) {
+        throw runtime_error("Address::format: buffer too small");
+    }
+    memcpy(buffer, text.data(), length);
+    return length;
+}
+
+// accessors
+string Address::ip() const {
+    array<char, max_formatted_size> text{};
+    return {text.data(), format_ip(text.data(), text.size())};
+}
+
+uint16_t Address::port() const {
+    switch (family()) {
+        case AF_INET:
+            return ntohs(_address.ipv4.sin_port);
+        case AF_INET6:
+            return ntohs(_address.ipv6.sin6_port);
+        default:
+            throw runtime_error("Address: not an IP address (family " + ::to_string(family()) + ")");
+    }
 }
 
+string Address::to_string() const {
+    array<char, max_formatted_size> text{};
+    return {text.data(), format(text.data(), text.size())};
+}
 uint32_t Address::ipv4_numeric() const {
-    if (_address.storage.ss_family != AF_INET or _size != sizeof(sockaddr_in)) {
+    if (family() != AF_INET or _size != sizeof(sockaddr_in)) {
         throw runtime_error("ipv4_numeric called on non-IPV4 address");
     }
 
-    sockaddr_in ipv4_addr{};
-    memcpy(&ipv4_addr, &_address.storage, _size);
-
-    return be32toh(ipv4_addr.sin_addr.s_addr);
+    return be32toh(_address.ipv4.sin_addr.s_addr);
 }
 
 Address Address::from_ipv4_numeric(const uint32_t ip_address) {
@@ -124,11 +335,135 @@ Address Address::from_ipv4_numeric(const uint32_t ip_address) {
     return {reinterpret_cast<sockaddr *>(&ipv4_addr), sizeof(ipv4_addr)};
 }
 
+Address::ipv6_bytes Address::ipv6_numeric() const {
+    if (family() != AF_INET6 or _size != sizeof(sockaddr_in6)) {
+        throw runtime_error("ipv6_numeric called on non-IPV6 address");
+    }
+
+    ipv6_bytes ip_address{};
+    memcpy(ip_address.data(), &_address.ipv6.sin6_addr, ip_address.size());
+    return ip_address;
+}
+
+uint32_t Address::ipv6_scope_id() const {
+    if (family() != AF_INET6 or _size != sizeof(sockaddr_in6)) {
+        throw runtime_error("ipv6_scope_id called on non-IPV6 address");
+    }
+
+    return _address.ipv6.sin6_scope_id;
+}
+
+//! \param[in] ip_address is the address's sixteen bytes, in network order
+//! \param[in] scope_id is the interface index that a link-local address is on (or zero)
+Address Address::from_ipv6_numeric(const ipv6_bytes &ip_address, const uint32_t scope_id) {
+    sockaddr_in6 ipv6_addr{};
+    ipv6_addr.sin6_family = AF_INET6;
+    ipv6_addr.sin6_scope_id = scope_id;
+    memcpy(&ipv6_addr.sin6_addr, ip_address.data(), ip_address.size());
+
+    return {reinterpret_cast<sockaddr *>(&ipv6_addr), sizeof(ipv6_addr)};
+}
+
+bool Address::is_ipv4_mapped() const {
+    return family() == AF_INET6 and _size == sizeof(sockaddr_in6) and IN6_IS_ADDR_V4MAPPED(&_address.ipv6.sin6_addr);
+}
+
+Address Address::ipv4_mapped() const {
+    if (family() != AF_INET or _size != sizeof(sockaddr_in)) {
+        return *this;
+    }
+
+    sockaddr_in6 ipv6_addr{};
+    ipv6_addr.sin6_family = AF_INET6;
+    ipv6_addr.sin6_port = _address.ipv4.sin_port;
+    ipv6_addr.sin6_addr.s6_addr[10] = ipv6_addr.sin6_addr.s6_addr[11] = 0xff;
+    memcpy(&ipv6_addr.sin6_addr.s6_addr[12], &_address.ipv4.sin_addr, sizeof(_address.ipv4.sin_addr));
+
+    return {reinterpret_cast<sockaddr *>(&ipv6_addr), sizeof(ipv6_addr)};
+}
+
+Address Address::unmapped() const {
+    if (not is_ipv4_mapped()) {
+        return *this;
+    }
+
+    sockaddr_in ipv4_addr{};
+    ipv4_addr.sin_family = AF_INET;
+    ipv4_addr.sin_port = _address.ipv6.sin6_port;
+    memcpy(&ipv4_addr.sin_addr, &_address.ipv6.sin6_addr.s6_addr[12], sizeof(ipv4_addr.sin_addr));
+
+    return {reinterpret_cast<sockaddr *>(&ipv4_addr), sizeof(ipv4_addr)};
+}
+
+//! \returns the fields that identify an IP address, in the order they sort by
+//! \details An IPv6 address's flow label isn't part of its identity, and is ignored.
+Address::Key Address::_key() const {
+    Key key{};
+    key.family = family();
+    if (key.family == AF_INET and _size == sizeof(sockaddr_in)) {
+        memcpy(key.address.data(), &_address.ipv4.sin_addr, sizeof(_address.ipv4.sin_addr));
+        key.port = ntohs(_address.ipv4.sin_port);
+    } else if (key.family == AF_INET6 and _size == sizeof(sockaddr_in6)) {
+        memcpy(key.address.data(), &_address.ipv6.sin6_addr, sizeof(_address.ipv6.sin6_addr));
+        key.port = ntohs(_address.ipv6.sin6_port);
+        key.scope = _address.ipv6.sin6_scope_id;
+    } else {
+        key.ip = false;
+    }
+    return key;
+}
+
 // equality
 bool Address::operator==(const Address &other) const {
+    const Key key = _key(), other_key = other._key();
+    if (key.ip and other_key.ip) {
+        return tie(key.family, key.address, key.port, key.scope) ==
+               tie(other_key.family, other_key.address, other_key.port, other_key.scope);
+    }
+
+    // any other kind of address is compared byte by byte
     if (_size != other._size) {
         return false;
     }
 
-    return 0 == memcmp(&_address, &other._address, _size);
+    return 0 == memcmp(_raw(), other._raw(), _size);
+}
+
+//! \details Addresses that aren't IP addresses are ordered by family, then size, then bytes.
+bool Address::operator<(const Address &other) const {
+    const Key key = _key(), other_key = other._key();
+    if (key.ip and other_key.ip) {
+        return tie(key.family, key.address, key.port, key.scope) <
+               tie(other_key.family, other_key.address, other_key.port, other_key.scope);
+    }
+    if (key.family != other_key.family or _size != other._size) {
+        return tie(key.family, _size) < tie(other_key.family, other._size);
+    }
+    return memcmp(_raw(), other._raw(), _size) < 0;
+}
+
+//! \details The fields of an IP address (or the bytes of any other kind) are mixed 64 bits at a time.
+size_t Address::hash() const noexcept {
+    static constexpr uint64_t multiplier = 0x9e3779b97f4a7c15;
+    const auto mix = [](uint64_t state, const uint64_t value) {
+        state = (state ^ value) * multiplier;
+        return state ^ (state >> 32);
+    };
+
+    const Key key = _key();
+    uint64_t state = mix(0, key.family);
+    if (key.ip) {
+        for (size_t i = 0; i < key.address.size(); i += sizeof(uint64_t)) {
+            uint64_t word = 0;
+            memcpy(&word, key.address.data() + i, sizeof(word));
+            state = mix(state, word);
+        }
+        state = mix(state, uint64_t{key.port} << 32 | key.scope);
+    } else {
+        const auto *bytes = reinterpret_cast<const uint8_t *>(_raw());
+        for (size_t i = 0; i < _size; i++) {
+            state = mix(state, bytes[i]);
+        }
+    }
+    return state;
 }
@@ -1,19 +1,22 @@
 #ifndef SPONGE_LIBSPONGE_ADDRESS_HH
 #define SPONGE_LIBSPONGE_ADDRESS_HH
 
+#include <array>
 #include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <string>
 #include <sys/socket.h>
 #include <utility>
 
-//! Wrapper around [IPv4 addresses](@ref man7::ip) and DNS operations.
+//! Wrapper around [IPv4](@ref man7::ip) and [IPv6](@ref man7::ipv6) addresses and DNS operations.
 class Address {
   public:
     //! \brief Wrapper around [sockaddr_storage](@ref man7::socket).
-    //! \details A `sockaddr_storage` is enough space to store any socket address (IPv4 or IPv6).
+    //! \details A `sockaddr_storage` is enough space to store any socket address (IPv4 or IPv6), so it is
+    //! what the kernel writes addresses into (see Socket::local_address).
     class Raw {
       public:
         sockaddr_storage storage{};  //!< The wrapped struct itself.
@@ -21,42 +24,139 @@ class Address {
         operator const sockaddr *() const;
     };
 
+    //! An IPv6 address's sixteen bytes, in network order
+    using ipv6_bytes = std::array<uint8_t, 16>;
+
   private:
-    socklen_t _size;  //!< Size of the wrapped address.
-    Raw _address{};   //!< A wrapped [sockaddr_storage](@ref man7::socket) containing the address.
+    //! An address too large for Storage (e.g., an `AF_UNIX` path), kept on the heap
+    //! \details The pointer is kept as bytes, so that it doesn't make Storage (and Address) 8-byte aligned.
+    struct External {
+        sa_family_t family;                                  //!< Address family (where every other member keeps it)
+        std::array<char, sizeof(sockaddr_storage *)> owner;  //!< The bytes of a pointer to the address (see _heap())
+    };
+
+    //! Room for an IPv4 or IPv6 socket address (or any other that fits), in far less than a `sockaddr_storage`
+    union Storage {
+        sockaddr_in6 ipv6;  //!< An IPv6 address (first, so that value-initialization zeroes all of it)
+        sockaddr_in ipv4;   //!< An IPv4 address
+        sockaddr generic;   //!< Any address (its family says which of the others it is)
+        External external;  //!< Any larger address (see _external())
+    };
+
+    socklen_t _size;     //!< Size of the wrapped address.
+    Storage _address{};  //!< The wrapped address.
+
+    //! Whether the address is too large for Storage, and kept on the heap
+    bool _external() const { return _size > sizeof(Storage); }
+
+    //! The address kept on the heap, if _external()
+    sockaddr_storage *_heap() const;
+
+    //! Keep the address on the heap at `heap`
+    void _set_heap(sockaddr_storage *heap);
+
+    //! The wrapped address, wherever it is kept
+    const sockaddr *_raw() const;
 
     //! Constructor from ip/host, service/port, and hints to the resolver.
     Address(const std::string &node, const std::string &service, const addrinfo &hints);
 
+    //! The fields that operator==, operator<, and hash() use
+    struct Key {
+        bool ip = true;                     //!< Whether this is an IP address (if not, only `family` is set)
+        sa_family_t family = AF_UNSPEC;     //!< Address family
+        ipv6_bytes address{};               //!< IP address, in network order (an IPv4 address is zero-padded)
+        uint16_t port = 0;                  //!< Port (host byte order)
+        uint32_t scope = 0;                 //!< IPv6 scope id
+    };
+
+    //! The fields that identify this address
+    Key _key() const;
+
+    //! Write the IP address (as in ip()) to `out`
+    char *_format_ip(char *out) const;
+
   public:
     //! Construct by resolving a hostname and servicename.
     Address(const std::string &hostname, const std::string &service);
 
-    //! Construct from dotted-quad string ("18.243.0.1") and numeric port.
+    //! Construct by resolving a hostname and servicename to an address of one family (`AF_INET` or `AF_INET6`)
+    Address(const std::string &hostname, const std::string &service, const int family);
+
+    //! Construct from a dotted-quad ("18.243.0.1") or IPv6 ("2001:db8::1") string and numeric port.
     Address(const std::string &ip, const std::uint16_t port = 0);
 
     //! Construct from a [sockaddr *](@ref man7::socket).
     Address(const sockaddr *addr, const std::size_t size);
 
+    //! \name Copying and moving (only an address kept on the heap needs more than copying Storage)
+    //!@{
+    Address(const Address &other);
+    Address(Address &&other) noexcept;
+    Address &operator=(const Address &other);
+    Address &operator=(Address &&other) noexcept;
+    ~Address();
+    //!@}
+
     //! Equality comparison.
     bool operator==(const Address &other) const;
     bool operator!=(const Address &other) const { return not operator==(other); }
 
+    //! \name Ordering, by family, then IP address (as a number), then port
+    //!@{
+    bool operator<(const Address &other) const;
+    bool operator>(const Address &other) const { return other < *this; }
+    bool operator<=(const Address &other) const { return not(other < *this); }
+    bool operator>=(const Address &other) const { return not(*this < other); }
+    //!@}
+
+    //! A hash of the address, consistent with operator== (see also `std::hash<Address>`)
+    size_t hash() const noexcept;
+
     //! \name Conversions
     //!@{
 
     //! Dotted-quad IP address string ("18.243.0.1") and numeric port.
-    std::pair<std::string, uint16_t> ip_port() const;
+    std::pair<std::string, uint16_t> ip_port() const { return {ip(), port()}; }
     //! Dotted-quad IP address string ("18.243.0.1").
-    std::string ip() const { return ip_port().first; }
+    std::string ip() const;
     //! Numeric port (host byte order).
-    uint16_t port() const { return ip_port().second; }
+    uint16_t port() const;
     //! Numeric IP address as an integer (i.e., in [host byte order](\ref man3::byteorder)).
     uint32_t ipv4_numeric() const;
     //! Create an Address from a 32-bit raw numeric IP address
     static Address from_ipv4_numeric(const uint32_t ip_address);
+    //! Numeric IPv6 address, as sixteen bytes in network order
+    ipv6_bytes ipv6_numeric() const;
+    //! Scope (the interface index of a link-local address, or zero) of an IPv6 address
+    uint32_t ipv6_scope_id() const;
+    //! Create an Address from a raw numeric IPv6 address (and scope)
+    static Address from_ipv6_numeric(const ipv6_bytes &ip_address, const uint32_t scope_id = 0);
     //! Human-readable string, e.g., "8.8.8.8:53".
     std::string to_string() const;
+
+    //! The longest text that format() writes: a bracketed IPv6 address with an embedded IPv4 address
+    //! and a scope, then a port
+    static constexpr size_t max_formatted_size = 64;
+
+    //! Write to_string() into `buffer` (of `size` bytes, not NUL-terminated) without allocating; returns the length
+    size_t format(char *buffer, const size_t size) const;
+
+    //! Write ip() into `buffer` (of `size` bytes, not NUL-terminated) without allocating; returns the length
+    size_t format_ip(char *buffer, const size_t size) const;
+    //!@}
+
+    //! \name Families
+    //!@{
+
+    //! Address family: `AF_INET` or `AF_INET6` (the `domain` of a socket that can use this address)
+    int family() const { return _address.generic.sa_family; }
+    //! Whether this is an IPv4 address mapped into IPv6 (::ffff:0:0/96), as a dual-stack socket reports one
+    bool is_ipv4_mapped() const;
+    //! This IPv4 address mapped into IPv6 (for a dual-stack socket); any other address is unchanged
+    Address ipv4_mapped() const;
+    //! The IPv4 address that an IPv4-mapped address stands for; any other address is unchanged
+    Address unmapped() const;
     //!@}
 
     //! \name Low-level operations
@@ -65,7 +165,7 @@ class Address {
     //! Size of the underlying address storage.
     socklen_t size() const { return _size; }
     //! Const pointer to the underlying socket address storage.
-    operator const sockaddr *() const { return _address; }
+    operator const sockaddr *() const { return _raw(); }
     //!@}
 };
 
@@ -81,5 +181,26 @@ class Address {
 //! Once you have an address, you can convert it to other useful representations, e.g.,
 //!
 //! \include address_example_3.cc
+//!
+//! An Address holds an IPv4 or an IPv6 address. A hostname resolves to either (whichever
+//! [getaddrinfo(3)](\ref man3::getaddrinfo) prefers, among the families this host has addresses in), so a
+//! socket for it should be made with family(), e.g., `TCPSocket socket{address.family()}`. An IPv6
+//! socket is dual-stack (see Socket::set_ipv6_only): it reports IPv4 peers as IPv4-mapped addresses, which
+//! unmapped() converts back.
+//!
+//! The conversions to text don't use [getnameinfo(3)](\ref man3::getnameinfo): format() and format_ip()
+//! write into the caller's buffer, so addresses can be logged without allocating. Addresses are hashable
+//! and ordered, so they can key flow tables in `std::unordered_map` or `std::map`.
+//!
+//! An Address made from a `sockaddr` can hold any other kind of socket address, too (e.g., the path of a
+//! LocalStreamSocket). IP addresses are kept inline; anything larger is kept on the heap.
+
+namespace std {
+//! Hashes an Address with Address::hash, so that it can key an unordered container
+template <>
+struct hash<Address> {
+    size_t operator()(const Address &address) const noexcept { return address.hash(); }
+};
+}  // namespace std
 
 #endif  // SPONGE_LIBSPONGE_ADDRESS_HH
@@ -0,0 +1,426 @@
+#ifndef SPONGE_LIBSPONGE_ASYNC_HH
+#define SPONGE_LIBSPONGE_ASYNC_HH
+
+#if __cplusplus < 202002L or not defined(__cpp_impl_coroutine)
+#error "async.hh needs C++20 coroutines; compile with -std=c++20"
+#endif
+
+#include "eventloop.hh"
+#include "socket.hh"
+#include "util.hh"
+
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+template <typename T = void>
+class Task;
+
+//! State shared by the promises of every kind of Task
+class TaskPromiseBase {
+  public:
+    std::coroutine_handle<> continuation{};  //!< The coroutine awaiting this one, if any
+    EventLoop *detached_on = nullptr;        //!< The EventLoop passed to Task::detach(), if detached
+    std::exception_ptr error{};              //!< An exception that escaped the coroutine
+
+    //! Resumes the awaiting coroutine, or frees a detached Task's frame
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+            TaskPromiseBase &promise = handle.promise();
+            if (promise.continuation) {
+                return promise.continuation;
+            }
+            if (promise.detached_on) {
+                handle.destroy();
+            }
+            return std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    //! A Task doesn't run until it is awaited or detached
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() {
+        if (detached_on) {
+            // nothing awaits a detached Task, so raise the exception from EventLoop::wait_next_event
+            detached_on->post([error = std::current_exception()] { std::rethrow_exception(error); });
+        } else {
+            error = std::current_exception();
+        }
+    }
+};
+
+//! The promise of a Task that produces a `T`
+template <typename T>
+class TaskPromise : public TaskPromiseBase {
+  public:
+    std::optional<T> value{};  //!< The value passed to `co_return`
+
+    Task<T> get_return_object();
+
+    template <typename U>
+    void return_value(U &&returned) {
+        value.emplace(std::forward<U>(returned));
+    }
+
+    //! The value returned, or the exception thrown, by the coroutine
+    T result() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*value);
+    }
+};
+
+//! The promise of a Task that produces nothing
+template <>
+class TaskPromise<void> : public TaskPromiseBase {
+  public:
+    Task<void> get_return_object();
+
+    void return_void() {}
+
+    //! Rethrows the exception thrown by the coroutine, if any
+    void result() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+//! \brief A coroutine running on an EventLoop, which eventually produces a `T`
+//! \details A Task starts when it is awaited (by another coroutine) or detached (from ordinary code).
+template <typename T>
+class Task {
+  public:
+    using promise_type = TaskPromise<T>;
+
+  private:
+    std::coroutine_handle<promise_type> _handle;  //!< The coroutine (null if moved from or detached)
+
+  public:
+    explicit Task(const std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+
+    Task(Task &&other) noexcept : _handle(std::exchange(other._handle, {})) {}
+
+    Task &operator=(Task &&other) noexcept {
+        if (this != &other) {
+            if (_handle) {
+                _handle.destroy();
+            }
+            _handle = std::exchange(other._handle, {});
+        }
+        return *this;
+    }
+
+    //! A Task owns its coroutine, so it can't be copied
+
+    //!@{
+    Task(const Task &other) = delete;
+    Task &operator=(const Task &other) = delete;
+    //!@}
+
+    //! Destroys the coroutine, canceling whatever it was awaiting
+    ~Task() {
+        if (_handle) {
+            _handle.destroy();
+        }
+    }
+
+    //! \name Awaiting a Task runs it, and resumes the awaiting coroutine with its result
+
+    //!@{
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(const std::coroutine_handle<> awaiting) noexcept {
+        _handle.promise().continuation = awaiting;
+        return _handle;
+    }
+
+    T await_resume() { return _handle.promise().result(); }
+    //!@}
+
+    //! \brief Run the Task until it first suspends, then leave it to `loop`
+    //! \details The coroutine frees itself when it finishes. An exception that escapes it
+    //! is rethrown from `loop`'s next call to EventLoop::wait_next_event.
+    void detach(EventLoop &loop) {
+        const auto handle = std::exchange(_handle, {});
+        handle.promise().detached_on = &loop;
+        handle.resume();
+    }
+};
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() {
+    return Task<T>{std::coroutine_handle<TaskPromise<T>>::from_promise(*this)};
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() {
+    return Task<void>{std::coroutine_handle<TaskPromise<void>>::from_promise(*this)};
+}
+
+//! Start `task` on `loop` without waiting for it (see Task::detach)
+inline void spawn(EventLoop &loop, Task<void> task) { task.detach(loop); }
+
+//! \brief Suspends a coroutine until a descriptor is ready, retrying an operation each time it is
+//! \details The operation is attempted once before suspending, so a coroutine whose data is already
+//! waiting never goes through the EventLoop. While suspended, the awaiter holds a Rule whose callback
+//! makes the next attempt; the Rule is canceled as soon as the operation completes.
+class DescriptorAwaiter {
+  private:
+    EventLoop &_loop;                    //!< Where the Rule is installed
+    Direction _direction;                //!< The readiness the operation waits for
+    std::coroutine_handle<> _waiting{};  //!< The suspended coroutine
+    EventLoop::RuleHandle _rule{};       //!< Installed while the coroutine is suspended
+    std::exception_ptr _error{};         //!< Thrown by an attempt, or set if the Rule was canceled
+    bool _done = false;                  //!< The operation completed (or failed)
+
+    //! The Rule's callback: attempt the operation, and resume the coroutine if it completed
+    void _on_ready() {
+        try {
+            _done = _attempt();
+        } catch (...) {
+            _error = std::current_exception();
+            _done = true;
+        }
+        if (_done) {
+            _rule.cancel();
+            _waiting.resume();
+        }
+    }
+
+    //! The Rule's cancel callback: if the EventLoop gave up on the descriptor, fail the operation
+    void _on_cancel() {
+        if (not _done) {
+            _done = true;
+            _error = std::make_exception_ptr(std::runtime_error("descriptor was closed while awaiting it"));
+            _waiting.resume();
+        }
+    }
+
+  protected:
+    FileDescriptor &_fd;  //!< The descriptor operated on
+
+    //! Make progress on the operation; returns `true` once it has completed
+    virtual bool _attempt() = 0;
+
+    //! Rethrow the exception the operation failed with, if any
+    void _rethrow_error() const {
+        if (_error) {
+            std::rethrow_exception(_error);
+        }
+    }
+
+  public:
+    DescriptorAwaiter(EventLoop &loop, FileDescriptor &fd, const Direction direction)
+        : _loop(loop), _direction(direction), _fd(fd) {}
+
+    //! The Rule refers to the awaiter, so it can't be copied or moved
+
+    //!@{
+    DescriptorAwaiter(const DescriptorAwaiter &other) = delete;
+    DescriptorAwaiter &operator=(const DescriptorAwaiter &other) = delete;
+    //!@}
+
+    //! Cancels the Rule, if the coroutine is destroyed while suspended
+    virtual ~DescriptorAwaiter() {
+        _done = true;
+        _rule.cancel();
+    }
+
+    bool await_ready() {
+        _done = _attempt();
+        return _done;
+    }
+
+    void await_suspend(const std::coroutine_handle<> waiting) {
+        // an error on the descriptor (say, a reset connection) fails the next attempt, rather than the EventLoop
+        EventLoop::RuleOptions options;
+        options.report_errors = true;
+        _waiting = waiting;
+        _rule = _loop.add_rule(
+            _fd, _direction, [this] { _on_ready(); }, {}, [this] { _on_cancel(); }, options);
+    }
+};
+
+//! Awaits the next chunk of data from a descriptor (see async_read)
+class ReadAwaiter : public DescriptorAwaiter {
+  private:
+    size_t _limit;        //!< The most bytes to read
+    std::string _data{};  //!< The bytes read
+
+    bool _attempt() override { return _fd.try_read(_data, _limit); }
+
+  public:
+    ReadAwaiter(EventLoop &loop, FileDescriptor &fd, const size_t limit)
+        : DescriptorAwaiter(loop, fd, Direction::In), _limit(limit) {}
+
+    std::string await_resume() {
+        _rethrow_error();
+        return std::move(_data);
+    }
+};
+
+//! Awaits writing all of a string to a descriptor (see async_write)
+class WriteAwaiter : public DescriptorAwaiter {
+  private:
+    std::string _data;    //!< The bytes to write
+    size_t _written = 0;  //!< How many have been written so far
+
+    bool _attempt() override {
+        _written += _fd.try_write(std::string_view(_data).substr(_written));
+        return _written == _data.size();
+    }
+
+  public:
+    WriteAwaiter(EventLoop &loop, FileDescriptor &fd, std::string &&data)
+        : DescriptorAwaiter(loop, fd, Direction::Out), _data(std::move(data)) {}
+
+    void await_resume() const { _rethrow_error(); }
+};
+
+//! Awaits a connection to a peer (see async_connect)
+class ConnectAwaiter : public DescriptorAwaiter {
+  private:
+    Socket &_socket;        //!< The socket to connect
+    Address _address;       //!< The peer
+    bool _started = false;  //!< Socket::start_connect has been called
+
+    bool _attempt() override {
+        if (not _started) {
+            _started = true;
+            return _socket.start_connect(_address);
+        }
+
+        // the socket is writable, so the connection attempt has finished; find out how
+        _socket.finish_connect();
+        return true;
+    }
+
+  public:
+    ConnectAwaiter(EventLoop &loop, Socket &socket, const Address &address)
+        : DescriptorAwaiter(loop, socket, Direction::Out), _socket(socket), _address(address) {}
+
+    void await_resume() const { _rethrow_error(); }
+};
+
+//! Awaits an incoming connection (see async_accept)
+class AcceptAwaiter : public DescriptorAwaiter {
+  private:
+    TCPSocket &_listener;                //!< The listening socket
+    std::vector<TCPSocket> _accepted{};  //!< The new connection
+
+    bool _attempt() override { return _listener.accept_batch(_accepted, 1) == 1; }
+
+  public:
+    AcceptAwaiter(EventLoop &loop, TCPSocket &listener)
+        : DescriptorAwaiter(loop, listener, Direction::In), _listener(listener) {}
+
+    TCPSocket await_resume() {
+        _rethrow_error();
+        return std::move(_accepted.back());
+    }
+};
+
+//! Awaits the passing of time (see sleep_for)
+class SleepAwaiter {
+  private:
+    EventLoop &_loop;                 //!< Where the timer is added
+    uint64_t _duration_ms;            //!< How long to sleep
+    EventLoop::TimerHandle _timer{};  //!< Pending while the coroutine is suspended
+
+  public:
+    SleepAwaiter(EventLoop &loop, const uint64_t duration_ms) : _loop(loop), _duration_ms(duration_ms) {}
+
+    //! The timer refers to the suspended coroutine, so the awaiter can't be copied or moved
+
+    //!@{
+    SleepAwaiter(const SleepAwaiter &other) = delete;
+    SleepAwaiter &operator=(const SleepAwaiter &other) = delete;
+    //!@}
+
+    //! Cancels the timer, if the coroutine is destroyed while suspended
+    ~SleepAwaiter() { _timer.cancel(); }
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(const std::coroutine_handle<> waiting) {
+        _timer = _loop.add_timer(timestamp_ms() + _duration_ms, [waiting] { waiting.resume(); });
+    }
+
+    void await_resume() const noexcept {}
+};
+
+//! \name Awaitable operations
+//! The descriptors passed to these must be non-blocking (see FileDescriptor::set_blocking),
+//! and must outlive the `co_await`.
+
+//!@{
+
+//! Read up to `limit` bytes; an empty result means EOF (see FileDescriptor::eof)
+inline ReadAwaiter async_read(EventLoop &loop, FileDescriptor &fd, const size_t limit = 65536) {
+    return {loop, fd, limit};
+}
+
+//! Write all of `data`, however many times the descriptor must become writable again
+inline WriteAwaiter async_write(EventLoop &loop, FileDescriptor &fd, std::string data) {
+    return {loop, fd, std::move(data)};
+}
+
+//! Connect `socket` to `address`; throws unix_error if the connection fails
+inline ConnectAwaiter async_connect(EventLoop &loop, Socket &socket, const Address &address) {
+    return {loop, socket, address};
+}
+
+//! Accept a connection on a listening socket; the new connection is non-blocking
+inline AcceptAwaiter async_accept(EventLoop &loop, TCPSocket &listener) { return {loop, listener}; }
+
+//! Suspend the coroutine for `duration_ms` milliseconds
+inline SleepAwaiter sleep_for(EventLoop &loop, const uint64_t duration_ms) { return {loop, duration_ms}; }
+
+//!@}
+
+//! \file async.hh
+//! C++20 coroutines on top of EventLoop. A coroutine returning a Task can `co_await` the operations
+//! above, or another Task, and reads as straight-line code: each `co_await` that can't complete at
+//! once installs a one-shot Rule (or timer) and suspends, and the EventLoop resumes the coroutine
+//! when the descriptor is ready. Thousands of such sessions can share one thread and one EventLoop,
+//! and since adding and canceling a Rule doesn't allocate, a suspension costs only the Rule's
+//! bookkeeping and one readiness notification.
+//!
+//! A suspended Task refers to its EventLoop, so it must be destroyed (or have finished) before the
+//! EventLoop is. The rest of libsponge is C++17; only translation units built with `-std=c++20` can include this
+//! header. A minimal echo server:
+//!
+//! ~~~{.cpp}
+//! Task<> echo(EventLoop &loop, TCPSocket connection) {
+//!     while (true) {
+//!         std::string data = co_await async_read(loop, connection);
+//!         if (data.empty()) {
+//!             co_return;
+//!         }
+//!         co_await async_write(loop, connection, std::move(data));
+//!     }
+//! }
+//!
+//! Task<> serve(EventLoop &loop, TCPSocket &listener) {
+//!     while (true) {
+//!         spawn(loop, echo(loop, co_await async_accept(loop, listener)));
+//!     }
+//! }
+//! ~~~
+
+#endif  // SPONGE_LIBSPONGE_ASYNC_HH
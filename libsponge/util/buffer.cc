@@ -1,5 +1,9 @@
 #include "buffer.hh"
 
+#include "util.hh"
+
+#include <stdexcept>
+
 using namespace std;
 
 void Buffer::remove_prefix(const size_t n) {
@@ -7,11 +11,57 @@ void Buffer::remove_prefix(const size_t n) {
         throw out_of_range("Buffer::remove_prefix");
     }
     _starting_offset += n;
-    if (_storage and _starting_offset == _storage->size()) {
+    if (_storage and _starting_offset == _ending_offset) {
         _storage.reset();
     }
 }
 
+shared_ptr<string> BufferPool::_take() {
+    // look for a string that no Buffer refers to any more, starting after the last one handed out (strings
+    // tend to be released in the order they were handed out, so if the next few are busy, the rest likely are)
+    const size_t tries = min<size_t>(_storage.size(), 16);
+    for (size_t i = 0; i < tries; i++) {
+        auto &storage = _storage[_next];
+        _next = _next + 1 == _storage.size() ? 0 : _next + 1;
+        if (storage.use_count() == 1) {
+            return storage;
+        }
+    }
+
+    if (_storage.size() == _max_strings) {
+        return make_shared<string>();
+    }
+    _storage.push_back(make_shared<string>());
+    return _storage.back();
+}
+
+//! \param[in] data is copied into the Buffer's storage
+Buffer BufferPool::make(const string_view data) {
+    shared_ptr<string> storage = _take();
+    storage->assign(data);
+    return {move(storage), data.size()};
+}
+
+//! \param[in] size is the least number of bytes the storage must hold
+//! \details The string is only ever grown, so once the pool has warmed up, acquiring storage of a
+//! steady size neither allocates nor initializes it.
+shared_ptr<string> BufferPool::acquire(const size_t size) {
+    shared_ptr<string> storage = _take();
+    if (storage->size() < size) {
+        storage->resize(size);
+    }
+    return storage;
+}
+
+//! \param[in] storage is the storage, from acquire(), whose first `size` bytes have been filled in
+//! \param[in] size is the number of bytes the Buffer holds (the rest of the storage is ignored)
+Buffer BufferPool::make(shared_ptr<string> storage, const size_t size) {
+    if (size > storage->size()) {
+        throw out_of_range("BufferPool::make");
+    }
+    return {move(storage), size};
+}
+
 void BufferList::append(const BufferList &other) {
     for (const auto &buf : other._buffers) {
         _buffers.push_back(buf);
@@ -40,6 +90,25 @@ string BufferList::concatenate() const {
     return ret;
 }
 
+//! \param[in,out] checksum has the bytes added to it (after whatever it has already summed)
+//! \details A segment boundary may fall anywhere, even between the two bytes of a checksummed word.
+string BufferList::concatenate(InternetChecksum &checksum) const {
+    std::string ret(size(), '\0');
+    copy_and_checksum(ret.data(), checksum);
+    return ret;
+}
+
+//! \param[out] destination is where to copy the bytes
+//! \param[in,out] checksum has the bytes added to it (after whatever it has already summed)
+size_t BufferList::copy_and_checksum(char *destination, InternetChecksum &checksum) const {
+    size_t copied = 0;
+    for (const auto &buf : _buffers) {
+        checksum.copy_and_add(destination + copied, buf);
+        copied += buf.size();
+    }
+    return copied;
+}
+
 size_t BufferList::size() const {
     size_t ret = 0;
     for (const auto &buf : _buffers) {
@@ -94,6 +163,17 @@ size_t BufferViewList::size() const {
     return ret;
 }
 
+//! \param[out] destination is where to copy the bytes
+//! \param[in,out] checksum has the bytes added to it (after whatever it has already summed)
+size_t BufferViewList::copy_and_checksum(char *destination, InternetChecksum &checksum) const {
+    size_t copied = 0;
+    for (const auto &view : _views) {
+        checksum.copy_and_add(destination + copied, view);
+        copied += view.size();
+    }
+    return copied;
+}
+
 vector<iovec> BufferViewList::as_iovecs() const {
     vector<iovec> ret;
     ret.reserve(_views.size());
@@ -10,17 +10,27 @@
 #include <sys/uio.h>
 #include <vector>
 
+class InternetChecksum;
+
 //! \brief A reference-counted read-only string that can discard bytes from the front
 class Buffer {
   private:
+    friend class BufferPool;
+
     std::shared_ptr<std::string> _storage{};
     size_t _starting_offset{};
+    size_t _ending_offset{};  //!< Where the Buffer's bytes end in _storage (a pooled string may be longer)
+
+    //! \brief Construct by sharing the first `size` bytes of a BufferPool's string
+    Buffer(std::shared_ptr<std::string> storage, const size_t size) noexcept
+        : _storage(std::move(storage)), _ending_offset(size) {}
 
   public:
     Buffer() = default;
 
     //! \brief Construct by taking ownership of a string
-    Buffer(std::string &&str) noexcept : _storage(std::make_shared<std::string>(std::move(str))) {}
+    Buffer(std::string &&str) noexcept
+        : _storage(std::make_shared<std::string>(std::move(str))), _ending_offset(_storage->size()) {}
 
     //! \name Expose contents as a std::string_view
     //!@{
@@ -28,7 +38,7 @@ class Buffer {
         if (not _storage) {
             return {};
         }
-        return {_storage->data() + _starting_offset, _storage->size() - _starting_offset};
+        return {_storage->data() + _starting_offset, _ending_offset - _starting_offset};
     }
 
     operator std::string_view() const { return str(); }
@@ -48,6 +58,37 @@ class Buffer {
     void remove_prefix(const size_t n);
 };
 
+//! \brief Hands out Buffers whose storage is recycled once every copy of them has been destroyed
+//! \details A string is reused (keeping its capacity) when the pool holds the only reference to it,
+//! so a steady stream of similar Buffers stops allocating once the pool has warmed up.
+//! \note Not thread-safe: the pool, and every Buffer it hands out, must stay on one thread.
+class BufferPool {
+  private:
+    std::vector<std::shared_ptr<std::string>> _storage{};  //!< Every string the pool has kept
+    size_t _max_strings;                                   //!< The most strings to keep
+    size_t _next = 0;                                      //!< Where to start looking for a free string
+
+    //! A string no Buffer refers to, or a new one (kept if the pool isn't full)
+    std::shared_ptr<std::string> _take();
+
+  public:
+    //! \param[in] max_strings is the most strings to keep; beyond that, Buffers are allocated as usual
+    explicit BufferPool(const size_t max_strings = 4096) : _max_strings(max_strings) {}
+
+    //! \brief A Buffer holding a copy of `data`, in recycled storage if any is free
+    Buffer make(std::string_view data);
+
+    //! \brief Writable storage of at least `size` bytes, recycled if any is free, to fill in place and
+    //! then hand out with make(std::shared_ptr<std::string>, size_t)
+    std::shared_ptr<std::string> acquire(const size_t size);
+
+    //! \brief A Buffer holding the first `size` bytes of `storage` (from acquire()), without a copy
+    Buffer make(std::shared_ptr<std::string> storage, const size_t size);
+
+    //! \brief How many strings the pool holds (in use or free)
+    size_t size() const { return _storage.size(); }
+};
+
 //! \brief A reference-counted discontiguous string that can discard bytes from the front
 //! \note Used to model packets that contain multiple sets of headers
 //! + a payload. This allows us to prepend headers (e.g., to
@@ -91,6 +132,13 @@ class BufferList {
 
     //! \brief Make a copy to a new std::string
     std::string concatenate() const;
+
+    //! \brief Make a copy to a new std::string, adding it to `checksum` in the same pass
+    std::string concatenate(InternetChecksum &checksum) const;
+
+    //! \brief Copy to `destination` (with room for size() bytes), adding it to `checksum` in the same pass
+    //! \returns the number of bytes copied
+    size_t copy_and_checksum(char *destination, InternetChecksum &checksum) const;
 };
 
 //! \brief A non-owning temporary view (similar to std::string_view) of a discontiguous string
@@ -124,6 +172,10 @@ class BufferViewList {
     //! \note used for system calls that write discontiguous buffers,
     //! e.g. [writev(2)](\ref man2::writev) and [sendmsg(2)](\ref man2::sendmsg)
     std::vector<iovec> as_iovecs() const;
+
+    //! \brief Copy to `destination` (with room for size() bytes), adding it to `checksum` in the same pass
+    //! \returns the number of bytes copied
+    size_t copy_and_checksum(char *destination, InternetChecksum &checksum) const;
 };
 
 #endif  // SPONGE_LIBSPONGE_BUFFER_HH
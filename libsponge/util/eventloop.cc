@@ -2,16 +2,136 @@
 
 #include "util.hh"
 
+#include <algorithm>
 #include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
 #include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <system_error>
+#include <unistd.h>
 #include <utility>
 #include <vector>
 
 using namespace std;
 
+//! The name of `direction` in stats and log messages
+static const char *direction_name(const EventLoop::Direction direction) {
+    switch (direction) {
+        case EventLoop::Direction::In:
+            return "in";
+        case EventLoop::Direction::Out:
+            return "out";
+        case EventLoop::Direction::Error:
+            return "error";
+    }
+    return "unknown";
+}
+
 unsigned int EventLoop::Rule::service_count() const {
-    return direction == Direction::In ? fd.read_count() : fd.write_count();
+    return direction == Direction::Out ? fd.write_count() : fd.read_count();
+}
+
+//! \param[in] backend selects [epoll(7)](\ref man7::epoll) (the default) or [poll(2)](\ref man2::poll)
+EventLoop::EventLoop(const Backend backend)
+    : _backend(backend)
+    , _state_log_position(FileDescriptor::state_log_position())
+    , _timers(timestamp_ms())
+    , _wakeup_fd(SystemCall("eventfd", ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))) {
+    if (_backend == Backend::Epoll) {
+        _epoll_fd.emplace(SystemCall("epoll_create1", ::epoll_create1(EPOLL_CLOEXEC)));
+    }
+    sigemptyset(&_signals);
+    sigemptyset(&_blocked_signals);
+
+    // reset the eventfd before taking the tasks, so a post that races with us is never missed
+    RuleOptions wakeup_options;
+    wakeup_options.priority = Priority::High;
+    _add_rule(
+        _wakeup_fd,
+        Direction::In,
+        [&] {
+            _wakeup_fd.read(sizeof(uint64_t));
+            _run_posted();
+        },
+        {},
+        {},
+        wakeup_options,
+        true);
+}
+
+EventLoop::~EventLoop() {
+    if (not sigisemptyset(&_blocked_signals)) {
+        pthread_sigmask(SIG_UNBLOCK, &_blocked_signals, nullptr);
+    }
+}
+
+EventLoop::Rule *EventLoop::RuleHandle::_rule() const {
+    if (not _loop or _index >= _loop->_slots_used) {
+        return nullptr;
+    }
+    auto &slot = _loop->_slot(_index);
+    return slot.rule and slot.generation == _generation ? &*slot.rule : nullptr;
+}
+
+bool EventLoop::RuleHandle::cancel() {
+    Rule *rule = _rule();
+    if (not rule) {
+        return false;
+    }
+    _loop->_cancel_rule(rule);
+    return true;
+}
+
+void EventLoop::RuleHandle::pause() {
+    if (Rule *rule = _rule()) {
+        rule->paused = true;
+        _loop->_set_polled(*rule, false);
+    }
+}
+
+//! \details A Rule with an `interest` callback is polled again once the callback next returns `true`.
+void EventLoop::RuleHandle::resume() {
+    if (Rule *rule = _rule(); rule and rule->paused) {
+        rule->paused = false;
+        if (not rule->interest) {
+            _loop->_set_polled(*rule, true);
+        }
+        if (rule->options.edge_triggered) {
+            // the descriptor may have become ready while paused, and an edge won't be reported again
+            _loop->_requeue(rule);
+        }
+    }
+}
+
+//! \param[in] direction is Direction::In to poll for reading, or Direction::Out to poll for writing
+void EventLoop::RuleHandle::set_direction(const Direction direction) {
+    Rule *rule = _rule();
+    if (rule and rule->direction != direction) {
+        rule->direction = direction;
+        if (rule->polled) {
+            _loop->_mark_dirty(rule->fd.fd_num());
+        }
+        if (rule->options.edge_triggered) {
+            _loop->_requeue(rule);
+        }
+    }
+}
+
+bool EventLoop::RuleHandle::paused() const {
+    const Rule *rule = _rule();
+    return rule and rule->paused;
+}
+
+EventLoop::RuleStats EventLoop::RuleHandle::stats() const {
+    const Rule *rule = _rule();
+    return rule ? rule->stats : RuleStats{};
 }
 
 //! \param[in] fd is the FileDescriptor to be polled
@@ -19,13 +139,476 @@ unsigned int EventLoop::Rule::service_count() const {
 //! \param[in] callback is called when `fd` is ready.
 //! \param[in] interest is called by EventLoop::wait_next_event. If it returns `true`, `fd` will
 //!                     be polled, otherwise `fd` will be ignored only for this execution of `wait_next_event.
-//! \param[in] cancel is called when the rule is cancelled (e.g. on hangup, EOF, or closure).
-void EventLoop::add_rule(const FileDescriptor &fd,
-                         const Direction direction,
-                         const CallbackT &callback,
-                         const InterestT &interest,
-                         const CallbackT &cancel) {
-    _rules.push_back({fd.duplicate(), direction, callback, interest, cancel});
+//!                     If `interest` is empty, `fd` is polled whenever the Rule is not paused.
+//! \param[in] cancel is called when the rule is cancelled (e.g. on hangup, EOF, or closure), if not empty.
+//! \returns a RuleHandle that can pause, resume, redirect, or cancel the Rule
+EventLoop::RuleHandle EventLoop::add_rule(const FileDescriptor &fd,
+                                          const Direction direction,
+                                          CallbackT callback,
+                                          InterestT interest,
+                                          CallbackT cancel) {
+    return _add_rule(fd, direction, move(callback), move(interest), move(cancel), {}, false);
+}
+
+//! \param[in] options selects edge triggering and budgets (see RuleOptions)
+//! \details The other parameters are as for the other overload of add_rule().
+EventLoop::RuleHandle EventLoop::add_rule(const FileDescriptor &fd,
+                                          const Direction direction,
+                                          CallbackT callback,
+                                          InterestT interest,
+                                          CallbackT cancel,
+                                          const RuleOptions &options) {
+    return _add_rule(fd, direction, move(callback), move(interest), move(cancel), options, false);
+}
+
+//! \param[in] internal is `true` for a Rule that should not by itself keep the EventLoop running
+//! \details The other parameters are as for add_rule().
+EventLoop::RuleHandle EventLoop::_add_rule(const FileDescriptor &fd,
+                                           const Direction direction,
+                                           CallbackT callback,
+                                           InterestT interest,
+                                           CallbackT cancel,
+                                           const RuleOptions &options,
+                                           const bool internal) {
+    uint32_t index = 0;
+    if (not _free_slots.empty()) {
+        index = _free_slots.back();
+        _free_slots.pop_back();
+    } else {
+        if (_slots_used == _rule_chunks.size() * RULE_CHUNK_SIZE) {
+            _rule_chunks.push_back(make_unique<RuleChunk>());
+        }
+        index = _slots_used++;
+    }
+
+    auto &slot = _slot(index);
+    slot.rule.emplace(Rule{fd.duplicate(), direction, move(callback), move(interest), move(cancel)});
+    Rule *rule = &*slot.rule;
+    rule->index = index;
+    rule->internal = internal;
+    rule->options = options;
+    _rule_count++;
+
+    if (rule->interest) {
+        rule->interest_pos = _interest_rules.size();
+        _interest_rules.push_back(rule);
+    }
+
+    if (_backend == Backend::Epoll) {
+        const auto fd_num = static_cast<size_t>(fd.fd_num());
+        if (fd_num >= _registrations.size()) {
+            _registrations.resize(fd_num + 1);
+        }
+        _registrations[fd_num].rules.push_back(rule);
+    }
+
+    // a Rule with an interest callback is evaluated on each wait; any other is polled from the start
+    if (not rule->interest) {
+        _set_polled(*rule, true);
+    }
+
+    return {*this, index, slot.generation};
+}
+
+//! \param[in] deadline_ms is the time (in the units of timestamp_ms()) at which to call `callback`
+//! \param[in] callback is called once, from within wait_next_event
+//! \returns a TimerHandle that can be used to cancel the timer
+EventLoop::TimerHandle EventLoop::add_timer(const uint64_t deadline_ms, CallbackT callback) {
+    return {_timers, _timers.schedule(deadline_ms, move(callback))};
+}
+
+//! \param[in] interval_ms is the time between calls to `callback`; must be positive
+//! \param[in] callback is called repeatedly, from within wait_next_event, until canceled
+//! \returns a TimerHandle that can be used to cancel the timer
+EventLoop::TimerHandle EventLoop::add_periodic(const uint64_t interval_ms, CallbackT callback) {
+    if (interval_ms == 0) {
+        throw runtime_error("EventLoop::add_periodic: interval must be positive");
+    }
+    return {_timers, _timers.schedule(timestamp_ms() + interval_ms, move(callback), interval_ms)};
+}
+
+//! \param[in] task is called once, from within wait_next_event, after any tasks posted before it
+//! \details Only the post that finds the queue empty signals the eventfd; later posts in the same
+//! batch are picked up by the same wakeup.
+void EventLoop::post(CallbackT task) {
+    if (_posted.push(move(task))) {
+        const uint64_t one = 1;
+        SystemCall("write", ::write(_wakeup_fd.fd_num(), &one, sizeof(one)));
+    }
+}
+
+//! \param[in] timeout_ms is the caller's timeout (negative means no timeout)
+//! \returns the smaller of `timeout_ms` and the time until the next timer expires
+int EventLoop::_timeout_for_timers(const int timeout_ms) const {
+    const auto next_expiry = _timers.next_expiry();
+    if (not next_expiry) {
+        return timeout_ms;
+    }
+
+    const uint64_t now = timestamp_ms();
+    const uint64_t until_expiry = *next_expiry > now ? *next_expiry - now : 0;
+    if (timeout_ms >= 0 and uint64_t(timeout_ms) <= until_expiry) {
+        return timeout_ms;
+    }
+    return static_cast<int>(min<uint64_t>(until_expiry, numeric_limits<int>::max()));
+}
+
+//! \param[in] rule is the Rule to update
+//! \param[in] polled is the new value of Rule::polled
+void EventLoop::_set_polled(Rule &rule, const bool polled) {
+    if (rule.polled == polled) {
+        return;
+    }
+
+    rule.polled = polled;
+    // internal rules don't count toward keeping the loop running
+    if (polled and not rule.internal) {
+        _polled_count++;
+    } else if (not rule.internal) {
+        _polled_count--;
+    }
+    _mark_dirty(rule.fd.fd_num());
+}
+
+//! \param[in] fd_num is the descriptor whose Registration has changed
+void EventLoop::_mark_dirty(const int fd_num) {
+    if (_backend != Backend::Epoll) {
+        return;
+    }
+
+    auto &registration = _registrations.at(fd_num);
+    if (not registration.dirty) {
+        registration.dirty = true;
+        _dirty.push_back(fd_num);
+    }
+}
+
+//! \param[in] fd_num is a descriptor that reported an error
+//! \details With Backend::Poll, this looks through the Rules being polled by the current wait.
+bool EventLoop::_has_error_rule(const int fd_num) const {
+    const auto is_error_rule = [&](const Rule *rule) {
+        return rule->fd.fd_num() == fd_num and rule->direction == Direction::Error and not rule->canceled;
+    };
+    if (_backend == Backend::Epoll) {
+        const auto &rules = _registrations[fd_num].rules;
+        return any_of(rules.begin(), rules.end(), is_error_rule);
+    }
+    return any_of(_polled_rules.begin(), _polled_rules.end(), is_error_rule);
+}
+
+//! \param[in] rule is the Rule being canceled
+//! \details The Rule stays in its slot (and Registration) until _erase_canceled(), so that it is safe
+//! to cancel a Rule from within any callback, including its own.
+void EventLoop::_cancel_rule(Rule *rule) {
+    if (rule->canceled) {
+        return;
+    }
+
+    _set_polled(*rule, false);
+    rule->canceled = true;
+    _canceled.push_back(rule);
+    _slot(rule->index).generation++;
+
+    if (rule->cancel) {
+        rule->cancel();
+    }
+}
+
+//! \details If a canceled Rule was the last on its descriptor, the descriptor is also removed from the
+//! epoll instance. (This is attempted even if the descriptor has been closed: the kernel only drops it once
+//! every duplicate of it is closed, too, and a Rule's own descriptor stays open until the Rule is destroyed
+//! here.) Each Rule is destroyed, and its slot returned to the free list.
+void EventLoop::_erase_canceled() {
+    if (_canceled.empty()) {
+        return;
+    }
+
+    const auto is_canceled = [](const Rule *rule) { return rule->canceled; };
+    _requeued.erase(remove_if(_requeued.begin(), _requeued.end(), is_canceled), _requeued.end());
+
+    for (const auto &rule : _canceled) {
+        if (_backend == Backend::Epoll) {
+            const int fd_num = rule->fd.fd_num();
+            auto &registration = _registrations[fd_num];
+            registration.rules.erase(find(registration.rules.begin(), registration.rules.end(), rule));
+
+            if (rule->fd.closed() and registration.registered and not registration.rules.empty()) {
+                // the descriptor number may be reused; start over with a fresh registration
+                registration.registered = false;
+                registration.events = 0;
+                _mark_dirty(fd_num);
+            }
+
+            if (registration.rules.empty() and registration.registered) {
+                // (a closed descriptor's number is either free or belongs to a file that isn't registered)
+                const int ret = ::epoll_ctl(_epoll_fd->fd_num(), EPOLL_CTL_DEL, fd_num, nullptr);
+                if (ret < 0 and errno != ENOENT and errno != EBADF) {
+                    throw unix_error("epoll_ctl");
+                }
+                registration.registered = false;
+                registration.events = 0;
+            }
+
+            if (registration.rules.empty() and registration.always_ready) {
+                registration.always_ready = false;
+                _always_ready.erase(find(_always_ready.begin(), _always_ready.end(), fd_num));
+            }
+        }
+
+        if (rule->interest) {
+            // move the last Rule in _interest_rules into this one's place
+            Rule *last = _interest_rules.back();
+            last->interest_pos = rule->interest_pos;
+            _interest_rules[rule->interest_pos] = last;
+            _interest_rules.pop_back();
+        }
+
+        _free_slots.push_back(rule->index);
+        _rule_count--;
+        _slot(rule->index).rule.reset();
+    }
+    _canceled.clear();
+}
+
+//! \details Only the descriptors in FileDescriptor's close/EOF log are examined, unless the log has
+//! overflowed since the last wait.
+void EventLoop::_cancel_finished_rules() {
+    const auto check_descriptor = [&](const int fd_num) {
+        if (fd_num < 0 or static_cast<size_t>(fd_num) >= _registrations.size()) {
+            return;
+        }
+        // NOTE: cancel callbacks may add rules, so index afresh on each pass
+        for (size_t j = 0; j < _registrations[fd_num].rules.size(); j++) {
+            Rule *rule = _registrations[fd_num].rules[j];
+            if (not rule->canceled and rule->finished()) {
+                _cancel_rule(rule);
+            }
+        }
+    };
+
+    if (not FileDescriptor::read_state_log(_state_log_position, check_descriptor)) {
+        for (size_t fd_num = 0; fd_num < _registrations.size(); fd_num++) {
+            check_descriptor(fd_num);
+        }
+    }
+}
+
+//! \param[in] rule is the Rule whose callback should be called
+void EventLoop::_run_callback(Rule &rule) {
+    if (not _instrumented) {
+        rule.callback();
+        return;
+    }
+
+    const uint64_t start = timestamp_ns();
+    rule.callback();
+    const uint64_t duration = timestamp_ns() - start;
+
+    _iteration_callback_ns += duration;
+    rule.stats.calls++;
+    rule.stats.total_ns += duration;
+    rule.stats.max_ns = max(rule.stats.max_ns, duration);
+
+    if (_slow_callback_ns and duration >= _slow_callback_ns) {
+        _stats.slow_callbacks++;
+        _on_slow_callback({rule.fd.fd_num(), rule.direction, duration});
+    }
+}
+
+size_t EventLoop::_advance_timers() {
+    if (not _instrumented) {
+        return _timers.advance(timestamp_ms());
+    }
+
+    const uint64_t start = timestamp_ns();
+    const size_t fired = _timers.advance(timestamp_ms());
+    if (fired) {
+        _iteration_callback_ns += timestamp_ns() - start;
+    }
+    return fired;
+}
+
+//! \param[in] wait_start_ns is when the wait began (as measured by timestamp_ns())
+void EventLoop::_note_wakeup(const uint64_t wait_start_ns) {
+    if (_instrumented) {
+        _wake_ns = timestamp_ns();
+        _stats.poll_ns.record(_wake_ns - wait_start_ns);
+    }
+}
+
+//! \param[in] rule is a Rule whose descriptor is ready in Rule::direction
+void EventLoop::_dispatch(Rule *rule) {
+    // a requeued Rule may also be reported ready by the kernel; run it only once per wait
+    if (rule->dispatched_in == _iteration) {
+        return;
+    }
+    rule->dispatched_in = _iteration;
+
+    if (_instrumented) {
+        _iteration_ready++;
+        _stats.lag_ns.record(timestamp_ns() - _wake_ns);
+    }
+
+    if (rule->options.edge_triggered) {
+        _dispatch_edge_triggered(rule);
+        return;
+    }
+
+    // we only want to call callback if revents includes the event we asked for
+    const auto direction_before = rule->direction;
+    const auto count_before = rule->service_count();
+    _run_callback(*rule);
+
+    if (rule->canceled) {
+        return;  // the callback canceled its own Rule
+    }
+
+    if (rule->finished()) {
+        // no more reading on this rule (it's reached eof), or the fd has been closed
+        _cancel_rule(rule);
+        return;
+    }
+
+    // only check for busy wait if we're not canceling or exiting
+    if (rule->direction == direction_before and count_before == rule->service_count() and rule->interested()) {
+        throw runtime_error("EventLoop: busy wait detected: callback did not read/write fd and is still interested");
+    }
+}
+
+//! \param[in] rule is an edge-triggered Rule whose descriptor is ready in Rule::direction
+void EventLoop::_dispatch_edge_triggered(Rule *rule) {
+    const FileDescriptor &fd = rule->fd;
+    const auto direction = rule->direction;
+    const auto bytes_moved = [&] { return direction == Direction::Out ? fd.bytes_written() : fd.bytes_read(); };
+    const uint64_t eagain_before = fd.eagain_count();
+    const uint64_t short_writes_before = fd.short_write_count();
+    const uint64_t bytes_before = bytes_moved();
+
+    for (unsigned calls = 1;; calls++) {
+        const auto count_before = rule->service_count();
+        _run_callback(*rule);
+
+        if (rule->canceled) {
+            return;  // the callback canceled its own Rule
+        }
+
+        if (rule->finished()) {
+            // no more reading on this rule (it's reached eof), or the fd has been closed
+            _cancel_rule(rule);
+            return;
+        }
+
+        // stop if the callback paused or redirected the Rule, or didn't touch fd (it will be
+        // dispatched again on the next edge, or when resumed or redirected)
+        if (rule->direction != direction or count_before == rule->service_count() or not rule->interested()) {
+            return;
+        }
+
+        // stop once fd is drained: the kernel will report the next edge
+        const bool drained = fd.eagain_count() != eagain_before
+                             or (direction == Direction::Out and fd.short_write_count() != short_writes_before);
+        if (drained) {
+            return;
+        }
+
+        // stop if the budget is spent, and continue on the next wait
+        const auto &options = rule->options;
+        if ((options.call_budget and calls >= options.call_budget)
+            or (options.byte_budget and bytes_moved() - bytes_before >= options.byte_budget)) {
+            _requeue(rule);
+            return;
+        }
+    }
+}
+
+//! \param[in] rule is an edge-triggered Rule that may still have work to do
+void EventLoop::_requeue(Rule *rule) {
+    if (not rule->requeued and not rule->canceled) {
+        rule->requeued = true;
+        _requeued.push_back(rule);
+    }
+}
+
+//! \details Called once the kernel has been asked which descriptors are ready, so that Rules requeued
+//! from now on (e.g. because they spend their budget again) wait for the next call.
+void EventLoop::_take_requeued() {
+    // (these are only non-empty if a callback threw during the last dispatch)
+    _requeue_batch.clear();
+    for (auto &bucket : _ready_rules) {
+        bucket.clear();
+    }
+
+    _requeue_batch.swap(_requeued);
+    for (const auto &rule : _requeue_batch) {
+        rule->requeued = false;
+    }
+}
+
+//! \param[in] rule is a Rule watching a descriptor that the kernel reported
+//! \param[in] revents is the set of events reported
+//! \param[in] hangup is whether a hangup was reported
+//! \details A Rule that has been passed over by the dispatch limit often enough goes ahead of every
+//! Priority; otherwise it goes in the bucket for its RuleOptions::priority.
+void EventLoop::_add_ready(Rule *rule, const uint32_t revents, const bool hangup) {
+    const bool promoted = _dispatch_limit and _promote_after and rule->deferrals >= _promote_after;
+    const size_t bucket = promoted ? 0 : 1 + static_cast<size_t>(rule->options.priority);
+    _ready_rules[bucket].push_back({rule, revents, hangup});
+}
+
+void EventLoop::_add_requeued() {
+    for (const auto &rule : _requeue_batch) {
+        if (rule->polled) {
+            _add_ready(rule, static_cast<uint32_t>(rule->direction), false);
+        }
+    }
+    _requeue_batch.clear();
+}
+
+void EventLoop::_dispatch_ready() {
+    size_t dispatched = 0;
+    for (auto &bucket : _ready_rules) {
+        for (const auto &ready : bucket) {
+            // a callback earlier in this pass may have paused, redirected, or canceled this rule
+            Rule *rule = ready.rule;
+            const uint32_t events = rule->polled ? static_cast<uint32_t>(rule->direction) : 0;
+            const auto poll_ready = static_cast<bool>(ready.revents & events);
+            if (ready.hangup and events and not poll_ready) {
+                // if we asked for the status, and the _only_ condition was a hangup, this FD is defunct:
+                //   - if it was POLLIN and nothing is readable, no more will ever be readable
+                //   - if it was POLLOUT, it will not be writable again
+                _cancel_rule(rule);
+                continue;
+            }
+
+            // (a requeued Rule may also have been reported ready by the kernel)
+            if (not poll_ready or rule->dispatched_in == _iteration) {
+                continue;
+            }
+
+            if (_dispatch_limit and dispatched == _dispatch_limit) {
+                _defer(rule);
+                continue;
+            }
+
+            dispatched++;
+            rule->deferrals = 0;
+            _dispatch(rule);
+        }
+        bucket.clear();
+    }
+}
+
+//! \param[in] rule is a ready Rule that will not be dispatched in this wait
+//! \details A level-triggered descriptor will be reported ready again by the kernel, but an edge-triggered
+//! one will not, so an edge-triggered Rule is requeued.
+void EventLoop::_defer(Rule *rule) {
+    rule->deferrals++;
+    if (_instrumented) {
+        _stats.deferred++;
+    }
+    if (rule->options.edge_triggered) {
+        _requeue(rule);
+    }
 }
 
 //! \param[in] timeout_ms is the timeout value passed to [poll(2)](\ref man2::poll); `wait_next_event`
@@ -45,101 +628,549 @@ void EventLoop::add_rule(const FileDescriptor &fd,
 //!
 //! If an error occurs during polling, this function throws a std::runtime_error.
 //!
-//! If a [signal(7)](\ref man7::signal) was caught during polling or if EventLoop::_rules becomes empty,
-//! this function returns Result::Exit.
+//! If every Rule has been canceled (or is uninterested) and no timer is outstanding, this function
+//! returns Result::Exit. A [signal(7)](\ref man7::signal) caught by a handler during polling does not end
+//! the wait early with Result::Exit; it counts as a wakeup with no ready descriptors (see add_signal_handler()).
+//!
+//! The wait is cut short when a timer is due. After any ready Rule callbacks have run, the callback
+//! of every expired timer is called.
 //!
-//! If a timeout occurred while polling (i.e., no fd became ready), this function returns Result::Timeout.
+//! If a timeout occurred while polling (i.e., no fd became ready and no timer expired), this function
+//! returns Result::Timeout.
 //!
 //! Otherwise, this function returns Result::Success.
 //!
+//! With Backend::Epoll, Rule::interest is still called for every Rule that has one, but Rule objects
+//! managed through a RuleHandle are only examined when paused, resumed, redirected, or canceled (or
+//! when their descriptor is ready, closed, or at EOF). The kernel is only updated for descriptors
+//! whose combined interest changed, and only Rule objects on ready descriptors are examined after waiting.
+//!
 //! \b IMPORTANT: every call to Rule::callback must read from or write to Rule::fd, or the `interest`
-//! callback must stop returning true after the callback completes.
+//! callback must stop returning true (or the Rule must be paused, redirected, or canceled) after the
+//! callback completes.
 //! If none of these conditions occur, EventLoop::wait_next_event will throw std::runtime_error. This is
 //! because [poll(2)](\ref man2::poll) is level triggered, so failing to act on a ready file descriptor
 //! will result in a busy loop (poll returns on a ready file descriptor; file descriptor is not read or
 //! written, so it is still ready; the next call to poll will immediately return).
 EventLoop::Result EventLoop::wait_next_event(const int timeout_ms) {
-    vector<pollfd> pollfds{};
-    pollfds.reserve(_rules.size());
-    bool something_to_poll = false;
-
-    // set up the pollfd for each rule
-    for (auto it = _rules.cbegin(); it != _rules.cend();) {  // NOTE: it gets erased or incremented in loop body
-        const auto &this_rule = *it;
-        if (this_rule.direction == Direction::In && this_rule.fd.eof()) {
-            // no more reading on this rule, it's reached eof
-            this_rule.cancel();
-            it = _rules.erase(it);
+    if (not _instrumented) {
+        return _backend == Backend::Epoll ? _wait_epoll(timeout_ms) : _wait_poll(timeout_ms);
+    }
+
+    _iteration_callback_ns = 0;
+    _iteration_ready = 0;
+    const Result result = _backend == Backend::Epoll ? _wait_epoll(timeout_ms) : _wait_poll(timeout_ms);
+    _stats.iterations++;
+    _stats.callback_ns.record(_iteration_callback_ns);
+    _stats.ready.record(_iteration_ready);
+    return result;
+}
+
+EventLoop::Result EventLoop::_wait_poll(const int timeout_ms) {
+    _iteration++;
+    _pollfds.clear();
+    _polled_rules.clear();
+
+    // cancel finished rules and evaluate the interest of the rest
+    // NOTE: cancel callbacks may add rules, so compare against _slots_used afresh on each pass
+    for (uint32_t index = 0; index < _slots_used; index++) {
+        auto &slot = _slot(index);
+        if (not slot.rule or slot.rule->canceled) {
             continue;
         }
 
-        if (this_rule.fd.closed()) {
-            this_rule.cancel();
-            it = _rules.erase(it);
+        Rule &this_rule = *slot.rule;
+        if (this_rule.finished()) {
+            // no more reading on this rule (it's reached eof), or the fd has been closed
+            _cancel_rule(&this_rule);
             continue;
         }
 
-        if (this_rule.interest()) {
-            pollfds.push_back({this_rule.fd.fd_num(), static_cast<short>(this_rule.direction), 0});
-            something_to_poll = true;
-        } else {
-            pollfds.push_back({this_rule.fd.fd_num(), 0, 0});  // placeholder --- we still want errors
+        _set_polled(this_rule, this_rule.interested());
+    }
+    _erase_canceled();
+
+    // set up the pollfd for each rule that is left
+    // (only once the canceled rules are gone, since a cancel callback may cancel a rule seen earlier in the pass)
+    for (uint32_t index = 0; index < _slots_used; index++) {
+        auto &slot = _slot(index);
+        if (not slot.rule) {
+            continue;
         }
-        ++it;
+
+        Rule &this_rule = *slot.rule;
+        // if not polled, this is a placeholder --- we still want errors
+        const short events = this_rule.polled ? static_cast<short>(this_rule.direction) : 0;
+        _pollfds.push_back({this_rule.fd.fd_num(), events, 0});
+        _polled_rules.push_back(&this_rule);
     }
 
-    // quit if there is nothing left to poll
-    if (not something_to_poll) {
+    // quit if there is nothing left to poll, no timer to wait for, and no posted task to run
+    if (_polled_count == 0 and not _have_timers() and _posted.empty()) {
         return Result::Exit;
     }
 
     // call poll -- wait until one of the fds satisfies one of the rules (writeable/readable)
-    try {
-        if (0 == SystemCall("poll", ::poll(pollfds.data(), pollfds.size(), timeout_ms))) {
-            return Result::Timeout;
+    // don't block if a requeued rule still has work to do
+    const int poll_timeout = _requeued.empty() ? _timeout_for_timers(timeout_ms) : 0;
+    // a signal that interrupts the wait is treated as a wakeup with nothing ready
+    const uint64_t wait_start = _instrumented ? timestamp_ns() : 0;
+    const int ready_count = max(0, SystemCall("poll", ::poll(_pollfds.data(), _pollfds.size(), poll_timeout), EINTR));
+    _note_wakeup(wait_start);
+
+    _take_requeued();
+    if (ready_count == 0 and _requeue_batch.empty()) {
+        return _advance_timers() ? Result::Success : Result::Timeout;
+    }
+
+    // go through the poll results, then dispatch the ready rules in priority order
+
+    for (size_t idx = 0; idx < _polled_rules.size(); idx++) {
+        const auto &this_pollfd = _pollfds[idx];
+
+        Rule *rule = _polled_rules[idx];
+        auto revents = this_pollfd.revents;
+        if ((revents & POLLERR) and not rule->reports_errors()) {
+            if (not _has_error_rule(this_pollfd.fd)) {
+                throw runtime_error("EventLoop: error on polled file descriptor");
+            }
+            revents &= ~POLLERR;  // (left to the descriptor's Direction::Error Rule)
         }
-    } catch (unix_error const &e) {
-        if (e.code().value() == EINTR) {
-            return Result::Exit;
+        if (revents & POLLNVAL) {
+            throw runtime_error("EventLoop: error on polled file descriptor");
+        }
+
+        if (revents & POLLERR) {
+            // the callback finds the error with its next read or write (or SO_ERROR)
+            _add_ready(rule, revents | POLLIN | POLLOUT, false);
+        } else if (revents) {
+            const auto poll_hup = static_cast<bool>(revents & POLLHUP);
+            _add_ready(rule, static_cast<uint16_t>(revents), poll_hup);
         }
     }
+    _add_requeued();
+    _dispatch_ready();
+    _erase_canceled();
 
-    // go through the poll results
+    _advance_timers();
 
-    for (auto [it, idx] = make_pair(_rules.begin(), size_t(0)); it != _rules.end(); ++idx) {
-        const auto &this_pollfd = pollfds[idx];
+    return Result::Success;
+}
 
-        const auto poll_error = static_cast<bool>(this_pollfd.revents & (POLLERR | POLLNVAL));
-        if (poll_error) {
-            throw runtime_error("EventLoop: error on polled file descriptor");
+//! \param[in] fd_num is the descriptor whose Registration::wanted events should be installed
+void EventLoop::_update_registration(const int fd_num) {
+    auto &registration = _registrations[fd_num];
+    if (registration.always_ready or (registration.registered and registration.events == registration.wanted)) {
+        return;
+    }
+
+    epoll_event event{};
+    event.events = registration.wanted;
+    event.data.fd = fd_num;
+
+    // the descriptor number may have been closed and reused behind our back, so fall back
+    // from MOD to ADD (or from ADD to MOD) if the kernel disagrees about whether it is registered
+    const int first_op = registration.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    int ret = ::epoll_ctl(_epoll_fd->fd_num(), first_op, fd_num, &event);
+    if (ret < 0 and first_op == EPOLL_CTL_MOD and errno == ENOENT) {
+        ret = ::epoll_ctl(_epoll_fd->fd_num(), EPOLL_CTL_ADD, fd_num, &event);
+    } else if (ret < 0 and first_op == EPOLL_CTL_ADD and errno == EEXIST) {
+        ret = ::epoll_ctl(_epoll_fd->fd_num(), EPOLL_CTL_MOD, fd_num, &event);
+    }
+
+    if (ret < 0 and errno == EPERM) {
+        // epoll does not support this kind of file (e.g., a regular file); poll(2) would always
+        // report it ready, so do the same
+        registration.always_ready = true;
+        _always_ready.push_back(fd_num);
+        return;
+    }
+
+    SystemCall("epoll_ctl", ret);
+    registration.registered = true;
+    registration.events = registration.wanted;
+}
+
+EventLoop::Result EventLoop::_wait_epoll(const int timeout_ms) {
+    _iteration++;
+
+    // cancel rules whose descriptors were closed or reached EOF outside of their callbacks
+    _cancel_finished_rules();
+
+    // evaluate the interest of each rule that has an interest callback
+    // NOTE: cancel callbacks may add rules, so index afresh on each pass
+    for (size_t i = 0; i < _interest_rules.size(); i++) {
+        Rule &this_rule = *_interest_rules[i];
+        if (this_rule.canceled) {
+            continue;
         }
 
-        const auto &this_rule = *it;
-        const auto poll_ready = static_cast<bool>(this_pollfd.revents & this_pollfd.events);
-        const auto poll_hup = static_cast<bool>(this_pollfd.revents & POLLHUP);
-        if (poll_hup && this_pollfd.events && !poll_ready) {
-            // if we asked for the status, and the _only_ condition was a hangup, this FD is defunct:
-            //   - if it was POLLIN and nothing is readable, no more will ever be readable
-            //   - if it was POLLOUT, it will not be writable again
-            this_rule.cancel();
-            it = _rules.erase(it);
+        if (this_rule.finished()) {
+            // no more reading on this rule (it's reached eof), or the fd has been closed
+            _cancel_rule(&this_rule);
             continue;
         }
 
-        if (poll_ready) {
-            // we only want to call callback if revents includes the event we asked for
-            const auto count_before = this_rule.service_count();
-            this_rule.callback();
+        _set_polled(this_rule, this_rule.interested());
+    }
+
+    // rules that were just added, resumed, or redirected might already be finished
+    // NOTE: cancel callbacks may add rules (growing _dirty), so index afresh on each pass
+    for (size_t i = 0; i < _dirty.size(); i++) {
+        const int fd_num = _dirty[i];
+        for (size_t j = 0; j < _registrations[fd_num].rules.size(); j++) {
+            Rule *rule = _registrations[fd_num].rules[j];
+            if (not rule->canceled and rule->finished()) {
+                _cancel_rule(rule);
+            }
+        }
+    }
+    _erase_canceled();
+
+    // quit if there is nothing left to poll, no timer to wait for, and no posted task to run
+    if (_polled_count == 0 and not _have_timers() and _posted.empty()) {
+        return Result::Exit;
+    }
 
-            // only check for busy wait if we're not canceling or exiting
-            if (count_before == this_rule.service_count() and this_rule.interest()) {
-                throw runtime_error(
-                    "EventLoop: busy wait detected: callback did not read/write fd and is still interested");
+    // recompute the events wanted on each changed descriptor, and tell the kernel
+    // (descriptors with no polled rules stay registered for errors)
+    for (const int fd_num : _dirty) {
+        auto &registration = _registrations[fd_num];
+        registration.dirty = false;
+        registration.wanted = 0;
+        bool edge_triggered = true;
+        for (const auto &rule : registration.rules) {
+            if (rule->polled) {
+                registration.wanted |= static_cast<uint32_t>(rule->direction);
+                edge_triggered = edge_triggered and rule->options.edge_triggered;
             }
         }
+        if (registration.wanted and edge_triggered) {
+            registration.wanted |= EPOLLET;
+        }
+        if (not registration.rules.empty()) {
+            _update_registration(fd_num);
+        }
+    }
+    _dirty.clear();
+
+    // descriptors that epoll refused are always ready, so don't block if any of them is wanted
+    // (and don't block if a requeued rule still has work to do)
+    const bool have_always_ready = any_of(
+        _always_ready.begin(), _always_ready.end(), [&](const int fd_num) { return _registrations[fd_num].wanted; });
+    const bool dont_block = have_always_ready or not _requeued.empty();
+
+    // call epoll_wait -- wait until one of the fds satisfies one of the rules (writeable/readable)
+    _ready_events.resize(max<size_t>(1, min<size_t>(_rule_count, 1024)));
+    // (a signal that interrupts the wait is treated as a wakeup with nothing ready)
+    const uint64_t wait_start = _instrumented ? timestamp_ns() : 0;
+    const int ready_count = max(0,
+                                SystemCall("epoll_wait",
+                                           ::epoll_wait(_epoll_fd->fd_num(),
+                                                        _ready_events.data(),
+                                                        _ready_events.size(),
+                                                        dont_block ? 0 : _timeout_for_timers(timeout_ms)),
+                                           EINTR));
+    _note_wakeup(wait_start);
+    _ready_events.resize(ready_count);
 
-        ++it;  // if we got here, it means we didn't call _rules.erase()
+    for (const int fd_num : _always_ready) {
+        if (_registrations[fd_num].wanted) {
+            epoll_event event{};
+            event.events = _registrations[fd_num].wanted & ~uint32_t(EPOLLET);
+            event.data.fd = fd_num;
+            _ready_events.push_back(event);
+        }
+    }
+
+    _take_requeued();
+    if (_ready_events.empty() and _requeue_batch.empty()) {
+        return _advance_timers() ? Result::Success : Result::Timeout;
     }
 
+    // go through the ready descriptors, then dispatch the ready rules in priority order
+    // (every rule on a ready descriptor is considered; _dispatch_ready checks its direction)
+
+    for (const auto &ready_event : _ready_events) {
+        const int fd_num = ready_event.data.fd;
+        const uint32_t revents = ready_event.events;
+
+        const auto poll_error = static_cast<bool>(revents & EPOLLERR);
+        const auto poll_hup = static_cast<bool>(revents & EPOLLHUP);
+        const bool error_handled = poll_error and _has_error_rule(fd_num);
+        for (const auto &rule : _registrations[fd_num].rules) {
+            if (not poll_error) {
+                _add_ready(rule, revents, poll_hup);
+            } else if (rule->reports_errors()) {
+                _add_ready(rule, revents | EPOLLIN | EPOLLOUT, false);
+            } else if (error_handled) {
+                // (left to the descriptor's Direction::Error Rule)
+                _add_ready(rule, revents & ~uint32_t(EPOLLERR), poll_hup);
+            } else {
+                throw runtime_error("EventLoop: error on polled file descriptor");
+            }
+        }
+    }
+    _add_requeued();
+    _dispatch_ready();
+    _erase_canceled();
+
+    _advance_timers();
+
     return Result::Success;
 }
+
+//! \param[in] limit is the most Rules to dispatch in one wait, or zero for no limit
+//! \param[in] promote_after is how many waits in a row a ready Rule may be passed over before it is
+//!                          dispatched ahead of every Priority, or zero to dispatch strictly by Priority
+//! \details Rules that are passed over stay ready: a level-triggered descriptor is reported again by the
+//! kernel, and an edge-triggered Rule is requeued. Timers and posted tasks are not limited (but posted
+//! tasks run from a Rule with Priority::High, so they count toward the limit).
+void EventLoop::set_dispatch_limit(const size_t limit, const unsigned promote_after) {
+    _dispatch_limit = limit;
+    _promote_after = promote_after;
+}
+
+//! \param[in] signum is the signal to handle (not `SIGKILL` or `SIGSTOP`)
+//! \param[in] callback is called, from within wait_next_event, each time the signal is delivered
+//! \details The signal is blocked in the calling thread, which should be the thread that runs the EventLoop,
+//! and read from a [signalfd(2)](\ref man2::signalfd) instead. A signal sent to the whole process (e.g. by
+//! [kill(1)](\ref man1::kill)) must also be blocked in every other thread, or another thread may receive
+//! it; adding the handler before starting any other thread does this, since new threads inherit the
+//! signal mask. The signalfd is watched by an internal Rule with Priority::High, which does not keep
+//! the EventLoop running by itself.
+void EventLoop::add_signal_handler(const int signum, SignalCallbackT callback) {
+    if (signum <= 0 or signum >= NSIG or signum == SIGKILL or signum == SIGSTOP) {
+        throw runtime_error("EventLoop::add_signal_handler: invalid signal " + to_string(signum));
+    }
+
+    _on_signal.resize(NSIG);
+    _on_signal[signum] = move(callback);
+    if (sigismember(&_signals, signum)) {
+        return;
+    }
+
+    sigset_t signal_set, previous;
+    sigemptyset(&signal_set);
+    sigaddset(&signal_set, signum);
+    if (const int error = pthread_sigmask(SIG_BLOCK, &signal_set, &previous)) {
+        throw unix_error("pthread_sigmask", error);
+    }
+    if (not sigismember(&previous, signum)) {
+        sigaddset(&_blocked_signals, signum);
+    }
+    sigaddset(&_signals, signum);
+
+    if (_signal_fd) {
+        SystemCall("signalfd", ::signalfd(_signal_fd->fd_num(), &_signals, 0));
+        return;
+    }
+
+    _signal_fd.emplace(SystemCall("signalfd", ::signalfd(-1, &_signals, SFD_NONBLOCK | SFD_CLOEXEC)));
+    RuleOptions options;
+    options.priority = Priority::High;
+    _add_rule(
+        *_signal_fd, Direction::In, [this] { _read_signals(); }, {}, {}, options, true);
+}
+
+//! \param[in] signum is a signal passed to add_signal_handler()
+//! \details If the signal is pending, unblocking it delivers it with its current disposition.
+void EventLoop::remove_signal_handler(const int signum) {
+    if (signum <= 0 or signum >= NSIG or not sigismember(&_signals, signum)) {
+        return;
+    }
+
+    sigdelset(&_signals, signum);
+    _on_signal[signum] = nullptr;
+    SystemCall("signalfd", ::signalfd(_signal_fd->fd_num(), &_signals, 0));
+
+    if (sigismember(&_blocked_signals, signum)) {
+        sigdelset(&_blocked_signals, signum);
+        sigset_t signal_set;
+        sigemptyset(&signal_set);
+        sigaddset(&signal_set, signum);
+        if (const int error = pthread_sigmask(SIG_UNBLOCK, &signal_set, nullptr)) {
+            throw unix_error("pthread_sigmask", error);
+        }
+    }
+}
+
+//! \details The wakeup has already been consumed, so if a task throws, the eventfd is signaled again
+//! for the tasks still queued behind it.
+void EventLoop::_run_posted() {
+    try {
+        _posted.run_all();
+    } catch (...) {
+        if (not _posted.empty()) {
+            const uint64_t one = 1;
+            SystemCall("write", ::write(_wakeup_fd.fd_num(), &one, sizeof(one)));
+        }
+        throw;
+    }
+}
+
+//! \details Each handler is moved out of EventLoop::_on_signal while it runs, so that it may remove or
+//! replace itself. The signalfd is non-blocking, so a signal taken by someone else first (e.g. with
+//! [sigwaitinfo(2)](\ref man2::sigwaitinfo)) is not an error.
+void EventLoop::_read_signals() {
+    string data;
+    if (not _signal_fd->try_read(data, sizeof(signalfd_siginfo) * 16)) {
+        return;
+    }
+
+    for (size_t offset = 0; offset + sizeof(signalfd_siginfo) <= data.size(); offset += sizeof(signalfd_siginfo)) {
+        signalfd_siginfo info{};
+        memcpy(&info, data.data() + offset, sizeof(info));
+        const auto signum = info.ssi_signo;
+        if (signum >= _on_signal.size() or not _on_signal[signum]) {
+            continue;  // removed by an earlier handler in this batch
+        }
+
+        SignalCallbackT handler = move(_on_signal[signum]);
+        handler(info);
+        if (sigismember(&_signals, signum) and not _on_signal[signum]) {
+            _on_signal[signum] = move(handler);
+        }
+    }
+}
+
+//! \param[in] pid is a child of the calling process
+//! \param[in] callback is called, from within wait_next_event, with the child's exit status as reported
+//!                     by [waitid(2)](\ref man2::waitid)
+//! \returns a RuleHandle for the Rule watching the child; canceling it leaves the child to be reaped by the caller
+//! \details The child is watched through a [pidfd](\ref man2::pidfd_open), so no `SIGCHLD` handler is needed,
+//! and other children are left alone. The Rule has Priority::High, and keeps the EventLoop running
+//! until the child exits.
+EventLoop::RuleHandle EventLoop::add_child(const pid_t pid, ChildCallbackT callback) {
+    // (through syscall(2), since not every C library declares pidfd_open for C++)
+    FileDescriptor pidfd{SystemCall("pidfd_open", static_cast<int>(::syscall(SYS_pidfd_open, pid, 0)))};
+    RuleOptions options;
+    options.priority = Priority::High;
+    return _add_rule(
+        pidfd,
+        Direction::In,
+        [pidfd = pidfd.duplicate(), callback = move(callback)]() mutable {
+            siginfo_t info{};
+            SystemCall("waitid", ::waitid(P_PIDFD, pidfd.fd_num(), &info, WEXITED));
+            pidfd.close();  // the child is gone, so the Rule is finished
+            callback(info);
+        },
+        {},
+        {},
+        options,
+        false);
+}
+
+//! \param[in] socket is the socket to connect; it is made non-blocking
+//! \param[in] address is the peer
+//! \param[in] callback is called from within wait_next_event once the attempt has finished, however it went;
+//!                     Socket::finish_connect tells whether the socket is connected (or throws the error)
+//! \details The Rule watches a [dup(2)](\ref man2::dup) of `socket`, so other Rules can watch `socket` itself.
+//! The Rule reports errors (see RuleOptions::report_errors), since a refused connection is an error on the
+//! descriptor. Once the attempt has finished, the Rule cancels itself; the dup is closed when the Rule is
+//! destroyed, after it has been removed from the epoll instance. (Closing the dup any sooner would leave it
+//! registered, since `socket` shares its open file description, and the loop would spin on it.)
+EventLoop::RuleHandle EventLoop::add_connect(Socket &socket, const Address &address, CallbackT callback) {
+    socket.set_blocking(false);
+    socket.start_connect(address);  // (a socket that connects at once is writable at once, too)
+
+    FileDescriptor connecting{SystemCall("fcntl", ::fcntl(socket.fd_num(), F_DUPFD_CLOEXEC, 0))};
+    RuleOptions options;
+    options.report_errors = true;
+    auto handle = make_shared<RuleHandle>();
+    *handle = _add_rule(
+        connecting,
+        Direction::Out,
+        [handle, callback = move(callback)] {
+            handle->cancel();  // the attempt is over, so the Rule is finished
+            callback();
+        },
+        {},
+        {},
+        options,
+        false);
+    return *handle;
+}
+
+//! \param[in] sender is the ZeroCopySender whose completions to process; it must outlive the Rule
+//! \details The Rule watches the sender's socket with Direction::Error while any payload is pinned, and
+//! calls ZeroCopySender::process_completions when the socket's error queue has messages. Other Rules
+//! can watch the socket as usual: its error queue does not count as an error on their behalf.
+EventLoop::RuleHandle EventLoop::add_zerocopy(ZeroCopySender &sender) {
+    return _add_rule(
+        sender.socket(),
+        Direction::Error,
+        [&sender] { sender.process_completions(); },
+        [&sender] { return sender.pending() > 0; },
+        {},
+        {},
+        false);
+}
+
+//! \param[in] enabled is whether to collect instrumentation from now on
+//! \details Stats already collected are kept; see reset_stats().
+void EventLoop::set_instrumentation(const bool enabled) {
+    _instrumented = enabled;
+    _wake_ns = timestamp_ns();  // in case this is called from a callback
+}
+
+void EventLoop::reset_stats() {
+    _stats.iterations = 0;
+    _stats.slow_callbacks = 0;
+    _stats.poll_ns.reset();
+    _stats.callback_ns.reset();
+    _stats.ready.reset();
+    _stats.lag_ns.reset();
+    _stats.deferred = 0;
+    for (uint32_t index = 0; index < _slots_used; index++) {
+        if (auto &slot = _slot(index); slot.rule) {
+            slot.rule->stats = {};
+        }
+    }
+}
+
+//! \returns a JSON object with the Stats, and an array of RuleStats for the Rules still installed
+string EventLoop::stats_json() const {
+    ostringstream ss;
+    ss << "{\"iterations\":" << _stats.iterations << ",\"slow_callbacks\":" << _stats.slow_callbacks
+       << ",\"poll\":" << _stats.poll_ns.to_json() << ",\"callbacks\":" << _stats.callback_ns.to_json()
+       << ",\"ready\":" << _stats.ready.to_json("rules") << ",\"lag\":" << _stats.lag_ns.to_json()
+       << ",\"deferred\":" << _stats.deferred << ",\"rules\":[";
+
+    bool first = true;
+    for (uint32_t index = 0; index < _slots_used; index++) {
+        const auto &slot = _slot(index);
+        if (not slot.rule or slot.rule->canceled) {
+            continue;
+        }
+        const Rule &rule = *slot.rule;
+        ss << (first ? "" : ",") << "{\"fd\":" << rule.fd.fd_num() << ",\"direction\":\""
+           << direction_name(rule.direction) << "\",\"internal\":" << boolalpha << rule.internal
+           << ",\"calls\":" << rule.stats.calls << ",\"total_ns\":" << rule.stats.total_ns
+           << ",\"max_ns\":" << rule.stats.max_ns << "}";
+        first = false;
+    }
+
+    ss << "]}";
+    return ss.str();
+}
+
+//! \param[in] threshold_ns is the shortest callback duration to report, or zero to stop reporting
+//! \param[in] handler is called with each slow callback; if empty, slow callbacks are logged to std::cerr
+//! \details Slow callbacks are only detected while instrumentation is enabled.
+void EventLoop::set_slow_callback_threshold(const uint64_t threshold_ns, const SlowCallbackT &handler) {
+    _slow_callback_ns = threshold_ns;
+    _on_slow_callback = handler ? handler : [](const SlowCallback &slow) {
+        cerr << "EventLoop: slow callback on fd " << slow.fd << " ("
+             << direction_name(slow.direction) << "): " << slow.duration_ns << " ns\n";
+    };
+}
+
+//! \param[in] interval_ms is the time between calls
+//! \param[in] callback is called from within wait_next_event, and may use stats() or stats_json()
+void EventLoop::set_stats_callback(const uint64_t interval_ms, const StatsCallbackT &callback) {
+    _stats_timer.cancel();
+    if (interval_ms > 0 and callback) {
+        _stats_timer = add_periodic(interval_ms, [this, callback] { callback(*this); });
+    }
+}
@@ -2,75 +2,539 @@
 #define SPONGE_LIBSPONGE_EVENTLOOP_HH
 
 #include "file_descriptor.hh"
+#include "inline_function.hh"
+#include "socket.hh"
+#include "stats.hh"
+#include "task_queue.hh"
+#include "timer_wheel.hh"
 
+#include <array>
+#include <cstdint>
 #include <cstdlib>
 #include <functional>
-#include <list>
+#include <memory>
+#include <optional>
 #include <poll.h>
+#include <signal.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/types.h>
+#include <vector>
 
 //! Waits for events on file descriptors and executes corresponding callbacks.
 class EventLoop {
+  private:
+    class Rule;
+
   public:
-    //! Indicates interest in reading (In) or writing (Out) a polled fd.
+    //! Indicates interest in reading (In) or writing (Out) a polled fd, or in its errors (Error).
     enum class Direction : short {
-        In = POLLIN,   //!< Callback will be triggered when Rule::fd is readable.
-        Out = POLLOUT  //!< Callback will be triggered when Rule::fd is writable.
+        In = POLLIN,     //!< Callback will be triggered when Rule::fd is readable.
+        Out = POLLOUT,   //!< Callback will be triggered when Rule::fd is writable.
+        Error = POLLERR  //!< Callback will be triggered when Rule::fd has an error (or a socket's error queue does).
+    };
+
+    //! Selects the kernel interface used to wait for ready file descriptors.
+    enum class Backend {
+        Poll,  //!< Build a [poll(2)](\ref man2::poll) set from every Rule on each call to wait_next_event.
+        Epoll  //!< Keep registrations in an [epoll(7)](\ref man7::epoll) instance; dispatch only ready Rules.
+    };
+
+    //! Returned by each call to EventLoop::wait_next_event.
+    enum class Result {
+        Success,  //!< At least one Rule or timer was triggered.
+        Timeout,  //!< No rules or timers were triggered before timeout.
+        Exit  //!< All rules have been canceled or were uninterested; make no further calls to EventLoop::wait_next_event.
+    };
+
+    //! Order in which Rules that are ready in the same wait are dispatched (see RuleOptions::priority)
+    enum class Priority : uint8_t {
+        High,    //!< Control plane: listeners, signals, and admin or health-check sockets.
+        Normal,  //!< The default.
+        Low      //!< Bulk transfers that should yield to everything else.
+    };
+
+    //! Optional settings for a Rule added with EventLoop::add_rule()
+    struct RuleOptions {
+        bool edge_triggered = false;           //!< Call the callback repeatedly until the descriptor is drained
+        size_t byte_budget = 0;                //!< Edge-triggered: most bytes read or written per wait (0 for no limit)
+        unsigned call_budget = 64;             //!< Edge-triggered: most callback calls per wait (0 for no limit)
+        Priority priority = Priority::Normal;  //!< Rules with a higher Priority are dispatched first
+        bool report_errors = false;            //!< Dispatch an error on the descriptor instead of throwing
+    };
+
+    //! Time spent in one Rule's callback while instrumentation is enabled (see RuleHandle::stats())
+    struct RuleStats {
+        uint64_t calls = 0;     //!< Calls timed
+        uint64_t total_ns = 0;  //!< Total time in the callback
+        uint64_t max_ns = 0;    //!< Longest single call
+    };
+
+    //! Instrumentation collected while enabled with EventLoop::set_instrumentation()
+    struct Stats {
+        uint64_t iterations = 0;         //!< Calls to wait_next_event
+        uint64_t slow_callbacks = 0;     //!< Rule callbacks that reached the slow-callback threshold
+        LatencyHistogram poll_ns{};      //!< Time blocked in poll(2) or epoll_wait(2), per call
+        LatencyHistogram callback_ns{};  //!< Time in callbacks (rules, timers, and posted tasks), per call
+        LatencyHistogram ready{};        //!< Rules dispatched per call (a count, not a duration)
+        LatencyHistogram lag_ns{};       //!< Delay from the wait returning to each dispatched Rule's callback
+        uint64_t deferred = 0;           //!< Ready Rules left for a later wait by the dispatch limit
+    };
+
+    //! Describes a callback that reached the slow-callback threshold
+    struct SlowCallback {
+        int fd;                //!< The Rule's descriptor number
+        Direction direction;   //!< The Rule's direction
+        uint64_t duration_ns;  //!< How long the callback took
+    };
+
+    using SlowCallbackT = std::function<void(const SlowCallback &)>;         //!< Called for each slow callback
+    using StatsCallbackT = std::function<void(const EventLoop &)>;           //!< Called periodically with the EventLoop
+    using SignalCallbackT = InlineFunction<void(const signalfd_siginfo &)>;  //!< Called for each signal delivered
+    using ChildCallbackT = std::function<void(const siginfo_t &)>;           //!< Called when a child process exits
+
+    //! \brief Refers to a timer created by EventLoop::add_timer() or EventLoop::add_periodic().
+    //! \details A TimerHandle must not be used after its EventLoop has been destroyed.
+    class TimerHandle {
+      private:
+        TimerWheel *_timers = nullptr;  //!< The EventLoop's timers
+        TimerWheel::TimerId _id{};      //!< The timer within EventLoop::_timers
+
+      public:
+        //! A handle that refers to no timer
+        TimerHandle() = default;
+
+        //! Construct from a timer in an EventLoop's TimerWheel
+        TimerHandle(TimerWheel &timers, const TimerWheel::TimerId id) : _timers(&timers), _id(id) {}
+
+        //! Cancel the timer; returns `false` if it had already fired (one-shot) or been canceled
+        bool cancel() { return _timers and _timers->cancel(_id); }
+
+        //! Whether the timer is still scheduled
+        bool pending() const { return _timers and _timers->pending(_id); }
+    };
+
+    //! \brief Refers to a Rule created by EventLoop::add_rule().
+    //! \details Every operation is O(1). A RuleHandle goes stale once its Rule has been canceled
+    //! (by the handle or by the EventLoop); operations on a stale handle do nothing. A RuleHandle
+    //! must not be used after its EventLoop has been destroyed.
+    class RuleHandle {
+      private:
+        EventLoop *_loop = nullptr;  //!< The EventLoop holding the Rule
+        uint32_t _index = 0;         //!< The Rule's slot in EventLoop::_rule_chunks
+        uint32_t _generation = 0;    //!< Value of RuleSlot::generation when the Rule was added
+
+        //! The Rule, if it has not been canceled
+        Rule *_rule() const;
+
+      public:
+        //! A handle that refers to no Rule
+        RuleHandle() = default;
+
+        //! Construct from a slot in an EventLoop's Rule storage
+        RuleHandle(EventLoop &loop, const uint32_t index, const uint32_t generation)
+            : _loop(&loop), _index(index), _generation(generation) {}
+
+        //! Cancel the Rule, calling its `cancel` callback; returns `false` if it was already canceled
+        bool cancel();
+
+        //! Stop polling the Rule's descriptor on its behalf until resume() is called
+        void pause();
+
+        //! Undo pause()
+        void resume();
+
+        //! Poll for the other Direction from now on
+        void set_direction(const Direction direction);
+
+        //! Whether the Rule is still installed
+        bool active() const { return _rule() != nullptr; }
+
+        //! Whether the Rule is paused (a stale handle is never paused)
+        bool paused() const;
+
+        //! Time spent in the Rule's callback while instrumentation was enabled (zero for a stale handle)
+        RuleStats stats() const;
     };
 
   private:
-    using CallbackT = std::function<void(void)>;  //!< Callback for ready Rule::fd
-    using InterestT = std::function<bool(void)>;  //!< `true` return indicates Rule::fd should be polled.
+    using CallbackT = InlineFunction<void(void)>;  //!< Callback for ready Rule::fd
+    using InterestT = InlineFunction<bool(void)>;  //!< `true` return indicates Rule::fd should be polled.
 
     //! \brief Specifies a condition and callback that an EventLoop should handle.
     //! \details Created by calling EventLoop::add_rule() or EventLoop::add_cancelable_rule().
     class Rule {
       public:
-        FileDescriptor fd;    //!< FileDescriptor to monitor for activity.
-        Direction direction;  //!< Direction::In for reading from fd, Direction::Out for writing to fd.
-        CallbackT callback;   //!< A callback that reads or writes fd.
-        InterestT interest;   //!< A callback that returns `true` whenever fd should be polled.
-        CallbackT cancel;     //!< A callback that is called when the rule is cancelled (e.g. on hangup)
+        FileDescriptor fd;           //!< FileDescriptor to monitor for activity.
+        Direction direction;         //!< Direction::In or Direction::Error for reading fd, Direction::Out for writing.
+        CallbackT callback;          //!< A callback that reads or writes fd.
+        InterestT interest;          //!< A callback that returns `true` whenever fd should be polled (optional).
+        CallbackT cancel;            //!< A callback that is called when the rule is cancelled (optional)
+        uint32_t index = 0;          //!< This Rule's slot in EventLoop::_rule_chunks
+        uint32_t interest_pos = 0;   //!< This Rule's position in EventLoop::_interest_rules (if it has an interest)
+        bool paused = false;         //!< Set by RuleHandle::pause()
+        bool polled = false;         //!< Whether fd is being polled on this Rule's behalf
+        bool canceled = false;       //!< Canceled, but not yet erased from its slot (see EventLoop::_canceled)
+        bool internal = false;       //!< Added by the EventLoop itself; does not keep the EventLoop running
+        bool requeued = false;       //!< Whether the Rule is in EventLoop::_requeued
+        RuleOptions options{};       //!< Edge triggering and budgets
+        uint64_t dispatched_in = 0;  //!< Value of EventLoop::_iteration when the Rule was last dispatched
+        unsigned deferrals = 0;      //!< Consecutive waits in which the dispatch limit passed this Rule over
+        RuleStats stats{};           //!< Callback timing (instrumented only)
 
         //! Returns the number of times fd has been read or written, depending on the value of Rule::direction.
         //! \details This function is used internally by EventLoop; you will not need to call it
         unsigned int service_count() const;
+
+        //! Whether fd should be polled on this Rule's behalf: not paused, and Rule::interest (if any) agrees
+        bool interested() const { return not paused and (not interest or interest()); }
+
+        //! Whether the Rule can never be ready again: fd is closed, or at EOF for Direction::In
+        bool finished() const { return (direction == Direction::In and fd.eof()) or fd.closed(); }
+
+        //! Whether an error on fd is dispatched to the Rule (see RuleOptions::report_errors and Direction::Error)
+        bool reports_errors() const { return options.report_errors or direction == Direction::Error; }
     };
 
-    std::list<Rule> _rules{};  //!< All rules that have been added and not canceled.
+    //! \brief Storage for one Rule, indexed by RuleHandle.
+    //! \details A slot is reused once its Rule has been erased; RuleSlot::generation tells the Rule
+    //! objects that have occupied it apart.
+    struct RuleSlot {
+        std::optional<Rule> rule{};  //!< The Rule, from add_rule() until it is erased by _erase_canceled()
+        uint32_t generation = 0;     //!< Incremented each time a Rule in this slot is canceled
+    };
 
-  public:
-    //! Returned by each call to EventLoop::wait_next_event.
-    enum class Result {
-        Success,  //!< At least one Rule was triggered.
-        Timeout,  //!< No rules were triggered before timeout.
-        Exit  //!< All rules have been canceled or were uninterested; make no further calls to EventLoop::wait_next_event.
+    //! A Rule reported ready by the kernel (or requeued), waiting to be dispatched
+    struct ReadyRule {
+        Rule *rule;        //!< The Rule
+        uint32_t revents;  //!< Ready events, as reported by the kernel (only the Direction bits are examined)
+        bool hangup;       //!< Whether the kernel reported a hangup
+    };
+
+    //! Buckets of ReadyRule objects: one for Rules promoted by the dispatch limit, then one per Priority
+    using ReadyRules = std::array<std::vector<ReadyRule>, 4>;
+
+    static constexpr size_t RULE_CHUNK_SIZE = 64;                 //!< RuleSlot objects per chunk
+    using RuleChunk = std::array<RuleSlot, RULE_CHUNK_SIZE>;      //!< A fixed block of RuleSlot objects
+    using RuleChunks = std::vector<std::unique_ptr<RuleChunk>>;  //!< Chunks are never moved or freed once allocated
+
+    //! \brief The epoll backend's bookkeeping for one descriptor number.
+    //! \details epoll allows only one registration per descriptor, so the events requested by every
+    //! Rule on the descriptor are combined, and the kernel is told only when the combination changes.
+    struct Registration {
+        std::vector<Rule *> rules{};        //!< Rules watching this descriptor number.
+        uint32_t events = 0;                //!< Events currently registered with the kernel.
+        uint32_t wanted = 0;                //!< Events requested by the polled Rules on this descriptor.
+        bool registered = false;            //!< Whether the descriptor has been added to the epoll instance.
+        bool always_ready = false;          //!< epoll refused the descriptor (e.g., a regular file); treat it as ready.
+        bool dirty = false;                 //!< Whether the descriptor is in EventLoop::_dirty.
     };
 
+    Backend _backend;                            //!< Which wait implementation is in use.
+    RuleChunks _rule_chunks{};                   //!< Storage for every Rule.
+    uint32_t _slots_used = 0;                    //!< Slots handed out so far (the high-water mark).
+    std::vector<uint32_t> _free_slots{};         //!< Slots below EventLoop::_slots_used whose Rule was erased.
+    size_t _rule_count = 0;                      //!< Rules currently stored (including canceled ones).
+    std::vector<Rule *> _interest_rules{};       //!< Rules whose Rule::interest is called on every wait.
+    std::vector<Rule *> _canceled{};             //!< Canceled Rules, erased at the next safe point.
+    size_t _polled_count = 0;                    //!< Number of Rules with Rule::polled set (except internal ones).
+    uint64_t _state_log_position;                //!< How far FileDescriptor::read_state_log has been read.
+    std::optional<FileDescriptor> _epoll_fd{};   //!< The epoll instance (epoll backend only).
+    std::vector<Registration> _registrations{};  //!< Epoll bookkeeping, indexed by descriptor number.
+    std::vector<int> _dirty{};                   //!< Descriptors whose Registration::wanted may be out of date.
+    std::vector<int> _always_ready{};            //!< Descriptors epoll refused to watch.
+    std::vector<epoll_event> _ready_events{};    //!< Output buffer for [epoll_wait(2)](\ref man2::epoll_wait).
+    std::vector<pollfd> _pollfds{};              //!< Input to [poll(2)](\ref man2::poll) (poll backend only).
+    std::vector<Rule *> _polled_rules{};         //!< The Rule for each entry of EventLoop::_pollfds.
+    TimerWheel _timers;                          //!< Timers added with add_timer() and add_periodic().
+    std::vector<Rule *> _requeued{};             //!< Edge-triggered Rules to dispatch again on the next wait.
+    std::vector<Rule *> _requeue_batch{};        //!< The Rules from EventLoop::_requeued being dispatched now.
+    uint64_t _iteration = 0;                     //!< Number of calls to wait_next_event so far.
+    ReadyRules _ready_rules{};                   //!< Ready Rules, in dispatch order.
+    size_t _dispatch_limit = 0;                  //!< Most Rules to dispatch per wait, or zero for no limit.
+    unsigned _promote_after = 0;                 //!< Deferrals after which a Rule is promoted (zero never promotes).
+    TaskQueue _posted{};                         //!< Tasks added with post().
+    FileDescriptor _wakeup_fd;                   //!< An [eventfd(2)](\ref man2::eventfd) that post() signals.
+    bool _instrumented = false;                  //!< Whether to collect EventLoop::_stats.
+    Stats _stats{};                              //!< Instrumentation totals.
+    uint64_t _wake_ns = 0;                       //!< When the current wait returned (instrumented only).
+    uint64_t _iteration_callback_ns = 0;         //!< Time in callbacks so far in this call (instrumented only).
+    uint64_t _iteration_ready = 0;               //!< Rules dispatched so far in this call (instrumented only).
+    uint64_t _slow_callback_ns = 0;              //!< Slow-callback threshold, or zero if disabled.
+    SlowCallbackT _on_slow_callback{};           //!< Called for each slow callback.
+    TimerHandle _stats_timer{};                  //!< Periodic timer that calls the stats callback.
+    std::optional<FileDescriptor> _signal_fd{};  //!< A [signalfd(2)](\ref man2::signalfd) for EventLoop::_signals.
+    sigset_t _signals{};                         //!< Signals with a handler.
+    sigset_t _blocked_signals{};                 //!< Signals that add_signal_handler() blocked (to unblock later).
+    std::vector<SignalCallbackT> _on_signal{};   //!< Signal handlers, indexed by signal number.
+
+    //! Implementation of add_rule, which can also add an internal Rule
+    RuleHandle _add_rule(const FileDescriptor &fd,
+                         const Direction direction,
+                         CallbackT callback,
+                         InterestT interest,
+                         CallbackT cancel,
+                         const RuleOptions &options,
+                         const bool internal);
+
+    //! The slot at `index` (which must be below EventLoop::_slots_used)
+    RuleSlot &_slot(const uint32_t index) {
+        return (*_rule_chunks[index / RULE_CHUNK_SIZE])[index % RULE_CHUNK_SIZE];
+    }
+
+    //! The slot at `index` (which must be below EventLoop::_slots_used)
+    const RuleSlot &_slot(const uint32_t index) const {
+        return (*_rule_chunks[index / RULE_CHUNK_SIZE])[index % RULE_CHUNK_SIZE];
+    }
+
+    //! Set Rule::polled, keeping EventLoop::_polled_count and the descriptor's Registration up to date
+    void _set_polled(Rule &rule, const bool polled);
+
+    //! Queue a descriptor's Registration to be recomputed before the next wait (epoll backend)
+    void _mark_dirty(const int fd_num);
+
+    //! Calls Rule::cancel and stops dispatching the Rule; it is erased by the next call to _erase_canceled()
+    void _cancel_rule(Rule *rule);
+
+    //! Whether a Rule with Direction::Error watches descriptor `fd_num`, leaving its errors to that Rule
+    bool _has_error_rule(const int fd_num) const;
+
+    //! Erase the canceled Rules, removing each from its Registration (epoll backend)
+    void _erase_canceled();
+
+    //! Cancel the Rules on descriptors that were closed, or reached EOF, since the last wait
+    void _cancel_finished_rules();
+
+    //! Call Rule::callback, timing it if instrumentation is enabled
+    void _run_callback(Rule &rule);
+
+    //! Fire expired timers, timing them if instrumentation is enabled; returns the number fired
+    size_t _advance_timers();
+
+    //! Note that the kernel wait which began at `wait_start_ns` has returned (instrumented only)
+    void _note_wakeup(const uint64_t wait_start_ns);
+
+    //! Whether any timer is outstanding, other than the ones the EventLoop uses itself
+    bool _have_timers() const { return _timers.size() > (_stats_timer.pending() ? 1 : 0); }
+
+    //! Run a ready Rule's callback, then cancel it if it is finished or check it for a busy wait
+    void _dispatch(Rule *rule);
+
+    //! Run an edge-triggered Rule's callback until fd is drained or the Rule's budget is spent
+    void _dispatch_edge_triggered(Rule *rule);
+
+    //! Arrange for an edge-triggered Rule to be dispatched on the next wait, whether or not fd is reported ready
+    void _requeue(Rule *rule);
+
+    //! Move EventLoop::_requeued into EventLoop::_requeue_batch, and start a new set of EventLoop::_ready_rules
+    void _take_requeued();
+
+    //! Add a Rule on a descriptor reported ready to EventLoop::_ready_rules
+    void _add_ready(Rule *rule, const uint32_t revents, const bool hangup);
+
+    //! Add the Rules requeued before this wait to EventLoop::_ready_rules (after the ones reported ready)
+    void _add_requeued();
+
+    //! Dispatch EventLoop::_ready_rules in order, up to the dispatch limit
+    void _dispatch_ready();
+
+    //! Leave a ready Rule for a later wait, because the dispatch limit has been reached
+    void _defer(Rule *rule);
+
+    //! Run the posted tasks, leaving EventLoop::_wakeup_fd signaled if one throws before the rest have run
+    void _run_posted();
+
+    //! Read EventLoop::_signal_fd, and call the handler for each signal
+    void _read_signals();
+
+    //! Tell the kernel about a change in a descriptor's wanted events
+    void _update_registration(const int fd_num);
+
+    //! Shorten `timeout_ms` so that waiting ends in time for the next timer
+    int _timeout_for_timers(const int timeout_ms) const;
+
+    //! Implementation of wait_next_event for Backend::Poll
+    Result _wait_poll(const int timeout_ms);
+
+    //! Implementation of wait_next_event for Backend::Epoll
+    Result _wait_epoll(const int timeout_ms);
+
+  public:
+    //! Construct an EventLoop that waits using the specified Backend
+    explicit EventLoop(const Backend backend = Backend::Epoll);
+
+    //! Unblocks the signals that add_signal_handler() blocked
+    ~EventLoop();
+
     //! Add a rule whose callback will be called when `fd` is ready in the specified Direction.
-    void add_rule(const FileDescriptor &fd,
-                  const Direction direction,
-                  const CallbackT &callback,
-                  const InterestT &interest = [] { return true; },
-                  const CallbackT &cancel = [] {});
+    RuleHandle add_rule(const FileDescriptor &fd,
+                        const Direction direction,
+                        CallbackT callback,
+                        InterestT interest = {},
+                        CallbackT cancel = {});
+
+    //! Add a rule with the specified RuleOptions (e.g., edge triggering).
+    RuleHandle add_rule(const FileDescriptor &fd,
+                        const Direction direction,
+                        CallbackT callback,
+                        InterestT interest,
+                        CallbackT cancel,
+                        const RuleOptions &options);
 
-    //! Calls [poll(2)](\ref man2::poll) and then executes callback for each ready fd.
+    //! Call `callback` once, at time `deadline_ms` (as measured by timestamp_ms()).
+    TimerHandle add_timer(const uint64_t deadline_ms, CallbackT callback);
+
+    //! Call `callback` every `interval_ms` milliseconds, starting `interval_ms` from now.
+    TimerHandle add_periodic(const uint64_t interval_ms, CallbackT callback);
+
+    //! Run `task` on the thread that calls wait_next_event. Safe to call from any thread.
+    void post(CallbackT task);
+
+    //! Dispatch at most `limit` ready Rules per wait (zero for no limit), promoting a Rule that has been
+    //! passed over `promote_after` times in a row (zero never promotes) ahead of every Priority
+    void set_dispatch_limit(const size_t limit, const unsigned promote_after = 4);
+
+    //! Handle signal `signum` from within wait_next_event, rather than interrupting it (replaces any earlier handler)
+    void add_signal_handler(const int signum, SignalCallbackT callback);
+
+    //! Stop handling signal `signum`, and unblock it if add_signal_handler() blocked it
+    void remove_signal_handler(const int signum);
+
+    //! Reap child process `pid` once it exits, and then call `callback` with the result
+    RuleHandle add_child(const pid_t pid, ChildCallbackT callback);
+
+    //! Connect `socket` to `address` without blocking, and call `callback` once the attempt has finished
+    RuleHandle add_connect(Socket &socket, const Address &address, CallbackT callback);
+
+    //! Release the Buffers that `sender` has pinned as the kernel reports it is done with them
+    RuleHandle add_zerocopy(ZeroCopySender &sender);
+
+    //! Waits for events with [epoll_wait(2)](\ref man2::epoll_wait) or [poll(2)](\ref man2::poll) and then executes
+    //! callback for each ready fd.
     Result wait_next_event(const int timeout_ms);
+
+    //! The Backend this EventLoop was constructed with
+    Backend backend() const { return _backend; }
+
+    //! \name Instrumentation
+    //!@{
+
+    //! Start or stop collecting Stats and RuleStats (when stopped, the only cost is a branch per callback)
+    void set_instrumentation(const bool enabled);
+
+    //! Whether instrumentation is enabled
+    bool instrumentation() const { return _instrumented; }
+
+    //! The Stats collected so far
+    const Stats &stats() const { return _stats; }
+
+    //! Clear the Stats and every Rule's RuleStats
+    void reset_stats();
+
+    //! The Stats, and the RuleStats of every Rule, as a JSON object
+    std::string stats_json() const;
+
+    //! Report Rule callbacks that take at least `threshold_ns` (zero disables); by default, to std::cerr
+    void set_slow_callback_threshold(const uint64_t threshold_ns, const SlowCallbackT &handler = {});
+
+    //! Call `callback` every `interval_ms` milliseconds (zero, or an empty callback, stops the calls)
+    void set_stats_callback(const uint64_t interval_ms, const StatsCallbackT &callback);
+    //!@}
 };
 
 using Direction = EventLoop::Direction;
 
 //! \class EventLoop
 //!
-//! An EventLoop holds a std::list of Rule objects. Each time EventLoop::wait_next_event is
-//! executed, the EventLoop uses the Rule objects to construct a call to [poll(2)](\ref man2::poll).
+//! An EventLoop holds a set of Rule objects. With Backend::Poll, each time EventLoop::wait_next_event
+//! is executed, the EventLoop uses the Rule objects to construct a call to [poll(2)](\ref man2::poll).
+//!
+//! Rule objects live in fixed-size chunks of slots that are never freed or moved while the EventLoop
+//! exists, and a slot is reused (through a free list) once its Rule has been erased. Callbacks are held
+//! in InlineFunction objects, which store any lambda of up to 64 bytes inside the Rule. So once the
+//! EventLoop has held as many Rule objects as it will need, adding and canceling Rule objects with
+//! such callbacks does not touch the heap.
+//!
+//! With Backend::Epoll (the default), descriptors stay registered with an [epoll(7)](\ref man7::epoll)
+//! instance between calls. The kernel is only told about a descriptor when the combined interest of its
+//! Rule objects changes, and after waiting, only the Rule objects on ready descriptors are visited. Rule
+//! interest, callback, and cancellation behave identically under both backends. Descriptors that epoll
+//! cannot watch (e.g., regular files) are treated as always ready, as poll would report them.
 //!
 //! When a Rule is installed using EventLoop::add_rule, it will be polled for the specified Rule::direction
 //! whenver the Rule::interest callback returns `true`, until Rule::fd is no longer readable
 //! (for Rule::direction == Direction::In) or writable (for Rule::direction == Direction::Out).
 //! Once this occurs, the Rule is canceled, i.e., the EventLoop deletes it.
 //!
+//! A Rule installed without an `interest` callback is always interested, unless it has been paused with
+//! the RuleHandle that EventLoop::add_rule returns. Pausing, resuming, redirecting, or canceling through a
+//! RuleHandle is O(1), and with Backend::Epoll the EventLoop only revisits the descriptors whose Rule
+//! objects changed in one of these ways, so a loop with many idle Rule objects does no per-Rule work
+//! on each wakeup. Rule objects with an `interest` callback are also kept in a separate list, whose
+//! callbacks are still called on every wait. Descriptors that are closed, or reach EOF, somewhere else
+//! are found through FileDescriptor::read_state_log, which only sees events on the current thread;
+//! close watched descriptors on the thread that runs the EventLoop.
+//!
 //! A Rule installed using EventLoop::add_cancelable_rule will be polled and canceled under the
 //! same conditions, with the additional condition that if Rule::callback returns `true`, the
 //! Rule will be canceled.
+//!
+//! Timers installed using EventLoop::add_timer and EventLoop::add_periodic are kept in a hierarchical
+//! TimerWheel, so adding and canceling a timer is O(1) however many are outstanding. Each call to
+//! EventLoop::wait_next_event waits no longer than the time until the next timer is due, and then
+//! runs the callbacks of every timer that has expired (after the callbacks of any ready Rule objects).
+//! The EventLoop keeps running while any timer is outstanding, even if no Rule is left to poll.
+//!
+//! A Rule added with RuleOptions::edge_triggered set is dispatched differently. Its callback should
+//! read or write once per call, using FileDescriptor::try_read or FileDescriptor::try_write on a
+//! non-blocking descriptor. The EventLoop keeps calling it until the descriptor is drained, i.e. until
+//! an I/O call reports `EAGAIN` (or, for Direction::Out, a write comes up short). It also stops when the
+//! callback returns without touching the descriptor, pauses or redirects the Rule, or spends the Rule's
+//! RuleOptions::byte_budget or RuleOptions::call_budget; in the last case the Rule is requeued and
+//! dispatched again on the next wait, after the Rule objects the kernel reports ready. So a bulk transfer
+//! gets a bounded share of each iteration, and quiet connections on the same EventLoop are not starved.
+//! An edge-triggered callback is never treated as a busy wait. With Backend::Epoll, a descriptor whose
+//! polled Rule objects are all edge-triggered is registered with `EPOLLET`; otherwise (and with
+//! Backend::Poll) the kernel stays level triggered, and only the dispatching changes.
+//!
+//! The Rule objects that are ready after a wait are dispatched in order of RuleOptions::priority, so
+//! control-plane descriptors (listeners, signals, admin sockets) are served before bulk data. By default
+//! every ready Rule is still dispatched in every wait. EventLoop::set_dispatch_limit bounds the number of
+//! Rule objects dispatched per wait, so that a loop saturated with data transfer returns to the kernel
+//! (and to its high-priority Rule objects) promptly; the Rule objects passed over stay ready for a later
+//! wait. To keep low-priority Rule objects from starving, one that has been passed over enough times in a
+//! row is dispatched ahead of every Priority on its next wait. The EventLoop's own wakeup Rule (for
+//! EventLoop::post) has Priority::High, as do the listeners of a ShardedRuntime.
+//!
+//! With EventLoop::set_instrumentation, each call to wait_next_event records how long it blocked in the
+//! kernel, how long its callbacks ran, and how many Rule objects it dispatched, and each dispatched
+//! Rule records its loop lag (the delay between the wait returning and its callback starting, i.e.
+//! the time it spent queued behind other callbacks) and its callback duration. Callbacks that exceed the
+//! slow-callback threshold are counted and reported. The results are available from EventLoop::stats,
+//! RuleHandle::stats, and EventLoop::stats_json, or periodically through EventLoop::set_stats_callback
+//! (whose timer does not keep the EventLoop running). When disabled, no clock is read.
+//!
+//! EventLoop::post is the only member function that may be called from a thread other than the one
+//! running the EventLoop. Posted tasks go into a lock-free TaskQueue, and the first post into an empty
+//! queue writes to an [eventfd(2)](\ref man2::eventfd) that the EventLoop watches with an internal
+//! Rule, so a whole batch of posts costs a single wakeup. The tasks run, in the order each thread
+//! posted them, from within EventLoop::wait_next_event. If a task throws, the exception propagates out
+//! of wait_next_event and the tasks after it run on the next call. A task that has been posted but not yet run
+//! keeps wait_next_event from returning Result::Exit, but an EventLoop with nothing else to do does not
+//! wait for future posts.
+//!
+//! Signals are handled as ordinary events. EventLoop::add_signal_handler blocks a signal and reads it from
+//! a [signalfd(2)](\ref man2::signalfd), so a `SIGHUP` (for instance) runs its handler from within
+//! wait_next_event like any other callback, with no async-signal-safety concerns. EventLoop::add_child
+//! watches a child process through a pidfd and reaps it when it exits, without a `SIGCHLD` handler. A
+//! signal that does interrupt the wait (one caught by a sigaction handler) is just a wakeup with
+//! nothing ready; it does not make wait_next_event return Result::Exit. EventLoop::add_connect likewise
+//! turns a non-blocking [connect(2)](\ref man2::connect) into a single event.
+//!
+//! A Rule with Direction::Error is dispatched only when its descriptor reports an error, which for a
+//! socket includes messages waiting on its error queue, such as the completions of a ZeroCopySender
+//! (see EventLoop::add_zerocopy). While a descriptor has such a Rule, its errors are left to that Rule,
+//! and don't make wait_next_event throw on behalf of the descriptor's other Rules.
 
 #endif  // SPONGE_LIBSPONGE_EVENTLOOP_HH
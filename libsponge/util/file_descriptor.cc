@@ -3,27 +3,111 @@
 #include "util.hh"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <fcntl.h>
 #include <iostream>
+#include <mutex>
+#include <sstream>
 #include <stdexcept>
 #include <sys/uio.h>
 #include <unistd.h>
+#include <unordered_set>
 
 using namespace std;
 
+//! The live FDWrappers constructed on one thread
+struct FileDescriptor::RegistryShard {
+    mutex lock{};                                 //!< Protects RegistryShard::wrappers (rarely contended)
+    unordered_set<const FDWrapper *> wrappers{};  //!< Every such FDWrapper that has not been destroyed
+};
+
+//! Process-wide set of live FDWrappers, used by FileDescriptor::live_io_stats()
+//! \details Each thread registers its FDWrappers in a RegistryShard of its own. A shard outlives its
+//! thread (whose FDWrappers may still be live), and is handed to the next thread that starts.
+struct FileDescriptor::Registry {
+    mutex lock{};                                //!< Protects Registry::shards and Registry::free_shards
+    vector<unique_ptr<RegistryShard>> shards{};  //!< Every shard (never destroyed)
+    vector<RegistryShard *> free_shards{};       //!< Shards whose threads have exited
+};
+
+//! Whether syscall latency is being measured
+static atomic<bool> latency_tracing_enabled{false};
+
+//! A ring of the descriptor numbers most recently closed (or found at EOF) on one thread
+struct StateLog {
+    static constexpr size_t CAPACITY = 4096;  //!< Entries kept before the oldest are overwritten
+    array<int, CAPACITY> fds{};               //!< The ring itself
+    uint64_t next = 0;                        //!< Total number of entries ever appended
+};
+
+//! This thread's StateLog
+static thread_local StateLog state_log{};
+
+//! \param[in] fd is the descriptor number that was closed or reached EOF
+static void log_state_change(const int fd) { state_log.fds[state_log.next++ % StateLog::CAPACITY] = fd; }
+
+//! \returns the process-wide registry (constructed on first use, and never destroyed, so that
+//!          FDWrappers with static storage duration can safely unregister themselves)
+FileDescriptor::Registry &FileDescriptor::registry() {
+    static auto *const the_registry = new Registry;
+    return *the_registry;
+}
+
+//! \details The shard is claimed on the thread's first call, and handed back when the thread exits.
+FileDescriptor::RegistryShard &FileDescriptor::local_shard() {
+    //! Holds a RegistryShard for one thread
+    struct Lease {
+        RegistryShard *shard;  //!< The shard held
+
+        Lease() : shard(nullptr) {
+            auto &reg = registry();
+            const lock_guard<mutex> guard(reg.lock);
+            if (reg.free_shards.empty()) {
+                reg.shards.push_back(make_unique<RegistryShard>());
+                shard = reg.shards.back().get();
+            } else {
+                shard = reg.free_shards.back();
+                reg.free_shards.pop_back();
+            }
+        }
+
+        ~Lease() {
+            auto &reg = registry();
+            const lock_guard<mutex> guard(reg.lock);
+            reg.free_shards.push_back(shard);
+        }
+
+        Lease(const Lease &other) = delete;
+        Lease &operator=(const Lease &other) = delete;
+    };
+
+    static thread_local Lease lease{};
+    return *lease.shard;
+}
+
 //! \param[in] fd is the file descriptor number returned by [open(2)](\ref man2::open) or similar
-FileDescriptor::FDWrapper::FDWrapper(const int fd) : _fd(fd) {
+FileDescriptor::FDWrapper::FDWrapper(const int fd) : _fd(fd), _shard(&local_shard()) {
     if (fd < 0) {
         throw runtime_error("invalid fd number:" + to_string(fd));
     }
+
+    const lock_guard<mutex> guard(_shard->lock);
+    _shard->wrappers.insert(this);
 }
 
 void FileDescriptor::FDWrapper::close() {
     SystemCall("close", ::close(_fd));
     _eof = _closed = true;
+    log_state_change(_fd);
 }
 
 FileDescriptor::FDWrapper::~FDWrapper() {
+    {
+        const lock_guard<mutex> guard(_shard->lock);
+        _shard->wrappers.erase(this);
+    }
+
     try {
         if (_closed) {
             return;
@@ -46,23 +130,44 @@ FileDescriptor FileDescriptor::duplicate() const { return FileDescriptor(_intern
 
 //! \param[in] limit is the maximum number of bytes to read; fewer bytes may be returned
 //! \param[out] str is the string to be read
-void FileDescriptor::read(std::string &str, const size_t limit) {
+void FileDescriptor::read(std::string &str, const size_t limit) { read_helper(str, limit, 0); }
+
+//! \param[out] str is the string to be read
+//! \param[in] limit is the maximum number of bytes to read; fewer bytes may be returned
+//! \param[in] errno_mask is an errno value (e.g. `EAGAIN`) that should not cause an exception
+//! \returns `false` (with `str` empty) if the read failed with `errno_mask`
+bool FileDescriptor::read_helper(std::string &str, const size_t limit, const int errno_mask) {
     constexpr size_t BUFFER_SIZE = 1024 * 1024;  // maximum size of a read
     const size_t size_to_read = min(BUFFER_SIZE, limit);
     str.resize(size_to_read);
 
-    ssize_t bytes_read = SystemCall("read", ::read(fd_num(), str.data(), size_to_read));
-    if (limit > 0 && bytes_read == 0) {
+    ssize_t bytes_read =
+        traced_read("read", [&] { return ::read(fd_num(), str.data(), size_to_read); }, errno_mask);
+    if (bytes_read < 0) {
+        str.clear();
+        register_read();
+        return false;
+    }
+    if (limit > 0 && bytes_read == 0 && not _internal_fd->_eof) {
         _internal_fd->_eof = true;
+        log_state_change(fd_num());
     }
     if (bytes_read > static_cast<ssize_t>(size_to_read)) {
         throw runtime_error("read() read more than requested");
     }
     str.resize(bytes_read);
 
-    register_read();
+    register_read(bytes_read);
+    return true;
 }
 
+//! \param[out] str is the string to be read (empty at EOF, or if nothing was available)
+//! \param[in] limit is the maximum number of bytes to read; fewer bytes may be returned
+//! \returns `false` if the descriptor is non-blocking and had nothing to read
+//! \details Like read(), but a non-blocking descriptor with nothing to read is not an error. Use eof()
+//! to tell EOF apart from a successful read of zero bytes.
+bool FileDescriptor::try_read(std::string &str, const size_t limit) { return read_helper(str, limit, EAGAIN); }
+
 //! \param[in] limit is the maximum number of bytes to read; fewer bytes may be returned
 //! \returns a vector of bytes read
 string FileDescriptor::read(const size_t limit) {
@@ -79,7 +184,8 @@ size_t FileDescriptor::write(BufferViewList buffer, const bool write_all) {
     do {
         auto iovecs = buffer.as_iovecs();
 
-        const ssize_t bytes_written = SystemCall("writev", ::writev(fd_num(), iovecs.data(), iovecs.size()));
+        const ssize_t bytes_written =
+            traced_write("writev", [&] { return ::writev(fd_num(), iovecs.data(), iovecs.size()); });
         if (bytes_written == 0 and buffer.size() != 0) {
             throw runtime_error("write returned 0 given non-empty input buffer");
         }
@@ -88,7 +194,7 @@ size_t FileDescriptor::write(BufferViewList buffer, const bool write_all) {
             throw runtime_error("write wrote more than length of input buffer");
         }
 
-        register_write();
+        register_write(bytes_written, bytes_written < ssize_t(buffer.size()));
 
         buffer.remove_prefix(bytes_written);
 
@@ -98,6 +204,28 @@ size_t FileDescriptor::write(BufferViewList buffer, const bool write_all) {
     return total_bytes_written;
 }
 
+//! \param[in] buffer is the data to write
+//! \returns the number of bytes written, which is zero if a non-blocking descriptor had no room
+//! \details Makes a single [writev(2)](\ref man2::writev) call, like `write(buffer, false)`, except that
+//! a full non-blocking descriptor is not an error.
+size_t FileDescriptor::try_write(const BufferViewList &buffer) {
+    auto iovecs = buffer.as_iovecs();
+
+    const ssize_t bytes_written =
+        traced_write("writev", [&] { return ::writev(fd_num(), iovecs.data(), iovecs.size()); }, EAGAIN);
+    if (bytes_written < 0) {
+        register_write(0, buffer.size() > 0);
+        return 0;
+    }
+
+    if (bytes_written > ssize_t(buffer.size())) {
+        throw runtime_error("write wrote more than length of input buffer");
+    }
+
+    register_write(bytes_written, bytes_written < ssize_t(buffer.size()));
+    return bytes_written;
+}
+
 void FileDescriptor::set_blocking(const bool blocking_state) {
     int flags = SystemCall("fcntl", fcntl(fd_num(), F_GETFL));
     if (blocking_state) {
@@ -108,3 +236,83 @@ void FileDescriptor::set_blocking(const bool blocking_state) {
 
     SystemCall("fcntl", fcntl(fd_num(), F_SETFL, flags));
 }
+
+//! \param[in] w is the FDWrapper whose counters and latency histograms are copied
+FileDescriptor::IOStats FileDescriptor::snapshot(const FDWrapper &w) {
+    return {w._fd,
+            w._read_count.value(),
+            w._write_count.value(),
+            w._bytes_read.value(),
+            w._bytes_written.value(),
+            w._eagain_count.value(),
+            w._short_writes.value(),
+            w._read_latency,
+            w._write_latency};
+}
+
+string FileDescriptor::IOStats::to_json() const {
+    ostringstream ss;
+    ss << "{\"fd\":" << fd << ",\"reads\":" << reads << ",\"writes\":" << writes << ",\"bytes_read\":" << bytes_read
+       << ",\"bytes_written\":" << bytes_written << ",\"eagain\":" << eagain_count
+       << ",\"short_writes\":" << short_writes << ",\"read_latency\":" << read_latency.to_json()
+       << ",\"write_latency\":" << write_latency.to_json() << "}";
+    return ss.str();
+}
+
+//! \param[in] enabled is whether to time each read-side and write-side syscall
+//! \note Timing costs two reads of the steady clock per syscall, so it is off by default.
+void FileDescriptor::set_latency_tracing(const bool enabled) {
+    latency_tracing_enabled.store(enabled, memory_order_relaxed);
+}
+
+bool FileDescriptor::latency_tracing() { return latency_tracing_enabled.load(memory_order_relaxed); }
+
+//! \returns one IOStats per live FDWrapper (i.e., per open file descriptor), sorted by descriptor number
+vector<FileDescriptor::IOStats> FileDescriptor::live_io_stats() {
+    vector<IOStats> ret;
+    {
+        auto &reg = registry();
+        const lock_guard<mutex> guard(reg.lock);
+        for (const auto &shard : reg.shards) {
+            const lock_guard<mutex> shard_guard(shard->lock);
+            for (const FDWrapper *w : shard->wrappers) {
+                ret.push_back(snapshot(*w));
+            }
+        }
+    }
+
+    sort(ret.begin(), ret.end(), [](const IOStats &a, const IOStats &b) { return a.fd < b.fd; });
+    return ret;
+}
+
+//! \param[out] out is the stream to which the JSON array is written
+void FileDescriptor::dump_io_stats(ostream &out) {
+    out << "[";
+    bool first = true;
+    for (const auto &stats : live_io_stats()) {
+        out << (first ? "\n  " : ",\n  ") << stats.to_json();
+        first = false;
+    }
+    out << "\n]\n";
+}
+
+uint64_t FileDescriptor::state_log_position() { return state_log.next; }
+
+//! \param[in,out] position is where to start reading; on return, it is state_log_position()
+//! \param[in] visit is called with each descriptor number in the log, oldest first
+//! \returns `false` if some entries since `position` were overwritten (or `position` came from another
+//!          thread); nothing is visited in that case, and the caller should assume any descriptor may
+//!          have changed
+bool FileDescriptor::read_state_log(uint64_t &position, const function<void(int)> &visit) {
+    const uint64_t start = position;
+    position = state_log.next;
+
+    if (start > state_log.next or state_log.next - start > StateLog::CAPACITY) {
+        return false;
+    }
+
+    for (uint64_t i = start; i < state_log.next; i++) {
+        visit(state_log.fds[i % StateLog::CAPACITY]);
+    }
+    return true;
+}
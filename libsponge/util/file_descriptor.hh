@@ -2,23 +2,43 @@
 #define SPONGE_LIBSPONGE_FILE_DESCRIPTOR_HH
 
 #include "buffer.hh"
+#include "stats.hh"
+#include "util.hh"
 
 #include <array>
+#include <cerrno>
 #include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <limits>
 #include <memory>
+#include <ostream>
+#include <string>
+#include <sys/types.h>
+#include <utility>
+#include <vector>
 
 //! A reference-counted handle to a file descriptor
 class FileDescriptor {
+    //! One thread's share of the Registry
+    struct RegistryShard;
+
     //! \brief A handle on a kernel file descriptor.
     //! \details FileDescriptor objects contain a std::shared_ptr to a FDWrapper.
     class FDWrapper {
       public:
-        int _fd;                    //!< The file descriptor number returned by the kernel
-        bool _eof = false;          //!< Flag indicating whether FDWrapper::_fd is at EOF
-        bool _closed = false;       //!< Flag indicating whether FDWrapper::_fd has been closed
-        unsigned _read_count = 0;   //!< The number of times FDWrapper::_fd has been read
-        unsigned _write_count = 0;  //!< The numberof times FDWrapper::_fd has been written
+        int _fd;                            //!< The file descriptor number returned by the kernel
+        bool _eof = false;                  //!< Flag indicating whether FDWrapper::_fd is at EOF
+        bool _closed = false;               //!< Flag indicating whether FDWrapper::_fd has been closed
+        StatCounter _read_count{};          //!< The number of times FDWrapper::_fd has been read
+        StatCounter _write_count{};         //!< The number of times FDWrapper::_fd has been written
+        StatCounter _bytes_read{};          //!< The number of bytes read from FDWrapper::_fd
+        StatCounter _bytes_written{};       //!< The number of bytes written to FDWrapper::_fd
+        StatCounter _eagain_count{};        //!< The number of syscalls on FDWrapper::_fd that failed with `EAGAIN`
+        StatCounter _short_writes{};        //!< The number of writes that accepted less than was offered
+        LatencyHistogram _read_latency{};   //!< Duration of read-side syscalls (when tracing is enabled)
+        LatencyHistogram _write_latency{};  //!< Duration of write-side syscalls (when tracing is enabled)
+        RegistryShard *_shard;              //!< The shard that lists this FDWrapper (its constructing thread's)
 
         //! Construct from a file descriptor number returned by the kernel
         explicit FDWrapper(const int fd);
@@ -44,9 +64,74 @@ class FileDescriptor {
     // private constructor used to duplicate the FileDescriptor (increase the reference count)
     explicit FileDescriptor(std::shared_ptr<FDWrapper> other_shared_ptr);
 
+    //! Process-wide set of live FDWrappers
+    struct Registry;
+
+    //! The process-wide Registry
+    static Registry &registry();
+
+    //! This thread's RegistryShard
+    static RegistryShard &local_shard();
+
+    //! Time `syscall` (if tracing is enabled), count `EAGAIN`, then check the result with SystemCall()
+    template <typename SyscallT>
+    ssize_t traced(const char *attempt, LatencyHistogram &latency, SyscallT &&syscall, const int errno_mask);
+
+    //! Read up to `limit` bytes into `str`; returns `false` on an error matching `errno_mask`
+    bool read_helper(std::string &str, const size_t limit, const int errno_mask);
+
+  public:
+    //! A snapshot of the I/O accounting for one file descriptor
+    struct IOStats {
+        int fd;                          //!< The file descriptor number
+        uint64_t reads;                  //!< Number of reads
+        uint64_t writes;                 //!< Number of writes
+        uint64_t bytes_read;             //!< Bytes read
+        uint64_t bytes_written;          //!< Bytes written
+        uint64_t eagain_count;           //!< Syscalls that failed with `EAGAIN`
+        uint64_t short_writes;           //!< Writes that accepted less than was offered
+        LatencyHistogram read_latency;   //!< Read-side syscall latency
+        LatencyHistogram write_latency;  //!< Write-side syscall latency
+
+        //! Format as a JSON object
+        std::string to_json() const;
+    };
+
+  private:
+    //! Copy the accounting out of an FDWrapper
+    static IOStats snapshot(const FDWrapper &w);
+
   protected:
-    void register_read() { ++_internal_fd->_read_count; }    //!< increment read count
-    void register_write() { ++_internal_fd->_write_count; }  //!< increment write count
+    //! increment read count and add `bytes` to the bytes-read total
+    void register_read(const size_t bytes = 0) {
+        _internal_fd->_read_count.add();
+        _internal_fd->_bytes_read.add(bytes);
+    }
+
+    //! increment write count, add `bytes` to the bytes-written total, and note whether the write was short
+    void register_write(const size_t bytes = 0, const bool short_write = false) {
+        _internal_fd->_write_count.add();
+        _internal_fd->_bytes_written.add(bytes);
+        if (short_write) {
+            _internal_fd->_short_writes.add();
+        }
+    }
+
+    //! \name Wrappers for read-side and write-side syscalls issued by subclasses
+    //! \details `syscall` is a callable returning the raw syscall result. Its latency is recorded
+    //! when tracing is enabled, and an `EAGAIN` failure is counted before SystemCall() throws
+    //! (unless the failure matches `errno_mask`, as with SystemCall()).
+    //!@{
+    template <typename SyscallT>
+    ssize_t traced_read(const char *attempt, SyscallT &&syscall, const int errno_mask = 0) {
+        return traced(attempt, _internal_fd->_read_latency, std::forward<SyscallT>(syscall), errno_mask);
+    }
+
+    template <typename SyscallT>
+    ssize_t traced_write(const char *attempt, SyscallT &&syscall, const int errno_mask = 0) {
+        return traced(attempt, _internal_fd->_write_latency, std::forward<SyscallT>(syscall), errno_mask);
+    }
+    //!@}
 
   public:
     //! Construct from a file descriptor number returned by the kernel
@@ -70,6 +155,12 @@ class FileDescriptor {
     //! Write a buffer (or list of buffers), possibly blocking until all is written
     size_t write(BufferViewList buffer, const bool write_all = true);
 
+    //! Read up to `limit` bytes without throwing if none are available; returns `false` on `EAGAIN`
+    bool try_read(std::string &str, const size_t limit = std::numeric_limits<size_t>::max());
+
+    //! Write as much of a buffer as can be written without throwing on `EAGAIN`; returns the bytes written
+    size_t try_write(const BufferViewList &buffer);
+
     //! Close the underlying file descriptor
     void close() { _internal_fd->close(); }
 
@@ -81,11 +172,46 @@ class FileDescriptor {
 
     //! \name FDWrapper accessors
     //!@{
-    int fd_num() const { return _internal_fd->_fd; }                         //!< \brief underlying descriptor number
-    bool eof() const { return _internal_fd->_eof; }                          //!< \brief EOF flag state
-    bool closed() const { return _internal_fd->_closed; }                    //!< \brief closed flag state
-    unsigned int read_count() const { return _internal_fd->_read_count; }    //!< \brief number of reads
-    unsigned int write_count() const { return _internal_fd->_write_count; }  //!< \brief number of writes
+    int fd_num() const { return _internal_fd->_fd; }                                    //!< \brief descriptor number
+    bool eof() const { return _internal_fd->_eof; }                                     //!< \brief EOF flag state
+    bool closed() const { return _internal_fd->_closed; }                               //!< \brief closed flag state
+    unsigned int read_count() const { return _internal_fd->_read_count.value(); }       //!< \brief number of reads
+    unsigned int write_count() const { return _internal_fd->_write_count.value(); }     //!< \brief number of writes
+    uint64_t bytes_read() const { return _internal_fd->_bytes_read.value(); }           //!< \brief bytes read
+    uint64_t bytes_written() const { return _internal_fd->_bytes_written.value(); }     //!< \brief bytes written
+    uint64_t eagain_count() const { return _internal_fd->_eagain_count.value(); }       //!< \brief `EAGAIN` failures
+    uint64_t short_write_count() const { return _internal_fd->_short_writes.value(); }  //!< \brief short writes
+    //!@}
+
+    //! Snapshot of this descriptor's I/O accounting
+    IOStats io_stats() const { return snapshot(*_internal_fd); }
+
+    //! \name Process-wide I/O accounting
+    //!@{
+
+    //! Enable or disable syscall latency measurement for all descriptors (off by default)
+    static void set_latency_tracing(const bool enabled);
+
+    //! Whether syscall latency is being measured
+    static bool latency_tracing();
+
+    //! Snapshots of every file descriptor that is currently open in this process
+    static std::vector<IOStats> live_io_stats();
+
+    //! Write live_io_stats() to `out` as a JSON array
+    static void dump_io_stats(std::ostream &out);
+    //!@}
+
+    //! \name Close and EOF notifications
+    //! \details Each thread keeps a short log of the descriptor numbers that were closed, or reached
+    //! EOF, on that thread. EventLoop uses it to notice such descriptors without checking every Rule.
+    //!@{
+
+    //! Position just past the newest entry in this thread's log
+    static uint64_t state_log_position();
+
+    //! Call `visit` on each descriptor number logged since `position`, then advance `position`
+    static bool read_state_log(uint64_t &position, const std::function<void(int)> &visit);
     //!@}
 
     //! \name Copy/move constructor/assignment operators
@@ -98,10 +224,36 @@ class FileDescriptor {
     //!@}
 };
 
+template <typename SyscallT>
+ssize_t FileDescriptor::traced(const char *attempt,
+                               LatencyHistogram &latency,
+                               SyscallT &&syscall,
+                               const int errno_mask) {
+    const bool tracing = latency_tracing();
+    const uint64_t start = tracing ? timestamp_ns() : 0;
+    const ssize_t ret = syscall();
+    const int saved_errno = errno;
+    if (tracing) {
+        latency.record(timestamp_ns() - start);
+    }
+    if (ret < 0 and (saved_errno == EAGAIN or saved_errno == EWOULDBLOCK)) {
+        _internal_fd->_eagain_count.add();
+    }
+    errno = saved_errno;
+    return SystemCall(attempt, ret, errno_mask);
+}
+
 //! \class FileDescriptor
 //! In addition, FileDescriptor tracks EOF state and calls to FileDescriptor::read and
 //! FileDescriptor::write, which EventLoop uses to detect busy loop conditions.
 //!
+//! Every FDWrapper also keeps byte counts, `EAGAIN` and short-write counts, and (when enabled with
+//! FileDescriptor::set_latency_tracing) histograms of syscall latency. All open descriptors are
+//! listed in a process-wide registry, so FileDescriptor::dump_io_stats can show which connections
+//! are busy or stalled. The registry is split into one shard per thread, so threads opening and
+//! closing descriptors at the same time don't contend for a lock. The counters have a single writer
+//! (the thread doing the I/O) but can be read safely from any thread.
+//!
 //! For an example of FileDescriptor use, see the EventLoop class documentation.
 
 #endif  // SPONGE_LIBSPONGE_FILE_DESCRIPTOR_HH
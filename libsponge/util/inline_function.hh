@@ -0,0 +1,145 @@
+#ifndef SPONGE_LIBSPONGE_INLINE_FUNCTION_HH
+#define SPONGE_LIBSPONGE_INLINE_FUNCTION_HH
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+template <typename Signature, size_t Capacity = 64>
+class InlineFunction;
+
+//! A move-only callable wrapper that stores callables of up to `Capacity` bytes without allocating
+template <typename R, typename... Args, size_t Capacity>
+class InlineFunction<R(Args...), Capacity> {
+  private:
+    static_assert(Capacity >= sizeof(void *), "InlineFunction: Capacity must hold at least a pointer");
+
+    //! Operations on the stored callable (one table per callable type)
+    struct Ops {
+        R (*invoke)(void *storage, Args &&... args);      //!< Call the callable
+        void (*relocate)(void *from, void *to) noexcept;  //!< Move the callable, destroying the original
+        void (*destroy)(void *storage) noexcept;          //!< Destroy the callable
+    };
+
+    //! Ops for a callable stored in InlineFunction::_storage
+    template <typename F>
+    struct Inline {
+        static F *get(void *storage) { return std::launder(static_cast<F *>(storage)); }
+        static R invoke(void *storage, Args &&... args) { return (*get(storage))(std::forward<Args>(args)...); }
+        static void relocate(void *from, void *to) noexcept {
+            ::new (to) F(std::move(*get(from)));
+            get(from)->~F();
+        }
+        static void destroy(void *storage) noexcept { get(storage)->~F(); }
+        static constexpr Ops ops{&invoke, &relocate, &destroy};
+    };
+
+    //! Ops for a callable too large for InlineFunction::_storage, which holds a pointer to it instead
+    template <typename F>
+    struct Boxed {
+        static F *&get(void *storage) { return *std::launder(static_cast<F **>(storage)); }
+        static R invoke(void *storage, Args &&... args) { return (*get(storage))(std::forward<Args>(args)...); }
+        static void relocate(void *from, void *to) noexcept { ::new (to) F *(get(from)); }
+        static void destroy(void *storage) noexcept { delete get(storage); }
+        static constexpr Ops ops{&invoke, &relocate, &destroy};
+    };
+
+    alignas(std::max_align_t) mutable unsigned char _storage[Capacity]{};  //!< The callable (or a pointer to it)
+    const Ops *_ops = nullptr;                                             //!< Null if empty
+
+  public:
+    //! Whether a callable of type `F` is stored inline (rather than on the heap)
+    template <typename F>
+    static constexpr bool stored_inline = sizeof(F) <= Capacity and alignof(F) <= alignof(std::max_align_t)
+                                          and std::is_nothrow_move_constructible_v<F>;
+
+    //! An empty InlineFunction
+    InlineFunction() = default;
+
+    //! An empty InlineFunction
+    InlineFunction(std::nullptr_t) {}
+
+    //! Wrap a callable (a null function pointer gives an empty InlineFunction)
+    template <typename F,
+              typename D = std::decay_t<F>,
+              typename = std::enable_if_t<not std::is_same_v<D, InlineFunction>
+                                          and std::is_invocable_r_v<R, D &, Args...>>>
+    InlineFunction(F &&f) {
+        if constexpr (std::is_pointer_v<D> or std::is_member_pointer_v<D>) {
+            if (f == nullptr) {
+                return;
+            }
+        }
+
+        if constexpr (stored_inline<D>) {
+            ::new (static_cast<void *>(_storage)) D(std::forward<F>(f));
+            _ops = &Inline<D>::ops;
+        } else {
+            ::new (static_cast<void *>(_storage)) D *(new D(std::forward<F>(f)));
+            _ops = &Boxed<D>::ops;
+        }
+    }
+
+    InlineFunction(InlineFunction &&other) noexcept : _ops(other._ops) {
+        if (_ops) {
+            _ops->relocate(other._storage, _storage);
+            other._ops = nullptr;
+        }
+    }
+
+    InlineFunction &operator=(InlineFunction &&other) noexcept {
+        if (this != &other) {
+            reset();
+            if (other._ops) {
+                other._ops->relocate(other._storage, _storage);
+                _ops = other._ops;
+                other._ops = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    InlineFunction &operator=(std::nullptr_t) noexcept {
+        reset();
+        return *this;
+    }
+
+    //! An InlineFunction is move-only, so that it can hold move-only callables
+
+    //!@{
+    InlineFunction(const InlineFunction &other) = delete;
+    InlineFunction &operator=(const InlineFunction &other) = delete;
+    //!@}
+
+    ~InlineFunction() { reset(); }
+
+    //! Destroy the callable, leaving the InlineFunction empty
+    void reset() noexcept {
+        if (_ops) {
+            _ops->destroy(_storage);
+            _ops = nullptr;
+        }
+    }
+
+    //! Call the callable; throws std::bad_function_call if empty
+    R operator()(Args... args) const {
+        if (not _ops) {
+            throw std::bad_function_call();
+        }
+        return _ops->invoke(_storage, std::forward<Args>(args)...);
+    }
+
+    //! Whether a callable is held
+    explicit operator bool() const { return _ops != nullptr; }
+};
+
+//! \class InlineFunction
+//! Like std::function, but move-only, and with room for `Capacity` bytes of callable inside the
+//! object itself (64 by default: enough for a lambda capturing eight pointers, or a std::function).
+//! A callable that fits, and whose move constructor cannot throw, is constructed in place, so
+//! creating, moving, and destroying the InlineFunction never touches the heap. A larger callable is
+//! allocated, as std::function would; stored_inline tells which case applies.
+
+#endif  // SPONGE_LIBSPONGE_INLINE_FUNCTION_HH
@@ -0,0 +1,208 @@
+#include "resolver.hh"
+
+#include "util.hh"
+
+#include <exception>
+#include <iterator>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <utility>
+
+using namespace std;
+
+Resolver::Resolver() : Resolver(Options{}) {}
+
+//! \param[in] options are the caching policy
+Resolver::Resolver(const Options &options) : _options(options) {}
+
+//! \returns the Address that was resolved
+//! \details Throws the exception that resolving the name threw, if it failed.
+const Address &Resolver::Answer::address() const {
+    if (not _address) {
+        rethrow_exception(_error);
+    }
+    return *_address;
+}
+
+//! \param[in] hostname is the name to resolve
+//! \param[in] service is the service name or port number
+//! \returns Resolver::_key, which is reused so that a lookup only allocates when it misses
+const string &Resolver::_make_key(const string &hostname, const string &service) {
+    _key.assign(hostname).append(1, '\0').append(service);
+    return _key;
+}
+
+//! \returns the answer, or `nullptr` if it isn't cached (or has expired, in which case it is dropped)
+const Resolver::Answer *Resolver::_find() {
+    const auto entry = _cache.find(_key);
+    if (entry == _cache.end()) {
+        _misses++;
+        return nullptr;
+    }
+    if (entry->second.expires_ms <= timestamp_ms()) {
+        _cache.erase(entry);
+        _misses++;
+        return nullptr;
+    }
+    _hits++;
+    return &entry->second.answer;
+}
+
+//! \param[in] key is the cache key
+//! \param[in] answer is the answer to cache
+//! \returns the cached answer
+//! \details A full cache drops its expired answers, or if none has expired, an arbitrary one.
+const Resolver::Answer &Resolver::_store(const string &key, Answer answer) {
+    const uint64_t now = timestamp_ms();
+    if (_cache.size() >= _options.max_entries and _cache.find(key) == _cache.end()) {
+        for (auto it = _cache.begin(); it != _cache.end();) {
+            it = it->second.expires_ms <= now ? _cache.erase(it) : next(it);
+        }
+        if (_cache.size() >= _options.max_entries and not _cache.empty()) {
+            _cache.erase(_cache.begin());
+        }
+    }
+
+    const uint64_t ttl_ms = answer.ok() ? _options.ttl_ms : _options.negative_ttl_ms;
+    auto &entry = _cache.insert_or_assign(key, Entry{move(answer), now + ttl_ms}).first->second;
+    return entry.answer;
+}
+
+//! \param[in] key is a cache key made by _make_key()
+//! \returns the Address, or the exception that resolving the name threw
+Resolver::Answer Resolver::_resolve(const string &key) {
+    const size_t separator = key.find('\0');
+    try {
+        return Answer{Address(key.substr(0, separator), key.substr(separator + 1))};
+    } catch (...) {
+        return Answer{current_exception()};
+    }
+}
+
+//! \param[in] hostname is the name to resolve
+//! \param[in] service is the service name (from `/etc/services`, e.g., "http") or port number
+//! \returns the Address, as Address(hostname, service) would
+//! \details A failed lookup throws what Address(hostname, service) threw, whether it was cached or not.
+Address Resolver::resolve(const string &hostname, const string &service) {
+    _make_key(hostname, service);
+    if (const Answer *cached = _find()) {
+        return cached->address();
+    }
+    const string key = _key;
+    return _store(key, _resolve(key)).address();
+}
+
+//! \param[in] loop is the EventLoop to deliver the answer on (the same one on every call)
+//! \param[in] hostname is the name to resolve
+//! \param[in] service is the service name (from `/etc/services`, e.g., "http") or port number
+//! \param[in] callback is called with the answer: before resolve_async returns if it is cached, or
+//!                     otherwise from within a later call to loop.wait_next_event
+void Resolver::resolve_async(EventLoop &loop, const string &hostname, const string &service, CallbackT callback) {
+    if (_loop and _loop != &loop) {
+        throw runtime_error("Resolver: resolve_async called with a second EventLoop");
+    }
+
+    _make_key(hostname, service);
+    if (const Answer *cached = _find()) {
+        const Answer answer = *cached;  // (the callback may use the Resolver, which may drop the entry)
+        callback(answer);
+        return;
+    }
+
+    // a lookup already in flight will answer this one, too
+    auto &waiting = _waiting[_key];
+    waiting.push_back(move(callback));
+    if (waiting.size() > 1) {
+        return;
+    }
+
+    if (not _loop) {
+        _start(loop);
+    }
+    {
+        lock_guard<mutex> lock{_mutex};
+        _requests.push_back({_key});
+    }
+    _wakeup.notify_one();
+}
+
+//! \param[in] loop is the EventLoop to deliver answers on
+void Resolver::_start(EventLoop &loop) {
+    _loop = &loop;
+    _done.emplace(SystemCall("eventfd", ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)));
+    _delivering = loop.add_rule(
+        *_done, Direction::In, [this] { _deliver(); }, [this] { return not _waiting.empty(); });
+    _helper = thread([this] { _run_helper(); });
+}
+
+void Resolver::_run_helper() {
+    unique_lock<mutex> lock{_mutex};
+    while (true) {
+        _wakeup.wait(lock, [&] { return _stopping or not _requests.empty(); });
+        if (_stopping) {
+            return;
+        }
+
+        Lookup lookup = move(_requests.front());
+        _requests.pop_front();
+        lock.unlock();
+        lookup.answer = _resolve(lookup.key);
+        lock.lock();
+
+        // the first answer in a batch wakes the EventLoop
+        _answers.push_back(move(lookup));
+        if (_answers.size() == 1) {
+            const uint64_t one = 1;
+            SystemCall("write", ::write(_done->fd_num(), &one, sizeof(one)));
+        }
+    }
+}
+
+//! \details Every answer is stored, and its callbacks taken, before any callback runs, and a callback
+//! that throws doesn't stop the others: the first exception is rethrown once the batch is done.
+void Resolver::_deliver() {
+    _done->read(sizeof(uint64_t));
+    vector<Lookup> answers;
+    {
+        lock_guard<mutex> lock{_mutex};
+        swap(answers, _answers);
+    }
+
+    vector<pair<Answer, vector<CallbackT>>> deliveries;
+    deliveries.reserve(answers.size());
+    for (auto &lookup : answers) {
+        Answer answer = _store(lookup.key, move(*lookup.answer));  // (the callbacks may use the Resolver)
+        auto waiting = _waiting.extract(lookup.key);
+        deliveries.emplace_back(move(answer), move(waiting.mapped()));
+    }
+
+    exception_ptr error{};
+    for (const auto &[answer, callbacks] : deliveries) {
+        for (const auto &callback : callbacks) {
+            try {
+                callback(answer);
+            } catch (...) {
+                if (not error) {
+                    error = current_exception();
+                }
+            }
+        }
+    }
+    if (error) {
+        rethrow_exception(error);
+    }
+}
+
+Resolver::~Resolver() {
+    if (not _loop) {
+        return;
+    }
+    {
+        lock_guard<mutex> lock{_mutex};
+        _stopping = true;
+    }
+    _wakeup.notify_one();
+    _helper.join();
+    _delivering.cancel();
+}
@@ -0,0 +1,150 @@
+#ifndef SPONGE_LIBSPONGE_RESOLVER_HH
+#define SPONGE_LIBSPONGE_RESOLVER_HH
+
+#include "address.hh"
+#include "eventloop.hh"
+#include "file_descriptor.hh"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+//! Resolves hostnames to Addresses, caching the answers (and the failures) for a while
+class Resolver {
+  public:
+    //! How long answers are cached, and how many
+    struct Options {
+        uint64_t ttl_ms = 60'000;          //!< How long an Address is cached
+        uint64_t negative_ttl_ms = 5'000;  //!< How long a failed lookup is cached
+        size_t max_entries = 4096;         //!< The most answers to cache
+    };
+
+    //! The outcome of a lookup: an Address, or the exception that resolving the name threw
+    class Answer {
+      private:
+        std::optional<Address> _address{};  //!< The Address, if the lookup succeeded
+        std::exception_ptr _error{};        //!< The exception, if it failed
+
+      public:
+        //! Construct a successful answer
+        explicit Answer(const Address &address) : _address(address) {}
+
+        //! Construct a failed answer
+        explicit Answer(std::exception_ptr error) : _error(std::move(error)) {}
+
+        //! Whether the lookup succeeded
+        bool ok() const { return _address.has_value(); }
+
+        //! The Address, or (if the lookup failed) its exception is rethrown
+        const Address &address() const;
+    };
+
+    //! Called with the answer to resolve_async()
+    using CallbackT = std::function<void(const Answer &answer)>;
+
+  private:
+    //! A cached answer
+    struct Entry {
+        Answer answer;        //!< The answer
+        uint64_t expires_ms;  //!< When to stop using it (see timestamp_ms())
+    };
+
+    //! A lookup for the helper thread, or its answer
+    struct Lookup {
+        std::string key;                 //!< The cache key: the hostname and service, separated by a NUL
+        std::optional<Answer> answer{};  //!< Filled in by the helper thread
+    };
+
+    Options _options;                                 //!< The caching policy
+    std::unordered_map<std::string, Entry> _cache{};  //!< Answers by key
+    std::string _key{};                               //!< Reused to build keys without allocating
+    uint64_t _hits = 0;                               //!< Lookups answered from the cache
+    uint64_t _misses = 0;                             //!< Lookups that had to resolve the name
+
+    //! The callbacks waiting for each lookup in flight
+    std::unordered_map<std::string, std::vector<CallbackT>> _waiting{};
+
+    //! \name Asynchronous mode (see resolve_async())
+    //!@{
+    EventLoop *_loop = nullptr;             //!< The EventLoop that answers are delivered on
+    std::optional<FileDescriptor> _done{};  //!< An [eventfd(2)](\ref man2::eventfd) the helper signals
+    EventLoop::RuleHandle _delivering{};    //!< The Rule that delivers answers
+    std::thread _helper{};                  //!< Resolves names without blocking the EventLoop
+    std::mutex _mutex{};                    //!< Guards Resolver::_requests, _answers, and _stopping
+    std::condition_variable _wakeup{};      //!< Signals the helper that there is work (or that it should stop)
+    std::deque<Lookup> _requests{};         //!< Lookups for the helper
+    std::vector<Lookup> _answers{};         //!< Lookups the helper has finished
+    bool _stopping = false;                 //!< Tells the helper to stop
+    //!@}
+
+    //! Set Resolver::_key for `hostname` and `service`
+    const std::string &_make_key(const std::string &hostname, const std::string &service);
+
+    //! The cached answer for Resolver::_key, if it hasn't expired (counting a hit or a miss)
+    const Answer *_find();
+
+    //! Cache `answer` for `key`, making room if the cache is full
+    const Answer &_store(const std::string &key, Answer answer);
+
+    //! Resolve the name in a cache key, catching the failure
+    static Answer _resolve(const std::string &key);
+
+    //! Start the helper thread and the Rule that delivers its answers on `loop`
+    void _start(EventLoop &loop);
+
+    //! Resolve names until told to stop (runs on Resolver::_helper)
+    void _run_helper();
+
+    //! Cache the helper's answers and call their callbacks (runs from the Rule on Resolver::_loop)
+    void _deliver();
+
+  public:
+    //! Construct with the default caching policy
+    Resolver();
+
+    //! Construct with a caching policy
+    explicit Resolver(const Options &options);
+
+    //! Stops the helper thread (waiting for a lookup in progress) and cancels the Rule it uses
+    ~Resolver();
+
+    Resolver(const Resolver &other) = delete;             //!< \brief Not copyable
+    Resolver &operator=(const Resolver &other) = delete;  //!< \brief Not copyable
+
+    //! Resolve `hostname` and `service`, from the cache if possible, blocking while the name is resolved
+    Address resolve(const std::string &hostname, const std::string &service);
+
+    //! Resolve `hostname` and `service` without blocking, and call `callback` with the answer
+    void resolve_async(EventLoop &loop, const std::string &hostname, const std::string &service, CallbackT callback);
+
+    //! \name Statistics
+    //!@{
+    size_t size() const { return _cache.size(); }  //!< \brief answers cached (some may have expired)
+    uint64_t hits() const { return _hits; }        //!< \brief lookups answered from the cache
+    uint64_t misses() const { return _misses; }    //!< \brief lookups that had to resolve the name
+    //!@}
+};
+
+//! \class Resolver
+//! [getaddrinfo(3)](\ref man3::getaddrinfo), which Address uses to resolve a hostname, blocks until the
+//! answer arrives, and does not say how long the answer may be kept. A Resolver keeps each answer for a
+//! fixed time (Options::ttl_ms), and each failure for a shorter one (Options::negative_ttl_ms), so a
+//! repeated lookup costs a hash probe. resolve_async() resolves names on a helper thread, so a slow DNS
+//! server doesn't stall the EventLoop; the answers are delivered from within EventLoop::wait_next_event
+//! by a Rule that keeps the EventLoop running while any lookup is in flight. Concurrent lookups of the
+//! same name share one resolution. An exception thrown by a callback propagates out of wait_next_event,
+//! but only after every answer that arrived with it has been cached and delivered.
+//!
+//! A Resolver is not thread-safe: use it from one thread, and (once resolve_async() has been called)
+//! only with one EventLoop, which must outlive it.
+
+#endif  // SPONGE_LIBSPONGE_RESOLVER_HH
@@ -0,0 +1,171 @@
+#include "sharded_runtime.hh"
+
+#include "util.hh"
+
+#include <algorithm>
+#include <iostream>
+#include <sched.h>
+#include <stdexcept>
+#include <utility>
+
+using namespace std;
+
+//! \returns `true` if any connection was accepted
+bool ShardedRuntime::Shard::_accept() {
+    // take at most a batch per wait, so that the shard's other Rules are still served during a storm
+    constexpr size_t batch_size = 64;
+    _incoming.clear();
+    int resource_error = 0;
+    const size_t accepted = _listener.accept_batch(_incoming, batch_size, &resource_error);
+    if (resource_error) {
+        _back_off();
+    }
+
+    for (auto &connection : _incoming) {
+        _accepted.add();
+        _on_accept(*this, move(connection));
+    }
+    _incoming.clear();
+    return accepted > 0;
+}
+
+//! \details The listener stays readable while connections wait in its backlog, so instead of failing on
+//! every wait, the Rule is paused and a timer resumes it. Nothing is done once the shard is stopping.
+void ShardedRuntime::Shard::_back_off() {
+    if (not _accepting.active() or _accepting.paused()) {
+        return;
+    }
+
+    _accepting.pause();
+    _retry = _loop.add_timer(timestamp_ms() + ACCEPT_RETRY_MS, [&] { _accepting.resume(); });
+}
+
+//! \param[in] cpu is the CPU to run on, if the shard should be pinned
+void ShardedRuntime::Shard::_run(const optional<int> cpu) {
+    try {
+        if (cpu) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(*cpu, &cpus);
+            SystemCall("sched_setaffinity", ::sched_setaffinity(0, sizeof(cpus), &cpus));
+        }
+
+        // accept promptly, even while the shard's connections keep the loop busy
+        EventLoop::RuleOptions options;
+        options.priority = EventLoop::Priority::High;
+        _accepting = _loop.add_rule(
+            _listener, Direction::In, [&] { _accept(); }, {}, {}, options);
+
+        while (_loop.wait_next_event(-1) != EventLoop::Result::Exit) {
+        }
+    } catch (...) {
+        _error = current_exception();
+    }
+}
+
+void ShardedRuntime::Shard::_stop() {
+    if (not _accepting.cancel()) {
+        return;
+    }
+    _retry.cancel();
+
+    while (_accept()) {
+    }
+    _listener.close();
+}
+
+//! \param[in] address is the address for every listener
+//! \param[in] shard_count is the number of shards to create
+//! \returns the shards, with listeners bound and listening
+vector<unique_ptr<ShardedRuntime::Shard>> ShardedRuntime::_make_shards(const Address &address,
+                                                                        const size_t shard_count) {
+    if (shard_count == 0) {
+        throw runtime_error("ShardedRuntime: need at least one shard");
+    }
+
+    vector<unique_ptr<Shard>> shards;
+    optional<Address> bound_address;
+    for (size_t i = 0; i < shard_count; i++) {
+        shards.push_back(make_unique<Shard>(i, _on_accept, address));
+        TCPSocket &listener = shards.back()->_listener;
+        listener.set_reuseaddr();
+        listener.set_reuseport();
+        listener.bind(bound_address ? *bound_address : address);
+        listener.listen(SOMAXCONN);
+        listener.set_blocking(false);
+        if (not bound_address) {
+            bound_address = listener.local_address();
+        }
+    }
+    return shards;
+}
+
+//! \param[in] address is the address to listen on (port 0 picks an unused port, shared by every shard)
+//! \param[in] on_accept is called, on the accepting shard's thread, with each new connection
+//! \param[in] shard_count is the number of shards (threads) to run
+//! \param[in] pin is whether to pin each shard's thread to its own CPU
+ShardedRuntime::ShardedRuntime(const Address &address,
+                               const AcceptT &on_accept,
+                               const size_t shard_count,
+                               const bool pin)
+    : _on_accept(on_accept)
+    , _shards(_make_shards(address, shard_count))
+    , _address(_shards.front()->_listener.local_address()) {
+    vector<int> cpus;
+    if (pin) {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        SystemCall("sched_getaffinity", ::sched_getaffinity(0, sizeof(allowed), &allowed));
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+
+    for (auto &shard : _shards) {
+        const optional<int> cpu = cpus.empty() ? nullopt : optional<int>(cpus[shard->_index % cpus.size()]);
+        Shard *const this_shard = shard.get();
+        shard->_thread = thread([this_shard, cpu] { this_shard->_run(cpu); });
+    }
+}
+
+ShardedRuntime::~ShardedRuntime() {
+    try {
+        stop();
+        wait();
+    } catch (const exception &e) {
+        cerr << "Exception in ShardedRuntime: " << e.what() << endl;
+    }
+}
+
+void ShardedRuntime::stop() {
+    for (auto &shard : _shards) {
+        Shard *const this_shard = shard.get();
+        shard->_loop.post([this_shard] { this_shard->_stop(); });
+    }
+}
+
+//! \details Only waits; call stop() first, or wait() will not return until something else does.
+void ShardedRuntime::wait() {
+    for (auto &shard : _shards) {
+        if (shard->_thread.joinable()) {
+            shard->_thread.join();
+        }
+    }
+
+    for (auto &shard : _shards) {
+        if (shard->_error) {
+            rethrow_exception(exchange(shard->_error, nullptr));
+        }
+    }
+}
+
+size_t ShardedRuntime::default_shard_count() {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (::sched_getaffinity(0, sizeof(allowed), &allowed) == 0 and CPU_COUNT(&allowed) > 0) {
+        return CPU_COUNT(&allowed);
+    }
+    return max(1u, thread::hardware_concurrency());
+}
@@ -0,0 +1,136 @@
+#ifndef SPONGE_LIBSPONGE_SHARDED_RUNTIME_HH
+#define SPONGE_LIBSPONGE_SHARDED_RUNTIME_HH
+
+#include "address.hh"
+#include "eventloop.hh"
+#include "socket.hh"
+#include "stats.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+//! Runs one EventLoop per thread, each pinned to a CPU and accepting connections on its own listener
+class ShardedRuntime {
+  public:
+    class Shard;
+
+    //! Called on a Shard's thread with each connection the Shard accepts (non-blocking and close-on-exec)
+    using AcceptT = std::function<void(Shard &shard, TCPSocket &&connection)>;
+
+    //! \brief One thread's share of the runtime.
+    //! \details Apart from index() and accepted_count(), a Shard must only be used from its own
+    //! thread, e.g. from within an AcceptT callback or a callback installed on its loop().
+    class Shard {
+      private:
+        size_t _index;                       //!< Position in ShardedRuntime::_shards
+        const AcceptT &_on_accept;           //!< The ShardedRuntime's accept callback
+        EventLoop _loop{};                   //!< This Shard's EventLoop
+        TCPSocket _listener;                 //!< This Shard's listener, bound with SO_REUSEPORT
+        EventLoop::RuleHandle _accepting{};  //!< The Rule that accepts connections on Shard::_listener
+        EventLoop::TimerHandle _retry{};     //!< Resumes Shard::_accepting after it ran out of descriptors
+        std::vector<TCPSocket> _incoming{};  //!< Connections accepted but not yet handed to Shard::_on_accept
+        StatCounter _accepted{};             //!< Connections accepted so far
+        std::thread _thread{};               //!< Runs Shard::_loop
+        std::exception_ptr _error{};         //!< The exception that ended Shard::_thread, if any
+
+        friend class ShardedRuntime;
+
+        //! Accept a batch of connections and hand each to Shard::_on_accept; returns `false` if none was waiting
+        bool _accept();
+
+        //! Pause Shard::_accepting for a while, after accepting failed for lack of descriptors or memory
+        void _back_off();
+
+        //! Run the EventLoop until it has been stopped and every Rule is gone (runs on Shard::_thread)
+        void _run(const std::optional<int> cpu);
+
+        //! Stop accepting: take the connections already queued, then close the listener
+        void _stop();
+
+      public:
+        //! How long a Shard stops accepting after running out of descriptors or memory
+        static constexpr uint64_t ACCEPT_RETRY_MS = 100;
+
+        //! Construct a Shard whose accepted connections go to `on_accept`, with a listener for `address`'s family
+        Shard(const size_t index, const AcceptT &on_accept, const Address &address)
+            : _index(index), _on_accept(on_accept), _listener(address.family()) {}
+
+        //! \name Accessors
+        //!@{
+        size_t index() const { return _index; }                        //!< \brief position among the shards
+        EventLoop &loop() { return _loop; }                            //!< \brief this Shard's EventLoop
+        uint64_t accepted_count() const { return _accepted.value(); }  //!< \brief connections accepted so far
+        //!@}
+    };
+
+  private:
+    AcceptT _on_accept;                           //!< Called with each accepted connection
+    std::vector<std::unique_ptr<Shard>> _shards;  //!< The shards, in order of index
+    Address _address;                             //!< The address every listener is bound to
+
+    //! Create the shards, each with a listener bound to `address` (with port 0, all get the first one's port)
+    std::vector<std::unique_ptr<Shard>> _make_shards(const Address &address, const size_t shard_count);
+
+  public:
+    //! Bind `shard_count` listeners to `address`, then start a thread for each, pinned to a CPU if `pin`
+    ShardedRuntime(const Address &address,
+                   const AcceptT &on_accept,
+                   const size_t shard_count = default_shard_count(),
+                   const bool pin = true);
+
+    //! Stops the runtime and waits for every shard to finish
+    ~ShardedRuntime();
+
+    //! A ShardedRuntime cannot be copied or moved, since its threads refer to it
+
+    //!@{
+    ShardedRuntime(const ShardedRuntime &other) = delete;
+    ShardedRuntime &operator=(const ShardedRuntime &other) = delete;
+    ShardedRuntime(ShardedRuntime &&other) = delete;
+    ShardedRuntime &operator=(ShardedRuntime &&other) = delete;
+    //!@}
+
+    //! Ask every shard to stop accepting connections; safe to call from any thread, including a shard's
+    void stop();
+
+    //! Wait for every shard's thread to finish, then rethrow the first exception any of them threw
+    void wait();
+
+    //! \name Accessors
+    //!@{
+    const Address &address() const { return _address; }    //!< \brief the address the listeners are bound to
+    size_t shard_count() const { return _shards.size(); }  //!< \brief number of shards (and threads)
+
+    //! \brief connections accepted so far by one shard (may be called from any thread)
+    uint64_t accepted_count(const size_t shard) const { return _shards.at(shard)->accepted_count(); }
+    //!@}
+
+    //! Number of CPUs this process may run on (at least one)
+    static size_t default_shard_count();
+};
+
+//! \class ShardedRuntime
+//! Each shard owns a thread, an EventLoop, and a TCPSocket listening on the same address with
+//! [SO_REUSEPORT](\ref man7::socket), so the kernel spreads incoming connections across the shards by
+//! hashing each connection's addresses and ports. A connection is accepted, handed to the AcceptT
+//! callback, and served entirely on one shard, so nothing on the hot path is shared between threads.
+//! Each wakeup of a shard's listener accepts a batch of connections with TCPSocket::accept_batch (one
+//! system call per connection, and none to make it non-blocking), so a connection storm is absorbed
+//! quickly without starving the connections the shard already has. A connection that fails before it
+//! is accepted is skipped. When the process runs out of descriptors (or the kernel out of memory),
+//! the shard stops accepting for Shard::ACCEPT_RETRY_MS and leaves the rest of the backlog queued;
+//! its thread, and its connections, carry on.
+//! With `pin` set, shard i runs on the i-th CPU the process is allowed to use (wrapping around).
+//!
+//! stop() posts a task to each shard (see EventLoop::post) that accepts whatever is already queued on
+//! its listener (closing a SO_REUSEPORT listener would reset those connections) and then closes the
+//! listener. Each shard's thread keeps running until its EventLoop has no Rule or timer left, so
+//! connections in progress finish normally; wait() then returns. The destructor calls stop() and wait().
+
+#endif  // SPONGE_LIBSPONGE_SHARDED_RUNTIME_HH
@@ -2,40 +2,68 @@
 
 #include "util.hh"
 
+#include <algorithm>
+#include <array>
+#include <cerrno>
 #include <cstddef>
+#include <cstring>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <stdexcept>
 #include <unistd.h>
 
 using namespace std;
 
 // default constructor for socket of (subclassed) domain and type
-//! \param[in] domain is as described in [socket(7)](\ref man7::socket), probably `AF_INET` or `AF_UNIX`
+//! \param[in] domain is as described in [socket(7)](\ref man7::socket), probably `AF_INET`, `AF_INET6`, or `AF_UNIX`
 //! \param[in] type is as described in [socket(7)](\ref man7::socket)
-Socket::Socket(const int domain, const int type) : FileDescriptor(SystemCall("socket", socket(domain, type, 0))) {}
+//! \details An `AF_INET6` socket is made dual-stack, whatever the `net.ipv6.bindv6only` default.
+Socket::Socket(const int domain, const int type)
+    : FileDescriptor(SystemCall("socket", socket(domain, type, 0))), _domain(domain) {
+    if (domain == AF_INET6) {
+        set_ipv6_only(false);
+    }
+}
 
 // construct from file descriptor
 //! \param[in] fd is the FileDescriptor from which to construct
 //! \param[in] domain is `fd`'s domain; throws std::runtime_error if wrong value is supplied
 //! \param[in] type is `fd`'s type; throws std::runtime_error if wrong value is supplied
-Socket::Socket(FileDescriptor &&fd, const int domain, const int type) : FileDescriptor(move(fd)) {
+Socket::Socket(FileDescriptor &&fd, const int domain, const int type) : FileDescriptor(move(fd)), _domain(domain) {
     int actual_value;
     socklen_t len;
 
     // verify domain
     len = sizeof(actual_value);
-    SystemCall("getsockopt", getsockopt(fd_num(), SOL_SOCKET, SO_DOMAIN, &actual_value, &len));
+    SystemCall("getsockopt", ::getsockopt(fd_num(), SOL_SOCKET, SO_DOMAIN, &actual_value, &len));
     if ((len != sizeof(actual_value)) or (actual_value != domain)) {
         throw runtime_error("socket domain mismatch");
     }
 
     // verify type
     len = sizeof(actual_value);
-    SystemCall("getsockopt", getsockopt(fd_num(), SOL_SOCKET, SO_TYPE, &actual_value, &len));
+    SystemCall("getsockopt", ::getsockopt(fd_num(), SOL_SOCKET, SO_TYPE, &actual_value, &len));
     if ((len != sizeof(actual_value)) or (actual_value != type)) {
         throw runtime_error("socket type mismatch");
     }
 }
 
+// construct from an IPv4 or IPv6 file descriptor
+//! \param[in] fd is the FileDescriptor from which to construct
+//! \param[in] type is `fd`'s type; throws std::runtime_error if wrong value is supplied
+//! \details Throws std::runtime_error if `fd` is neither an `AF_INET` nor an `AF_INET6` socket.
+Socket::Socket(FileDescriptor &&fd, const int type)
+    : FileDescriptor(move(fd)), _domain(getsockopt<int>(SOL_SOCKET, SO_DOMAIN)) {
+    if (_domain != AF_INET and _domain != AF_INET6) {
+        throw runtime_error("socket domain mismatch");
+    }
+    if (getsockopt<int>(SOL_SOCKET, SO_TYPE) != type) {
+        throw runtime_error("socket type mismatch");
+    }
+}
+
 // get the local or peer address the socket is connected to
 //! \param[in] name_of_function is the function to call (string passed to SystemCall())
 //! \param[in] function is a pointer to the function
@@ -56,13 +84,57 @@ Address Socket::local_address() const { return get_address("getsockname", getsoc
 //! \returns the socket's peer's Address
 Address Socket::peer_address() const { return get_address("getpeername", getpeername); }
 
+//! \param[in] address is an Address to bind or connect to
+//! \returns `address`, mapped into IPv6 if it is an IPv4 address and this is an IPv6 (dual-stack) socket
+Address Socket::_for_domain(const Address &address) const {
+    return _domain == AF_INET6 ? address.ipv4_mapped() : address;
+}
+
 // bind socket to a specified local address (usually to listen/accept)
 //! \param[in] address is a local Address to bind
-void Socket::bind(const Address &address) { SystemCall("bind", ::bind(fd_num(), address, address.size())); }
+void Socket::bind(const Address &address) {
+    const Address local = _for_domain(address);
+    SystemCall("bind", ::bind(fd_num(), local, local.size()));
+}
 
 // connect socket to a specified peer address
 //! \param[in] address is the peer's Address
-void Socket::connect(const Address &address) { SystemCall("connect", ::connect(fd_num(), address, address.size())); }
+void Socket::connect(const Address &address) {
+    const Address peer = _for_domain(address);
+    SystemCall("connect", ::connect(fd_num(), peer, peer.size()));
+}
+
+// start connecting to a peer without waiting for the connection
+//! \param[in] address is the peer's Address
+//! \returns `true` if the connection was made at once, or `false` if it is in progress; either way the
+//!          socket becomes writable once the attempt has finished, and finish_connect() tells how it went
+//! \details See also EventLoop::add_connect, which does the waiting.
+bool Socket::start_connect(const Address &address) {
+    const Address peer = _for_domain(address);
+    return SystemCall("connect", ::connect(fd_num(), peer, peer.size()), EINPROGRESS) == 0;
+}
+
+// find out whether a connection started by start_connect() succeeded
+//! \details Reads (and clears) the socket's pending error with `SO_ERROR`; see [connect(2)](\ref man2::connect).
+void Socket::finish_connect() { _throw_pending_error("connect"); }
+
+//! \param[in] attempt is the operation that the error is reported for
+//! \details Reading the error with `SO_ERROR` clears it.
+void Socket::_throw_pending_error(const char *attempt) const {
+    const int error = getsockopt<int>(SOL_SOCKET, SO_ERROR);
+    if (error != 0) {
+        throw unix_error(attempt, error);
+    }
+}
+
+//! The timestamps in an `SCM_TIMESTAMPING` control message
+static Socket::packet_timestamp packet_timestamp_from(const cmsghdr *control) {
+    scm_timestamping timestamps{};
+    memcpy(&timestamps, CMSG_DATA(control), sizeof(timestamps));
+    const auto to_ns = [](const timespec &ts) { return uint64_t(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec; };
+    // (the middle one is deprecated, and always zero)
+    return {to_ns(timestamps.ts[0]), to_ns(timestamps.ts[2])};
+}
 
 // shut down a socket in the specified way
 //! \param[in] how can be `SHDN_RD`, `SHDN_WR`, or `SHDN_RDWR`; see [shutdown(2)](\ref man2::shutdown)
@@ -86,36 +158,46 @@ void Socket::shutdown(const int how) {
 
 //! \note If `mtu` is too small to hold the received datagram, this method throws a std::runtime_error
 void UDPSocket::recv(received_datagram &datagram, const size_t mtu) {
-    // receive source address and payload
+    // receive source address, payload, and (if enabled) timestamps
     Address::Raw datagram_source_address;
     datagram.payload.resize(mtu);
+    iovec iov{datagram.payload.data(), datagram.payload.size()};
+    control_buffer control;
 
-    socklen_t fromlen = sizeof(datagram_source_address);
+    msghdr message{};
+    message.msg_name = static_cast<sockaddr *>(datagram_source_address);
+    message.msg_namelen = sizeof(sockaddr_storage);
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.data;
+    message.msg_controllen = sizeof(control.data);
 
-    const ssize_t recv_len = SystemCall(
-        "recvfrom",
-        ::recvfrom(
-            fd_num(), datagram.payload.data(), datagram.payload.size(), MSG_TRUNC, datagram_source_address, &fromlen));
+    const ssize_t recv_len = traced_read("recvmsg", [&] { return ::recvmsg(fd_num(), &message, MSG_TRUNC); });
 
     if (recv_len > ssize_t(mtu)) {
-        throw runtime_error("recvfrom (oversized datagram)");
+        throw runtime_error("recvmsg (oversized datagram)");
     }
 
-    register_read();
-    datagram.source_address = {datagram_source_address, fromlen};
+    register_read(recv_len);
+    datagram.source_address = {datagram_source_address, message.msg_namelen};
     datagram.payload.resize(recv_len);
+    datagram.timestamp = {};
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET and cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            datagram.timestamp = packet_timestamp_from(cmsg);
+        }
+    }
 }
 
 UDPSocket::received_datagram UDPSocket::recv(const size_t mtu) {
-    received_datagram ret{{nullptr, 0}, ""};
+    received_datagram ret{{nullptr, 0}, "", {}};
     recv(ret, mtu);
     return ret;
 }
 
-void sendmsg_helper(const int fd_num,
-                    const sockaddr *destination_address,
-                    const socklen_t destination_address_len,
-                    const BufferViewList &payload) {
+void UDPSocket::sendmsg_helper(const sockaddr *destination_address,
+                               const socklen_t destination_address_len,
+                               const BufferViewList &payload) {
     auto iovecs = payload.as_iovecs();
 
     msghdr message{};
@@ -124,23 +206,171 @@ void sendmsg_helper(const int fd_num,
     message.msg_iov = iovecs.data();
     message.msg_iovlen = iovecs.size();
 
-    const ssize_t bytes_sent = SystemCall("sendmsg", ::sendmsg(fd_num, &message, 0));
+    const ssize_t bytes_sent = traced_write("sendmsg", [&] { return ::sendmsg(fd_num(), &message, 0); });
 
     if (size_t(bytes_sent) != payload.size()) {
         throw runtime_error("datagram payload too big for sendmsg()");
     }
+
+    register_write(bytes_sent);
 }
 
 void UDPSocket::sendto(const Address &destination, const BufferViewList &payload) {
-    sendmsg_helper(fd_num(), destination, destination.size(), payload);
-    register_write();
+    sendmsg_helper(destination, destination.size(), payload);
+}
+
+void UDPSocket::send(const BufferViewList &payload) { sendmsg_helper(nullptr, 0, payload); }
+
+// receive a batch of datagrams and the Addresses of their senders
+//! \param[in] batch holds the datagrams received, replacing those from the previous call
+//! \param[in] count is the most datagrams to receive (the kernel caps a call at `UIO_MAXIOV`, i.e. 1024)
+//! \param[in] mtu is the largest datagram expected; a larger one throws std::runtime_error
+//!                (with GRO enabled, datagrams are coalesced into ones of up to 65535 bytes)
+//! \returns the number of datagrams received, which is zero if the socket is non-blocking and none are waiting
+//! \details Waits (if the socket is blocking) for the first datagram only. Each datagram is received
+//! straight into storage from the batch's BufferPool, which becomes its payload without a copy; the payloads
+//! of the previous call are released first, so their storage is reused unless the caller kept them.
+//! \note A payload holds on to `mtu` bytes of storage until every copy of it is gone.
+size_t UDPSocket::recv_batch(ReceiveBatch &batch, const size_t count, const size_t mtu) {
+    batch._datagrams.clear();
+    batch._slots.clear();
+    batch._slots.resize(count);
+    batch._iovecs.resize(count);
+    batch._sources.resize(count);
+    batch._control.resize(count);
+    batch._headers.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        batch._slots[i] = batch._pool.acquire(mtu);
+        batch._iovecs[i] = {batch._slots[i]->data(), mtu};
+        auto &header = batch._headers[i].msg_hdr;
+        header = {};
+        header.msg_name = static_cast<sockaddr *>(batch._sources[i]);
+        header.msg_namelen = sizeof(sockaddr_storage);
+        header.msg_iov = &batch._iovecs[i];
+        header.msg_iovlen = 1;
+        header.msg_control = batch._control[i].data;
+        header.msg_controllen = sizeof(batch._control[i].data);
+    }
+
+    const ssize_t received = traced_read(
+        "recvmmsg",
+        [&] { return ::recvmmsg(fd_num(), batch._headers.data(), count, MSG_WAITFORONE, nullptr); },
+        EAGAIN);
+    if (received < 0) {
+        batch._slots.clear();
+        register_read();
+        return 0;
+    }
+
+    size_t bytes_received = 0;
+    for (size_t i = 0; i < size_t(received); i++) {
+        auto &header = batch._headers[i];
+        if (header.msg_hdr.msg_flags & MSG_TRUNC) {
+            throw runtime_error("recvmmsg (oversized datagram)");
+        }
+        bytes_received += header.msg_len;
+
+        // with GRO, a datagram may be several coalesced ones, all the given size but the last
+        size_t segment_size = 0;
+        packet_timestamp timestamp{};
+        msghdr &message = header.msg_hdr;
+        for (cmsghdr *control = CMSG_FIRSTHDR(&message); control; control = CMSG_NXTHDR(&message, control)) {
+            if (control->cmsg_level == SOL_UDP and control->cmsg_type == UDP_GRO) {
+                int gro_size = 0;
+                memcpy(&gro_size, CMSG_DATA(control), sizeof(gro_size));
+                segment_size = gro_size;
+            } else if (control->cmsg_level == SOL_SOCKET and control->cmsg_type == SCM_TIMESTAMPING) {
+                timestamp = packet_timestamp_from(control);
+            }
+        }
+
+        batch._datagrams.push_back({{batch._sources[i], header.msg_hdr.msg_namelen},
+                                    batch._pool.make(move(batch._slots[i]), header.msg_len),
+                                    segment_size,
+                                    timestamp});
+    }
+
+    // hand the unused storage back to the pool
+    batch._slots.clear();
+    register_read(bytes_received);
+    return received;
 }
 
-void UDPSocket::send(const BufferViewList &payload) {
-    sendmsg_helper(fd_num(), nullptr, 0, payload);
-    register_write();
+// send a batch of datagrams
+//! \param[in] datagrams are the datagrams to send, in order (with GSO, a payload may be up to 64 segments,
+//!                      and 65507 bytes, long)
+//! \param[in] count is the number of datagrams
+//! \returns the number of datagrams sent, which is less than `count` if the socket is non-blocking and its
+//!          send buffer filled up, or (blocking or not) if sending a datagram failed after others had been sent
+//! \details [sendmmsg(2)](\ref man2::sendmmsg) only reports an error for the first datagram of a call; when
+//! a later one fails, it returns the number sent before it and the error is lost. send_batch() stops there
+//! too, so to find out why, send the rest again: an error for the first of them is thrown (as is an error
+//! for the very first datagram).
+size_t UDPSocket::send_batch(const outgoing_datagram *datagrams, const size_t count) {
+    // each sendmmsg(2) call takes a chunk of the datagrams, described on the stack
+    constexpr size_t chunk_size = 128;
+    array<mmsghdr, chunk_size> headers;
+    array<iovec, chunk_size> iovecs;
+    array<control_buffer, chunk_size> control;
+
+    size_t sent = 0, bytes_sent = 0;
+    while (sent < count) {
+        const size_t chunk = min(chunk_size, count - sent);
+        for (size_t i = 0; i < chunk; i++) {
+            const auto &datagram = datagrams[sent + i];
+            iovecs[i] = {const_cast<char *>(datagram.payload.data()), datagram.payload.size()};
+            auto &header = headers[i].msg_hdr;
+            header = {};
+            header.msg_name = const_cast<sockaddr *>(static_cast<const sockaddr *>(datagram.destination));
+            header.msg_namelen = datagram.destination.size();
+            header.msg_iov = &iovecs[i];
+            header.msg_iovlen = 1;
+
+            if (datagram.segment_size) {
+                header.msg_control = control[i].data;
+                header.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+                cmsghdr *segment = CMSG_FIRSTHDR(&header);
+                segment->cmsg_level = SOL_UDP;
+                segment->cmsg_type = UDP_SEGMENT;
+                segment->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                memcpy(CMSG_DATA(segment), &datagram.segment_size, sizeof(uint16_t));
+            }
+        }
+
+        const ssize_t chunk_sent =
+            traced_write("sendmmsg", [&] { return ::sendmmsg(fd_num(), headers.data(), chunk, 0); }, EAGAIN);
+        if (chunk_sent < 0) {
+            break;
+        }
+
+        for (size_t i = 0; i < size_t(chunk_sent); i++) {
+            if (headers[i].msg_len != iovecs[i].iov_len) {
+                throw runtime_error("datagram payload too big for sendmmsg()");
+            }
+            bytes_sent += headers[i].msg_len;
+        }
+        sent += chunk_sent;
+        if (size_t(chunk_sent) < chunk) {
+            break;
+        }
+    }
+
+    register_write(bytes_sent, sent < count);
+    return sent;
 }
 
+// segment large sends (generic segmentation offload)
+//! \param[in] segment_size is the size of the datagrams each send is split into; the last may be shorter
+//! \details Segmentation happens in the kernel (or the NIC) after the whole payload has gone through the
+//! stack once, so a large send costs about as much as one datagram. See also outgoing_datagram::segment_size.
+void UDPSocket::set_segment_size(const uint16_t segment_size) { setsockopt(SOL_UDP, UDP_SEGMENT, int(segment_size)); }
+
+// coalesce received datagrams (generic receive offload)
+//! \param[in] enabled is whether received datagrams may be coalesced
+//! \details The kernel coalesces consecutive equal-sized datagrams from one source into one large datagram,
+//! which recv_batch() reports with its received_buffer::segment_size; recv() can't tell them apart.
+void UDPSocket::set_gro(const bool enabled) { setsockopt(SOL_UDP, UDP_GRO, int(enabled)); }
+
 // mark the socket as listening for incoming connections
 //! \param[in] backlog is the number of waiting connections to queue (see [listen(2)](\ref man2::listen))
 void TCPSocket::listen(const int backlog) { SystemCall("listen", ::listen(fd_num(), backlog)); }
@@ -150,7 +380,80 @@ void TCPSocket::listen(const int backlog) { SystemCall("listen", ::listen(fd_num
 //! \note This function blocks until a new connection is available
 TCPSocket TCPSocket::accept() {
     register_read();
-    return TCPSocket(FileDescriptor(SystemCall("accept", ::accept(fd_num(), nullptr, nullptr))));
+    return TCPSocket(FileDescriptor(traced_read("accept", [&] { return ::accept(fd_num(), nullptr, nullptr); })),
+                     domain());
+}
+
+//! \returns whether an accept(2) failure concerns only the connection being accepted (or the call itself)
+static bool accept_error_is_transient(const int error) {
+    switch (error) {
+        case ECONNABORTED:
+        case EINTR:
+        // network errors already pending on the new connection, which Linux reports from accept(2)
+        case EPROTO:
+        case ENOPROTOOPT:
+        case EHOSTDOWN:
+        case ENONET:
+        case EHOSTUNREACH:
+        case EOPNOTSUPP:
+        case ENETDOWN:
+        case ENETUNREACH:
+            return true;
+        default:
+            return false;
+    }
+}
+
+//! \returns whether an accept(2) failure is for lack of descriptors or memory, which may pass in time
+static bool accept_error_is_resource(const int error) {
+    return error == EMFILE or error == ENFILE or error == ENOBUFS or error == ENOMEM;
+}
+
+// accept every waiting connection, up to a limit
+//! \param[out] connections receives the accepted connections (appended to what it already holds)
+//! \param[in] limit is the most connections to accept
+//! \param[out] resource_error if given, receives the errno that stopped the batch for lack of descriptors or
+//!             memory (`EMFILE`, `ENFILE`, `ENOBUFS`, or `ENOMEM`), or zero; such a failure is thrown otherwise
+//! \returns the number of connections accepted, which is less than `limit` only once the backlog is empty
+//!          (or, with `resource_error` given, once it has been set)
+//! \details Uses [accept4(2)](\ref man2::accept) with `SOCK_NONBLOCK | SOCK_CLOEXEC`, so each connection
+//! is ready for an EventLoop without further system calls (its domain is the listener's, so it isn't asked
+//! of the kernel either). The listening socket must be non-blocking.
+//!
+//! A connection that failed between arriving and being accepted (`ECONNABORTED`, or one of the network
+//! errors that Linux reports from accept(2), such as `EPROTO`) is skipped, as is an interrupted call.
+size_t TCPSocket::accept_batch(vector<TCPSocket> &connections, const size_t limit, int *resource_error) {
+    register_read();
+    if (resource_error) {
+        *resource_error = 0;
+    }
+
+    size_t accepted = 0;
+    while (accepted < limit) {
+        ssize_t fd = -1;
+        try {
+            fd = traced_read(
+                "accept4",
+                [&] { return ::accept4(fd_num(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC); },
+                EAGAIN);
+        } catch (const unix_error &e) {
+            const int error = e.code().value();
+            if (accept_error_is_transient(error)) {
+                continue;
+            }
+            if (resource_error and accept_error_is_resource(error)) {
+                *resource_error = error;
+                break;
+            }
+            throw;
+        }
+        if (fd < 0) {
+            break;
+        }
+        connections.push_back(TCPSocket(FileDescriptor(static_cast<int>(fd)), domain()));
+        accepted++;
+    }
+    return accepted;
 }
 
 // set socket option
@@ -163,6 +466,307 @@ void Socket::setsockopt(const int level, const int option, const option_type &op
     SystemCall("setsockopt", ::setsockopt(fd_num(), level, option, &option_value, sizeof(option_value)));
 }
 
+// get socket option
+//! \param[in] level The protocol level at which the argument resides
+//! \param[in] option A single option to get
+//! \returns the option's current value
+//! \details See [getsockopt(2)](\ref man2::getsockopt) for details.
+template <typename option_type>
+option_type Socket::getsockopt(const int level, const int option) const {
+    option_type option_value{};
+    socklen_t option_size = sizeof(option_value);
+    SystemCall("getsockopt", ::getsockopt(fd_num(), level, option, &option_value, &option_size));
+    return option_value;
+}
+
 // allow local address to be reused sooner, at the cost of some robustness
 //! \note Using `SO_REUSEADDR` may reduce the robustness of your application
 void Socket::set_reuseaddr() { setsockopt(SOL_SOCKET, SO_REUSEADDR, int(true)); }
+
+// let the kernel balance incoming connections (or datagrams) across sockets bound to the same address
+//! \note Every socket sharing the address must set `SO_REUSEPORT` before bind(), and belong to the same user
+void Socket::set_reuseport() { setsockopt(SOL_SOCKET, SO_REUSEPORT, int(true)); }
+
+// accept only IPv6 traffic, or IPv4 traffic too
+//! \param[in] only is whether to refuse IPv4 traffic (which a dual-stack socket sees from IPv4-mapped addresses)
+//! \note Must be set before bind() or connect(); only an `AF_INET6` socket has the option
+void Socket::set_ipv6_only(const bool only) { setsockopt(IPPROTO_IPV6, IPV6_V6ONLY, int(only)); }
+
+void Socket::set_send_buffer(const int bytes) { setsockopt(SOL_SOCKET, SO_SNDBUF, bytes); }
+int Socket::send_buffer() const { return getsockopt<int>(SOL_SOCKET, SO_SNDBUF); }
+
+void Socket::set_receive_buffer(const int bytes) { setsockopt(SOL_SOCKET, SO_RCVBUF, bytes); }
+int Socket::receive_buffer() const { return getsockopt<int>(SOL_SOCKET, SO_RCVBUF); }
+
+//! \note Raising the value above `net.core.busy_poll` needs `CAP_NET_ADMIN`
+void Socket::set_busy_poll(const int microseconds) { setsockopt(SOL_SOCKET, SO_BUSY_POLL, microseconds); }
+int Socket::busy_poll() const { return getsockopt<int>(SOL_SOCKET, SO_BUSY_POLL); }
+
+// ask the kernel for software timestamps, and hardware ones where the network device provides them
+//! \param[in] receive is whether to timestamp received packets: UDPSocket reports these with each datagram
+//! \param[in] transmit is whether to timestamp sent packets, which read_transmit_timestamps() reports
+//! \details Software timestamps are taken as the kernel receives a packet from the device, or hands one to
+//! it, so unlike a timestamp taken after a syscall returns, they don't include time spent in the socket's
+//! queues or waiting to be scheduled. They are in `CLOCK_REALTIME`, so they can be compared across hosts
+//! whose clocks are synchronized. Hardware timestamps are reported only if the device has been configured
+//! to take them (with the `SIOCSHWTSTAMP` ioctl, which needs `CAP_NET_ADMIN`). When no other socket on
+//! the host is timestamping received packets, the kernel takes a moment to start, so the first few
+//! datagrams may arrive without a timestamp.
+//!
+//! Each transmit timestamp has an id (`SOF_TIMESTAMPING_OPT_ID`) that tells which send it concerns: on a
+//! datagram socket, the number of sends made since transmit timestamping was enabled (counting from zero);
+//! on a TCP socket, the number of bytes sent since then, up to and including the send's last byte, minus one.
+//! A TCP socket also reports when the peer has acknowledged each send (TransmitStage::Acknowledged), which
+//! measures the round-trip time without the peer's cooperation.
+void Socket::set_timestamping(const bool receive, const bool transmit) {
+    int flags = 0;
+    if (receive) {
+        flags |= SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_RX_HARDWARE;
+    }
+    if (transmit) {
+        flags |= SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_OPT_ID
+                 | SOF_TIMESTAMPING_OPT_TSONLY;
+        if (getsockopt<int>(SOL_SOCKET, SO_TYPE) == SOCK_STREAM) {
+            flags |= SOF_TIMESTAMPING_TX_ACK;
+        }
+    }
+    if (flags) {
+        flags |= SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RAW_HARDWARE;  // (report them, too)
+    }
+    setsockopt(SOL_SOCKET, SO_TIMESTAMPING, flags);
+}
+
+//! \param[in] message is replaced by the message read (if any)
+//! \details See [recvmsg(2)](\ref man2::recvmsg) (`MSG_ERRQUEUE`), which never blocks. A message that
+//! doesn't carry an error has `ee_origin` `SO_EE_ORIGIN_NONE`.
+bool Socket::_read_error_queue(error_message &message) {
+    union {
+        cmsghdr header;                                                             // (for alignment)
+        char data[CMSG_SPACE(sizeof(scm_timestamping))                              // the timestamps,
+                  + CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in6))];  // and the error and its origin
+    } control{};
+    msghdr header{};
+    header.msg_control = static_cast<char *>(control.data);
+    header.msg_controllen = sizeof(control.data);
+
+    const ssize_t result =
+        traced_read("recvmsg", [&] { return ::recvmsg(fd_num(), &header, MSG_ERRQUEUE); }, EAGAIN);
+    register_read();
+    if (result < 0) {
+        return false;
+    }
+
+    message = {};
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&header); cmsg; cmsg = CMSG_NXTHDR(&header, cmsg)) {
+        if ((cmsg->cmsg_level == SOL_IP and cmsg->cmsg_type == IP_RECVERR)
+            or (cmsg->cmsg_level == SOL_IPV6 and cmsg->cmsg_type == IPV6_RECVERR)) {
+            memcpy(&message.error, CMSG_DATA(cmsg), sizeof(message.error));
+        } else if (cmsg->cmsg_level == SOL_SOCKET and cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            message.timestamp = packet_timestamp_from(cmsg);
+        }
+    }
+    return true;
+}
+
+//! \param[in] timestamps has the timestamps read appended to it
+//! \returns the number of timestamps read
+//! \details Reads the error queue until it is empty (see set_timestamping()), which is signaled by
+//! [poll(2)](\ref man2::poll) as an error; an EventLoop Rule with Direction::Error can call this. Other
+//! messages on the error queue are discarded, so a socket that sends with a ZeroCopySender should not
+//! also report transmit timestamps. If the queue was empty, the socket's pending error (if any) is
+//! thrown as a unix_error.
+size_t Socket::read_transmit_timestamps(vector<transmit_timestamp> &timestamps) {
+    error_message message{};
+    size_t count = 0;
+    for (bool first_read = true;; first_read = false) {
+        if (not _read_error_queue(message)) {
+            if (first_read) {
+                _throw_pending_error("sendmsg");
+            }
+            return count;
+        }
+
+        if (message.error.ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+            timestamps.push_back(
+                {message.error.ee_data, static_cast<TransmitStage>(message.error.ee_info), message.timestamp});
+            count++;
+        }
+    }
+}
+
+void TCPSocket::set_nodelay(const bool enabled) { setsockopt(IPPROTO_TCP, TCP_NODELAY, int(enabled)); }
+bool TCPSocket::nodelay() const { return getsockopt<int>(IPPROTO_TCP, TCP_NODELAY); }
+
+//! \note Uncorking (set_cork(false)) sends any partial segment that is being held back
+void TCPSocket::set_cork(const bool enabled) { setsockopt(IPPROTO_TCP, TCP_CORK, int(enabled)); }
+bool TCPSocket::cork() const { return getsockopt<int>(IPPROTO_TCP, TCP_CORK); }
+
+void TCPSocket::set_quickack(const bool enabled) { setsockopt(IPPROTO_TCP, TCP_QUICKACK, int(enabled)); }
+bool TCPSocket::quickack() const { return getsockopt<int>(IPPROTO_TCP, TCP_QUICKACK); }
+
+//! \details An EventLoop Rule waiting for Direction::Out then wakes up only once the kernel is nearly out
+//! of data to send, so the application decides what to send as late as possible.
+void TCPSocket::set_notsent_lowat(const uint32_t bytes) { setsockopt(IPPROTO_TCP, TCP_NOTSENT_LOWAT, bytes); }
+uint32_t TCPSocket::notsent_lowat() const { return getsockopt<uint32_t>(IPPROTO_TCP, TCP_NOTSENT_LOWAT); }
+
+//! \details Turns off Nagle's algorithm and corking, acknowledges promptly, and keeps at most 16 KiB unsent,
+//! leaving the buffer sizes to the kernel's autotuning.
+TCPSocket::Tuning TCPSocket::Tuning::low_latency() {
+    Tuning tuning;
+    tuning.nodelay = true;
+    tuning.cork = false;
+    tuning.quickack = true;
+    tuning.notsent_lowat = 16384;
+    return tuning;
+}
+
+//! \details Lets Nagle's algorithm fill segments and asks for 4 MiB buffers each way (capped by the
+//! system's limits), which covers a bandwidth-delay product of about 300 Mbit/s at 100 ms.
+TCPSocket::Tuning TCPSocket::Tuning::bulk() {
+    Tuning tuning;
+    tuning.nodelay = false;
+    tuning.cork = false;
+    tuning.send_buffer = 4 << 20;
+    tuning.receive_buffer = 4 << 20;
+    return tuning;
+}
+
+//! \param[in] tuning holds the settings to apply; the others are left as they are
+void TCPSocket::tune(const Tuning &tuning) {
+    if (tuning.nodelay) {
+        set_nodelay(*tuning.nodelay);
+    }
+    if (tuning.cork) {
+        set_cork(*tuning.cork);
+    }
+    if (tuning.quickack) {
+        set_quickack(*tuning.quickack);
+    }
+    if (tuning.notsent_lowat) {
+        set_notsent_lowat(*tuning.notsent_lowat);
+    }
+    if (tuning.send_buffer) {
+        set_send_buffer(*tuning.send_buffer);
+    }
+    if (tuning.receive_buffer) {
+        set_receive_buffer(*tuning.receive_buffer);
+    }
+    if (tuning.busy_poll) {
+        set_busy_poll(*tuning.busy_poll);
+    }
+}
+
+//! \param[in] socket is the TCPSocket or UDPSocket to send from
+//! \param[in] threshold is the smallest payload to send without copying
+ZeroCopySender::ZeroCopySender(Socket &socket, const size_t threshold) : _socket(socket), _threshold(threshold) {
+    _socket.setsockopt(SOL_SOCKET, SO_ZEROCOPY, int(true));
+}
+
+//! \param[in] destination_address is where to send `payload`, or null to send it to the connected peer
+//! \param[in] destination_address_len is the size of `destination_address`
+//! \param[in] payload is the data to send (which is pinned, if sent without copying)
+//! \returns the number of bytes sent, which is zero if a non-blocking socket had no room
+size_t ZeroCopySender::_send(const sockaddr *destination_address,
+                             const socklen_t destination_address_len,
+                             const Buffer &payload) {
+    iovec iov{const_cast<char *>(payload.str().data()), payload.size()};
+    msghdr message{};
+    message.msg_name = const_cast<sockaddr *>(destination_address);
+    message.msg_namelen = destination_address_len;
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+
+    bool zerocopy = payload.size() >= _threshold;
+    const ssize_t bytes_sent = _socket.traced_write(
+        "sendmsg",
+        [&] {
+            if (zerocopy) {
+                const ssize_t result = ::sendmsg(_socket.fd_num(), &message, MSG_ZEROCOPY);
+                if (result >= 0 or errno != ENOBUFS) {
+                    return result;
+                }
+                zerocopy = false;  // no room to pin more pages for now, so copy this payload
+            }
+            return ::sendmsg(_socket.fd_num(), &message, 0);
+        },
+        EAGAIN);
+    if (bytes_sent < 0) {
+        _socket.register_write(0, payload.size() > 0);
+        return 0;
+    }
+
+    _socket.register_write(bytes_sent, size_t(bytes_sent) < payload.size());
+    // (a send that fails takes no number, but one that sends anything does, however little)
+    if (zerocopy and bytes_sent > 0) {
+        _pinned.push_back({_next_sequence++, payload, false});
+    }
+    return bytes_sent;
+}
+
+//! \param[in] buffer is the data to send
+//! \returns the number of bytes sent, which is zero if a non-blocking socket had no room
+//! \details Makes a single [sendmsg(2)](\ref man2::sendmsg) call, like FileDescriptor::try_write. The
+//! whole of `buffer` stays pinned until its completion arrives, even if only part of it was sent, so
+//! send the rest from a suffix of the same Buffer (see Buffer::remove_prefix) rather than a copy.
+size_t ZeroCopySender::write(const Buffer &buffer) { return _send(nullptr, 0, buffer); }
+
+//! \param[in] destination is the Address to send to
+//! \param[in] payload is the datagram payload
+//! \returns the size of the payload, or zero if a non-blocking socket had no room
+size_t ZeroCopySender::sendto(const Address &destination, const Buffer &payload) {
+    const size_t bytes_sent = _send(destination, destination.size(), payload);
+    if (bytes_sent != 0 and bytes_sent != payload.size()) {
+        throw runtime_error("datagram payload too big for sendmsg()");
+    }
+    return bytes_sent;
+}
+
+//! \param[in] first is the number of the first send completed
+//! \param[in] last is the number of the last send completed (the kernel merges consecutive completions)
+//! \param[in] copied is whether the kernel copied the payloads after all
+//! \returns the number of payloads released
+size_t ZeroCopySender::_complete(const uint32_t first, const uint32_t last, const bool copied) {
+    if (copied) {
+        _copied += last - first + 1;
+    }
+
+    // (the numbers are consecutive in _pinned, and wrap around along with the kernel's counter)
+    const uint32_t front = _pinned.empty() ? _next_sequence : _pinned.front().sequence;
+    for (uint32_t offset = first - front; offset < _pinned.size(); offset++) {
+        _pinned[offset].done = true;
+        if (offset == last - front) {
+            break;
+        }
+    }
+
+    size_t released = 0;
+    while (not _pinned.empty() and _pinned.front().done) {
+        _pinned.pop_front();
+        released++;
+    }
+    return released;
+}
+
+//! \returns the number of payloads released
+//! \details Reads the error queue with [recvmsg(2)](\ref man2::recvmsg) (`MSG_ERRQUEUE`) until it is empty,
+//! which never blocks. Completions usually arrive in order, but a payload is released only once every
+//! payload sent before it has been, too. Other messages on the error queue (such as transmit timestamps;
+//! see Socket::set_timestamping) are discarded. If the queue was empty, the socket's pending error (if
+//! any) is thrown as a unix_error, since that is what woke the caller.
+size_t ZeroCopySender::process_completions() {
+    Socket::error_message message{};
+    size_t released = 0;
+    for (bool first_read = true;; first_read = false) {
+        if (not _socket._read_error_queue(message)) {
+            if (first_read) {
+                _socket._throw_pending_error("sendmsg");
+            }
+            return released;
+        }
+
+        const auto &error = message.error;
+        if (error.ee_origin == SO_EE_ORIGIN_ZEROCOPY and error.ee_errno == 0) {
+            released += _complete(error.ee_info, error.ee_data, error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+        }
+    }
+}
@@ -5,14 +5,27 @@
 #include "file_descriptor.hh"
 
 #include <cstdint>
+#include <deque>
 #include <functional>
+#include <linux/errqueue.h>
+#include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <sys/socket.h>
+#include <vector>
 
 //! \brief Base class for network sockets (TCP, UDP, etc.)
 //! \details Socket is generally used via a subclass. See TCPSocket and UDPSocket for usage examples.
 class Socket : public FileDescriptor {
   private:
+    friend class ZeroCopySender;
+
+    int _domain;  //!< The socket's domain (`AF_INET`, `AF_INET6`, or `AF_UNIX`)
+
+    //! The Address to give the kernel for `address` (mapped into IPv6 for an IPv6 socket)
+    Address _for_domain(const Address &address) const;
+
     //! Get the local or peer address the socket is connected to
     Address get_address(const std::string &name_of_function,
                         const std::function<int(int, sockaddr *, socklen_t *)> &function) const;
@@ -24,10 +37,23 @@ class Socket : public FileDescriptor {
     //! Construct from a file descriptor.
     Socket(FileDescriptor &&fd, const int domain, const int type);
 
+    //! Construct from the file descriptor of an IPv4 or IPv6 socket
+    Socket(FileDescriptor &&fd, const int type);
+
+    //! Selects the constructor that takes the caller's word for a descriptor's domain and type
+    struct unchecked_t {};
+
+    //! Construct from a file descriptor known to be a socket of `domain`, e.g. one just returned by accept(2)
+    Socket(FileDescriptor &&fd, const int domain, unchecked_t) : FileDescriptor(std::move(fd)), _domain(domain) {}
+
     //! Wrapper around [setsockopt(2)](\ref man2::setsockopt)
     template <typename option_type>
     void setsockopt(const int level, const int option, const option_type &option_value);
 
+    //! Wrapper around [getsockopt(2)](\ref man2::getsockopt)
+    template <typename option_type>
+    option_type getsockopt(const int level, const int option) const;
+
   public:
     //! Bind a socket to a specified address with [bind(2)](\ref man2::bind), usually for listen/accept
     void bind(const Address &address);
@@ -35,6 +61,12 @@ class Socket : public FileDescriptor {
     //! Connect a socket to a specified peer address with [connect(2)](\ref man2::connect)
     void connect(const Address &address);
 
+    //! \brief Start connecting a non-blocking socket without waiting; returns `true` if it connected at once
+    bool start_connect(const Address &address);
+
+    //! \brief Complete start_connect() once the socket is writable, throwing unix_error if the connection failed
+    void finish_connect();
+
     //! Shut down a socket via [shutdown(2)](\ref man2::shutdown)
     void shutdown(const int how);
 
@@ -45,23 +77,109 @@ class Socket : public FileDescriptor {
 
     //! Allow local address to be reused sooner via [SO_REUSEADDR](\ref man7::socket)
     void set_reuseaddr();
+
+    //! Allow several sockets to bind the same address via [SO_REUSEPORT](\ref man7::socket)
+    void set_reuseport();
+
+    //! Refuse IPv4 traffic on an IPv6 socket (or, by default, accept it) via [IPV6_V6ONLY](\ref man7::ipv6)
+    void set_ipv6_only(const bool only);
+
+    //! The socket's domain, e.g., `AF_INET` or `AF_INET6`
+    int domain() const { return _domain; }
+
+    //! \name Buffering and polling, via [socket(7)](\ref man7::socket) options
+    //! The getters report the kernel's effective values: for the buffers, that is twice what was
+    //! set (the kernel's allowance for bookkeeping), capped by `net.core.wmem_max` and `rmem_max`.
+    //!@{
+
+    //! Set the send buffer size (`SO_SNDBUF`), which turns off the kernel's autotuning of it
+    void set_send_buffer(const int bytes);
+    int send_buffer() const;
+
+    //! Set the receive buffer size (`SO_RCVBUF`), which turns off the kernel's autotuning of it
+    void set_receive_buffer(const int bytes);
+    int receive_buffer() const;
+
+    //! Busy-poll the device for up to `microseconds` when a read would block (`SO_BUSY_POLL`)
+    void set_busy_poll(const int microseconds);
+    int busy_poll() const;
+    //!@}
+
+    //! \name Kernel timestamps, via [SO_TIMESTAMPING](\ref man7::socket)
+    //!@{
+
+    //! When the kernel handled a packet; a timestamp that was not reported is zero
+    struct packet_timestamp {
+        uint64_t software_ns = 0;  //!< Taken by the network stack, in nanoseconds of `CLOCK_REALTIME`
+        uint64_t hardware_ns = 0;  //!< Taken by the network device, in nanoseconds of its own clock
+    };
+
+    //! Which point in a packet's transmission a transmit_timestamp marks
+    enum class TransmitStage : uint32_t {
+        Sent = SCM_TSTAMP_SND,          //!< The packet was handed to the network device
+        Acknowledged = SCM_TSTAMP_ACK,  //!< (TCP only) The peer acknowledged all of the data sent
+    };
+
+    //! A transmit timestamp read by read_transmit_timestamps()
+    struct transmit_timestamp {
+        uint32_t id;                 //!< Which send it concerns (see set_timestamping())
+        TransmitStage stage;         //!< The point in the send that it marks
+        packet_timestamp timestamp;  //!< When the send reached that point
+    };
+
+    //! Timestamp received packets, sent packets, or both (or stop, if both are `false`)
+    void set_timestamping(const bool receive, const bool transmit);
+
+    //! Read the transmit timestamps waiting on the socket's error queue, appending them to `timestamps`
+    size_t read_transmit_timestamps(std::vector<transmit_timestamp> &timestamps);
+    //!@}
+
+  private:
+    //! A message read from the socket's error queue by _read_error_queue()
+    struct error_message {
+        sock_extended_err error;     //!< What the message reports (`ee_origin` says what it is about)
+        packet_timestamp timestamp;  //!< With SO_TIMESTAMPING, when the packet it concerns was sent
+    };
+
+    //! Read a message from the socket's error queue without blocking; returns `false` if it is empty
+    bool _read_error_queue(error_message &message);
+
+    //! Throw the socket's pending error (`SO_ERROR`), if it has one, as a unix_error from `attempt`
+    void _throw_pending_error(const char *attempt) const;
 };
 
 //! A wrapper around [UDP sockets](\ref man7::udp)
 class UDPSocket : public Socket {
+  private:
+    //! Send `payload` with [sendmsg(2)](\ref man2::sendmsg), to `destination_address` if non-null
+    void sendmsg_helper(const sockaddr *destination_address,
+                        const socklen_t destination_address_len,
+                        const BufferViewList &payload);
+
+    //! Room for the control messages UDPSocket sends or asks for: a `UDP_SEGMENT` or `UDP_GRO` size, and
+    //! the receive timestamps
+    union control_buffer {
+        cmsghdr header;                                                             //!< (for alignment)
+        char data[CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(scm_timestamping))];  //!< The control messages
+    };
+
   protected:
     //! \brief Construct from FileDescriptor (used by TCPOverUDPSocketAdapter)
     //! \param[in] fd is the FileDescriptor from which to construct
-    explicit UDPSocket(FileDescriptor &&fd) : Socket(std::move(fd), AF_INET, SOCK_DGRAM) {}
+    explicit UDPSocket(FileDescriptor &&fd) : Socket(std::move(fd), SOCK_DGRAM) {}
 
   public:
-    //! Default: construct an unbound, unconnected UDP socket
-    UDPSocket() : Socket(AF_INET, SOCK_DGRAM) {}
+    //! Default: construct an unbound, unconnected IPv4 UDP socket
+    UDPSocket() : UDPSocket(AF_INET) {}
+
+    //! Construct an unbound, unconnected UDP socket of a family (`AF_INET` or `AF_INET6`; see Address::family)
+    explicit UDPSocket(const int family) : Socket(family, SOCK_DGRAM) {}
 
     //! Returned by UDPSocket::recv; carries received data and information about the sender
     struct received_datagram {
-        Address source_address;  //!< Address from which this datagram was received
-        std::string payload;     //!< UDP datagram payload
+        Address source_address;        //!< Address from which this datagram was received
+        std::string payload;           //!< UDP datagram payload
+        packet_timestamp timestamp{};  //!< When the datagram arrived, if receive timestamping is enabled
     };
 
     //! Receive a datagram and the Address of its sender
@@ -75,6 +193,71 @@ class UDPSocket : public Socket {
 
     //! Send datagram to the socket's connected address (must call connect() first)
     void send(const BufferViewList &payload);
+
+    //! Send every datagram as datagrams of `segment_size` bytes via [UDP_SEGMENT](\ref man7::udp) (0 to stop)
+    void set_segment_size(const uint16_t segment_size);
+
+    //! Let the kernel coalesce received datagrams via [UDP_GRO](\ref man7::udp) (see received_buffer::segment)
+    void set_gro(const bool enabled);
+
+    //! A datagram received by recv_batch(), with its payload in a pooled Buffer
+    struct received_buffer {
+        Address source_address;      //!< Address from which this datagram was received
+        Buffer payload;              //!< UDP datagram payload
+        size_t segment_size;         //!< With GRO, the size of the datagrams coalesced into `payload` (else 0)
+        packet_timestamp timestamp;  //!< When the datagram arrived, if receive timestamping is enabled
+
+        //! How many datagrams were coalesced into `payload` (one, unless GRO is enabled)
+        size_t segments() const {
+            return segment_size == 0 or payload.size() == 0 ? 1 : (payload.size() + segment_size - 1) / segment_size;
+        }
+
+        //! The `i`th datagram coalesced into `payload` (a view of it, not a copy)
+        std::string_view segment(const size_t i) const {
+            return segment_size == 0 ? payload.str() : payload.str().substr(i * segment_size, segment_size);
+        }
+    };
+
+    //! \brief The datagrams received by recv_batch(), and the storage it reuses from one call to the next
+    //! \details Keep one per socket: once warmed up, receiving a batch allocates nothing unless
+    //! the caller is still holding on to every pooled payload.
+    class ReceiveBatch {
+      private:
+        friend class UDPSocket;
+
+        std::vector<std::shared_ptr<std::string>> _slots{};  //!< Pooled storage for each datagram to be received into
+        std::vector<iovec> _iovecs{};                        //!< One per datagram, pointing into its slot
+        std::vector<Address::Raw> _sources{};                //!< The source address of each datagram
+        std::vector<control_buffer> _control{};              //!< The control message (if any) of each datagram
+        std::vector<mmsghdr> _headers{};                     //!< Passed to [recvmmsg(2)](\ref man2::recvmmsg)
+        std::vector<received_buffer> _datagrams{};           //!< The datagrams received by the last call
+        BufferPool _pool{};                                  //!< Storage for the payloads
+
+      public:
+        //! The datagrams received by the last call to recv_batch() (the payloads may be moved out)
+        std::vector<received_buffer> &datagrams() { return _datagrams; }
+
+        //! The pool holding the payloads
+        const BufferPool &pool() const { return _pool; }
+    };
+
+    //! \brief Receive up to `count` datagrams with one [recvmmsg(2)](\ref man2::recvmmsg) call
+    size_t recv_batch(ReceiveBatch &batch, const size_t count = 64, const size_t mtu = 65536);
+
+    //! A datagram to send with send_batch()
+    struct outgoing_datagram {
+        Address destination;        //!< Where to send the datagram
+        std::string_view payload;   //!< UDP datagram payload (not copied)
+        uint16_t segment_size = 0;  //!< If nonzero, GSO splits `payload` into datagrams of this size
+    };
+
+    //! \brief Send datagrams with as few [sendmmsg(2)](\ref man2::sendmmsg) calls as possible
+    size_t send_batch(const outgoing_datagram *datagrams, const size_t count);
+
+    //! \brief Send datagrams with as few [sendmmsg(2)](\ref man2::sendmmsg) calls as possible
+    size_t send_batch(const std::vector<outgoing_datagram> &datagrams) {
+        return send_batch(datagrams.data(), datagrams.size());
+    }
 };
 
 //! \class UDPSocket
@@ -87,19 +270,69 @@ class UDPSocket : public Socket {
 //! A wrapper around [TCP sockets](\ref man7::tcp)
 class TCPSocket : public Socket {
   private:
-    //! \brief Construct from FileDescriptor (used by accept())
+    //! \brief Construct from a connection accepted on a listener (used by accept() and accept_batch())
     //! \param[in] fd is the FileDescriptor from which to construct
-    explicit TCPSocket(FileDescriptor &&fd) : Socket(std::move(fd), AF_INET, SOCK_STREAM) {}
+    //! \param[in] domain is the listener's domain, which an accepted connection shares
+    TCPSocket(FileDescriptor &&fd, const int domain) : Socket(std::move(fd), domain, unchecked_t{}) {}
 
   public:
-    //! Default: construct an unbound, unconnected TCP socket
-    TCPSocket() : Socket(AF_INET, SOCK_STREAM) {}
+    //! Default: construct an unbound, unconnected IPv4 TCP socket
+    TCPSocket() : TCPSocket(AF_INET) {}
+
+    //! Construct an unbound, unconnected TCP socket of a family (`AF_INET` or `AF_INET6`; see Address::family)
+    explicit TCPSocket(const int family) : Socket(family, SOCK_STREAM) {}
 
     //! Mark a socket as listening for incoming connections
     void listen(const int backlog = 16);
 
     //! Accept a new incoming connection
     TCPSocket accept();
+
+    //! \brief Accept up to `limit` waiting connections, which are non-blocking and close-on-exec
+    size_t accept_batch(std::vector<TCPSocket> &connections,
+                        const size_t limit = SIZE_MAX,
+                        int *resource_error = nullptr);
+
+    //! \name Latency and throughput, via [tcp(7)](\ref man7::tcp) options
+    //! The getters report the kernel's effective values.
+    //!@{
+
+    //! Send small segments at once instead of coalescing them (`TCP_NODELAY`, i.e. no Nagle's algorithm)
+    void set_nodelay(const bool enabled);
+    bool nodelay() const;
+
+    //! Hold back partial segments until uncorked, or for at most 200 ms (`TCP_CORK`)
+    void set_cork(const bool enabled);
+    bool cork() const;
+
+    //! Acknowledge at once instead of delaying ACKs (`TCP_QUICKACK`, which the kernel may later turn off)
+    void set_quickack(const bool enabled);
+    bool quickack() const;
+
+    //! Report the socket writable only while fewer than `bytes` are waiting to be sent (`TCP_NOTSENT_LOWAT`)
+    void set_notsent_lowat(const uint32_t bytes);
+    uint32_t notsent_lowat() const;
+    //!@}
+
+    //! Settings that tune() applies together; those left unset are not changed
+    struct Tuning {
+        std::optional<bool> nodelay{};            //!< See set_nodelay()
+        std::optional<bool> cork{};               //!< See set_cork()
+        std::optional<bool> quickack{};           //!< See set_quickack()
+        std::optional<uint32_t> notsent_lowat{};  //!< See set_notsent_lowat()
+        std::optional<int> send_buffer{};         //!< See Socket::set_send_buffer()
+        std::optional<int> receive_buffer{};      //!< See Socket::set_receive_buffer()
+        std::optional<int> busy_poll{};           //!< See Socket::set_busy_poll()
+
+        //! For request/response traffic: small writes go out at once, and little data waits unsent
+        static Tuning low_latency();
+
+        //! For streaming: full segments, and buffers big enough to keep a long fat pipe busy
+        static Tuning bulk();
+    };
+
+    //! Apply a set of settings, such as Tuning::low_latency() or Tuning::bulk()
+    void tune(const Tuning &tuning);
 };
 
 //! \class TCPSocket
@@ -108,6 +341,11 @@ class TCPSocket : public Socket {
 //! Example:
 //!
 //! \include socket_example_2.cc
+//!
+//! A socket's family is fixed when it is made, so for an Address that may be IPv6 (such as one resolved from
+//! a hostname), make the socket with `TCPSocket socket{address.family()}`. An IPv6 socket is dual-stack: it
+//! binds and connects to IPv4 Addresses too (mapping them into IPv6), and reports IPv4 peers as IPv4-mapped
+//! addresses (see Address::unmapped). The same goes for UDPSocket.
 
 //! A wrapper around [Unix-domain stream sockets](\ref man7::unix)
 class LocalStreamSocket : public Socket {
@@ -121,4 +359,63 @@ class LocalStreamSocket : public Socket {
 //!
 //! \include socket_example_3.cc
 
+//! \brief Sends Buffers from a TCPSocket or UDPSocket without copying them, via [MSG_ZEROCOPY](\ref man7::socket)
+class ZeroCopySender {
+  private:
+    //! A payload handed to the kernel by one zero-copy send
+    struct PinnedBuffer {
+        uint32_t sequence;  //!< The kernel's number for the send (it counts the zero-copy sends on each socket)
+        Buffer buffer;      //!< Keeps the payload's storage alive, and out of any BufferPool
+        bool done;          //!< Whether the kernel has reported that it is done with the payload
+    };
+
+    Socket &_socket;                     //!< The socket to send from
+    size_t _threshold;                   //!< The smallest payload to send without copying
+    std::deque<PinnedBuffer> _pinned{};  //!< The payloads the kernel may still be using, in the order sent
+    uint32_t _next_sequence = 0;         //!< The kernel's number for the next zero-copy send
+    uint64_t _copied = 0;                //!< Zero-copy sends that the kernel ended up copying after all
+
+    //! Send `payload` with [sendmsg(2)](\ref man2::sendmsg), to `destination_address` if non-null
+    size_t _send(const sockaddr *destination_address, const socklen_t destination_address_len, const Buffer &payload);
+
+    //! Mark the sends numbered `first` to `last` done, and release the payloads at the front that are done
+    size_t _complete(const uint32_t first, const uint32_t last, const bool copied);
+
+  public:
+    //! Payloads smaller than this are copied by default: pinning pages costs more than copying a few of them
+    static constexpr size_t default_threshold = 16384;
+
+    //! Enable [SO_ZEROCOPY](\ref man7::socket) on `socket`, which must outlive the ZeroCopySender
+    explicit ZeroCopySender(Socket &socket, const size_t threshold = default_threshold);
+
+    //! \brief Send as much of `buffer` as the socket will take, on a connected socket
+    size_t write(const Buffer &buffer);
+
+    //! \brief Send `payload` as a datagram to `destination`
+    size_t sendto(const Address &destination, const Buffer &payload);
+
+    //! \brief Read the completions waiting on the socket's error queue, and release the payloads they cover
+    size_t process_completions();
+
+    //! The number of payloads the kernel may still be using
+    size_t pending() const { return _pinned.size(); }
+
+    //! The number of zero-copy sends that the kernel reported having copied after all (e.g., over loopback)
+    uint64_t copied() const { return _copied; }
+
+    //! The socket being sent from
+    Socket &socket() { return _socket; }
+};
+
+//! \class ZeroCopySender
+//! With MSG_ZEROCOPY, the kernel sends straight from the payload's pages instead of copying them into
+//! the socket's buffer, so the payload must stay unchanged until the kernel says it is done with it.
+//! ZeroCopySender holds a copy of each Buffer it sends (which shares, and so pins, the Buffer's storage)
+//! until its completion arrives on the socket's error queue; process_completions() reads them, usually
+//! from an EventLoop Rule (see EventLoop::add_zerocopy). Payloads below the threshold are copied as usual,
+//! as are payloads the kernel has no room to pin (`ENOBUFS`), so callers can send everything through
+//! the ZeroCopySender. Copying is only worth avoiding for large payloads: each zero-copy send costs a
+//! page-pinning and a completion, and over loopback (or to a device without scatter-gather) the kernel
+//! copies the payload anyway, which copied() reports.
+
 #endif  // SPONGE_LIBSPONGE_SOCKET_HH
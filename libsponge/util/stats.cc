@@ -0,0 +1,59 @@
+#include "stats.hh"
+
+#include <sstream>
+
+using namespace std;
+
+//! \param[in] duration_ns is the sample to record
+void LatencyHistogram::record(const uint64_t duration_ns) {
+    // bucket 0 holds zero-length samples; bucket i holds [2^(i-1), 2^i)
+    const size_t index = duration_ns == 0 ? 0 : min<size_t>(64 - __builtin_clzll(duration_ns), NUM_BUCKETS - 1);
+    _buckets[index].add();
+    _count.add();
+    _sum_ns.add(duration_ns);
+    _max_ns.raise_to(duration_ns);
+}
+
+void LatencyHistogram::reset() {
+    for (auto &bucket : _buckets) {
+        bucket.reset();
+    }
+    _count.reset();
+    _sum_ns.reset();
+    _max_ns.reset();
+}
+
+uint64_t LatencyHistogram::mean_ns() const {
+    const uint64_t samples = count();
+    return samples == 0 ? 0 : sum_ns() / samples;
+}
+
+//! \param[in] fraction is the quantile of interest, e.g. 0.99 for the 99th percentile
+//! \returns the upper edge of the bucket containing the requested quantile (or the
+//!          largest sample, if that is smaller)
+uint64_t LatencyHistogram::percentile_ns(const double fraction) const {
+    const uint64_t samples = count();
+    if (samples == 0) {
+        return 0;
+    }
+
+    const auto rank = static_cast<uint64_t>(fraction * static_cast<double>(samples));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+        seen += bucket(i);
+        if (seen > rank) {
+            const uint64_t upper_edge = i == 0 ? 0 : (i >= 63 ? UINT64_MAX : (uint64_t(1) << i) - 1);
+            return min(upper_edge, max_ns());
+        }
+    }
+    return max_ns();
+}
+
+//! \param[in] unit names what the samples measure (the histogram is also useful for non-durations)
+string LatencyHistogram::to_json(const string &unit) const {
+    ostringstream ss;
+    ss << "{\"count\":" << count() << ",\"mean_" << unit << "\":" << mean_ns() << ",\"p50_" << unit
+       << "\":" << percentile_ns(0.50) << ",\"p90_" << unit << "\":" << percentile_ns(0.90) << ",\"p99_" << unit
+       << "\":" << percentile_ns(0.99) << ",\"max_" << unit << "\":" << max_ns() << "}";
+    return ss.str();
+}
@@ -0,0 +1,83 @@
+#ifndef SPONGE_LIBSPONGE_STATS_HH
+#define SPONGE_LIBSPONGE_STATS_HH
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+//! \brief A counter with one writer and any number of concurrent readers
+//! \details Updates are a relaxed load and store rather than an atomic read-modify-write, so
+//! incrementing costs the same as a plain integer while readers on other threads still
+//! see a consistent (if slightly stale) value.
+class StatCounter {
+  private:
+    std::atomic<uint64_t> _value{0};
+
+  public:
+    StatCounter() = default;
+
+    //! Add `n` to the counter (must only be called from the owning thread)
+    void add(const uint64_t n = 1) {
+        _value.store(_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    //! Raise the counter to `n` if it is currently smaller (must only be called from the owning thread)
+    void raise_to(const uint64_t n) {
+        if (n > value()) {
+            _value.store(n, std::memory_order_relaxed);
+        }
+    }
+
+    //! Current value
+    uint64_t value() const { return _value.load(std::memory_order_relaxed); }
+
+    //! Reset to zero
+    void reset() { _value.store(0, std::memory_order_relaxed); }
+
+    //! \name Copying takes a snapshot of the current value
+    //!@{
+    StatCounter(const StatCounter &other) : _value(other.value()) {}
+    StatCounter &operator=(const StatCounter &other) {
+        _value.store(other.value(), std::memory_order_relaxed);
+        return *this;
+    }
+    //!@}
+};
+
+//! \brief A histogram of durations (in nanoseconds) with power-of-two buckets
+//! \details Like StatCounter, a LatencyHistogram has a single writer, but may be read
+//! (or copied) from any thread.
+class LatencyHistogram {
+  public:
+    static constexpr size_t NUM_BUCKETS = 64;  //!< Bucket `i` holds samples in [2^(i-1), 2^i) ns
+
+  private:
+    std::array<StatCounter, NUM_BUCKETS> _buckets{};
+    StatCounter _count{};
+    StatCounter _sum_ns{};
+    StatCounter _max_ns{};
+
+  public:
+    //! Record one sample
+    void record(const uint64_t duration_ns);
+
+    //! Forget all samples
+    void reset();
+
+    //! \name Summary statistics
+    //!@{
+    uint64_t count() const { return _count.value(); }                         //!< \brief number of samples
+    uint64_t sum_ns() const { return _sum_ns.value(); }                       //!< \brief sum of all samples
+    uint64_t max_ns() const { return _max_ns.value(); }                       //!< \brief largest sample
+    uint64_t mean_ns() const;                                                 //!< \brief mean of all samples
+    uint64_t percentile_ns(const double fraction) const;                      //!< \brief bound on a quantile
+    uint64_t bucket(const size_t n) const { return _buckets.at(n).value(); }  //!< \brief samples in bucket `n`
+    //!@}
+
+    //! JSON object with the count, mean, max, and common percentiles, each suffixed with `unit`
+    std::string to_json(const std::string &unit = "ns") const;
+};
+
+#endif  // SPONGE_LIBSPONGE_STATS_HH
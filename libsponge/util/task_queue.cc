@@ -0,0 +1,53 @@
+#include "task_queue.hh"
+
+#include <memory>
+#include <utility>
+
+using namespace std;
+
+TaskQueue::~TaskQueue() {
+    for (Node *list : {_pending, _head.load(memory_order_acquire)}) {
+        while (list) {
+            unique_ptr<Node> node{list};
+            list = node->next;
+        }
+    }
+}
+
+//! \param[in] task is the task to run on the consumer thread
+//! \returns `true` if the queue's shared stack was empty before this push
+bool TaskQueue::push(TaskT task) {
+    Node *node = new Node{move(task), _head.load(memory_order_relaxed)};
+    while (not _head.compare_exchange_weak(node->next, node, memory_order_release, memory_order_relaxed)) {
+    }
+    return node->next == nullptr;
+}
+
+//! \details Tasks pushed while run_all() is running (including by the tasks themselves) are left for
+//! the next call.
+size_t TaskQueue::run_all() {
+    // take everything pushed so far, and reverse it onto the end of _pending (oldest first)
+    Node *stack = _head.exchange(nullptr, memory_order_acquire);
+    Node *batch = nullptr;
+    while (stack) {
+        Node *next = stack->next;
+        stack->next = batch;
+        batch = stack;
+        stack = next;
+    }
+
+    Node **tail = &_pending;
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = batch;
+
+    size_t count = 0;
+    while (_pending) {
+        unique_ptr<Node> node{_pending};
+        _pending = node->next;
+        count++;
+        node->task();
+    }
+    return count;
+}
@@ -0,0 +1,59 @@
+#ifndef SPONGE_LIBSPONGE_TASK_QUEUE_HH
+#define SPONGE_LIBSPONGE_TASK_QUEUE_HH
+
+#include "inline_function.hh"
+
+#include <atomic>
+#include <cstddef>
+
+//! A lock-free queue of tasks with any number of producer threads and a single consumer thread
+class TaskQueue {
+  public:
+    using TaskT = InlineFunction<void(void)>;  //!< A unit of work
+
+  private:
+    //! A queued task
+    struct Node {
+        TaskT task;            //!< The task itself
+        Node *next = nullptr;  //!< Next-older Node (in TaskQueue::_head) or next-newer Node (in TaskQueue::_pending)
+    };
+
+    std::atomic<Node *> _head{nullptr};  //!< Most recently pushed Node; a lock-free stack shared with producers
+    Node *_pending = nullptr;            //!< Oldest task taken from TaskQueue::_head but not yet run (consumer only)
+
+  public:
+    TaskQueue() = default;
+
+    //! Frees any tasks that were never run
+    ~TaskQueue();
+
+    //! A TaskQueue cannot be copied or moved, since producers hold references to it
+
+    //!@{
+    TaskQueue(const TaskQueue &other) = delete;
+    TaskQueue &operator=(const TaskQueue &other) = delete;
+    TaskQueue(TaskQueue &&other) = delete;
+    TaskQueue &operator=(TaskQueue &&other) = delete;
+    //!@}
+
+    //! Add a task from any thread; returns `true` if no task was waiting (so the consumer may need waking)
+    bool push(TaskT task);
+
+    //! Run every task pushed so far, oldest first (consumer thread only); returns the number run
+    size_t run_all();
+
+    //! Whether no task is waiting to be run (consumer thread only)
+    bool empty() const { return _pending == nullptr and _head.load(std::memory_order_acquire) == nullptr; }
+};
+
+//! \class TaskQueue
+//! Producers push onto a Treiber stack with a single compare-and-swap. The consumer takes the whole
+//! stack with one atomic exchange and reverses it, so tasks run in the order each producer pushed
+//! them. push() reports when the queue was empty, which lets the caller wake the consumer just once
+//! for a whole batch of tasks.
+//!
+//! If a task throws, the exception propagates out of run_all() and the tasks after it stay queued for
+//! the next run_all(). push() does not report those tasks, since the shared stack may still be empty,
+//! so a consumer woken by push() must wake itself again (EventLoop re-signals its eventfd).
+
+#endif  // SPONGE_LIBSPONGE_TASK_QUEUE_HH
@@ -0,0 +1,237 @@
+#include "timer_wheel.hh"
+
+#include <stdexcept>
+#include <utility>
+
+using namespace std;
+
+//! \param[in] now_ms is the wheel's initial current time
+TimerWheel::TimerWheel(const uint64_t now_ms) : _now(now_ms) {
+    for (auto &level : _heads) {
+        level.fill(NIL);
+    }
+}
+
+//! \param[in] deadline_ms is when the timer should first fire
+//! \param[in] callback is called each time the timer fires
+//! \param[in] period_ms is the interval between firings of a periodic timer, or zero for a one-shot timer
+//! \returns a TimerId that can be passed to cancel()
+TimerWheel::TimerId TimerWheel::schedule(const uint64_t deadline_ms, CallbackT callback, const uint64_t period_ms) {
+    uint32_t index = _free;
+    if (index == NIL) {
+        if (_nodes.size() >= NIL) {
+            throw runtime_error("TimerWheel: too many timers");
+        }
+        index = _nodes.size();
+        _nodes.emplace_back();
+    } else {
+        _free = _nodes[index].next;
+    }
+
+    Node &node = _nodes[index];
+    node.deadline = max(deadline_ms, _now + 1);
+    node.period = period_ms;
+    node.callback = move(callback);
+    node.active = true;
+    _size++;
+
+    _insert(index);
+    return {index, node.generation};
+}
+
+//! \param[in] id identifies the timer to cancel
+//! \returns `true` if the timer was scheduled and is now canceled
+bool TimerWheel::cancel(const TimerId id) {
+    if (not pending(id)) {
+        return false;
+    }
+
+    _unlink(id.index);
+
+    Node &node = _nodes[id.index];
+    node.callback = nullptr;
+    node.active = false;
+    node.generation++;
+    node.next = _free;
+    _free = id.index;
+    _size--;
+    return true;
+}
+
+//! \param[in] id identifies the timer
+bool TimerWheel::pending(const TimerId id) const {
+    return id.index < _nodes.size() and _nodes[id.index].active and _nodes[id.index].generation == id.generation;
+}
+
+//! \param[in] index is the Node to link; its deadline must not be earlier than TimerWheel::_now
+void TimerWheel::_insert(const uint32_t index) {
+    Node &node = _nodes[index];
+    const uint64_t delta = node.deadline - _now;
+
+    // find the lowest level whose span covers the deadline; clamp to the top level
+    // (a timer beyond the top level's span is simply cascaded again when its slot comes around)
+    unsigned level = 0;
+    while (level + 1 < NUM_LEVELS and delta >= (uint64_t(1) << (SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+
+    uint64_t block = node.deadline >> (SLOT_BITS * level);
+    if (delta >= (uint64_t(1) << (SLOT_BITS * NUM_LEVELS))) {
+        block = (_now >> (SLOT_BITS * level)) + NUM_SLOTS;  // the last slot in the top level's current span
+    }
+    const unsigned slot = block & (NUM_SLOTS - 1);
+
+    node.level = level;
+    node.slot = slot;
+    node.prev = NIL;
+    node.next = _heads[level][slot];
+    if (node.next != NIL) {
+        _nodes[node.next].prev = index;
+    }
+    _heads[level][slot] = index;
+    _occupied[level] |= uint64_t(1) << slot;
+}
+
+//! \param[in] index is the Node to unlink
+void TimerWheel::_unlink(const uint32_t index) {
+    Node &node = _nodes[index];
+    if (node.prev != NIL) {
+        _nodes[node.prev].next = node.next;
+    } else {
+        _heads[node.level][node.slot] = node.next;
+    }
+    if (node.next != NIL) {
+        _nodes[node.next].prev = node.prev;
+    }
+    if (_heads[node.level][node.slot] == NIL) {
+        _occupied[node.level] &= ~(uint64_t(1) << node.slot);
+    }
+    node.prev = node.next = NIL;
+}
+
+//! \param[in] level is the level of the slot (at least 1)
+//! \param[in] slot is the slot whose span begins at TimerWheel::_now
+void TimerWheel::_cascade(const unsigned level, const unsigned slot) {
+    // detach the whole slot first: a timer beyond the top level's span goes back into the same slot
+    uint32_t index = _heads[level][slot];
+    _heads[level][slot] = NIL;
+    _occupied[level] &= ~(uint64_t(1) << slot);
+
+    while (index != NIL) {
+        const uint32_t next = _nodes[index].next;
+        _insert(index);
+        index = next;
+    }
+}
+
+//! \returns the number of timers fired
+//! \details Each callback is moved out of its Node while it runs, so that callbacks may freely
+//! schedule or cancel timers (including their own). A periodic timer whose callback throws is canceled.
+size_t TimerWheel::_expire() {
+    const unsigned slot = _now & (NUM_SLOTS - 1);
+    size_t fired = 0;
+
+    while (_heads[0][slot] != NIL) {
+        const uint32_t index = _heads[0][slot];
+        _unlink(index);
+        fired++;
+
+        Node &node = _nodes[index];
+        const TimerId id{index, node.generation};
+        CallbackT callback = move(node.callback);
+
+        if (node.period == 0) {
+            node.active = false;
+            node.generation++;
+            node.next = _free;
+            _free = index;
+            _size--;
+            callback();
+            continue;
+        }
+
+        // periodic: reschedule before running, so the callback may cancel it
+        node.deadline += node.period;
+        if (node.deadline <= _now) {
+            node.deadline = _now + node.period;  // fell behind; skip the missed firings
+        }
+        _insert(index);
+
+        try {
+            callback();
+        } catch (...) {
+            cancel(id);  // its callback is gone, so it must not fire again
+            throw;
+        }
+
+        if (pending(id)) {
+            _nodes[index].callback = move(callback);
+        }
+    }
+
+    return fired;
+}
+
+//! \returns the earliest tick after TimerWheel::_now at which a level-0 slot fires or a higher-level
+//!          slot must be cascaded, or `nullopt` if the wheel is empty
+std::optional<uint64_t> TimerWheel::_next_tick() const {
+    std::optional<uint64_t> ret;
+
+    for (unsigned level = 0; level < NUM_LEVELS; level++) {
+        if (_occupied[level] == 0) {
+            continue;
+        }
+
+        // the next occupied slot strictly after the current one, wrapping around
+        const unsigned shift = SLOT_BITS * level;
+        const uint64_t current_block = _now >> shift;
+        const unsigned current_slot = current_block & (NUM_SLOTS - 1);
+        const uint64_t later = current_slot == NUM_SLOTS - 1 ? 0 : _occupied[level] >> (current_slot + 1);
+        const uint64_t distance = later ? __builtin_ctzll(later) + 1
+                                        : __builtin_ctzll(_occupied[level]) + NUM_SLOTS - current_slot;
+        const uint64_t tick = (current_block + distance) << shift;
+
+        if (not ret or tick < *ret) {
+            ret = tick;
+        }
+    }
+
+    return ret;
+}
+
+//! \details This is now() itself while timers are left over in the current tick (see advance()).
+std::optional<uint64_t> TimerWheel::next_expiry() const {
+    if (_heads[0][_now & (NUM_SLOTS - 1)] != NIL) {
+        return _now;
+    }
+    return _next_tick();
+}
+
+//! \param[in] now_ms is the new current time (which never moves backwards)
+//! \returns the number of timers fired
+size_t TimerWheel::advance(const uint64_t now_ms) {
+    // finish the current slot first, in case a callback threw out of the previous call
+    size_t fired = _heads[0][_now & (NUM_SLOTS - 1)] != NIL ? _expire() : 0;
+
+    while (_now < now_ms) {
+        const auto tick = _next_tick();
+        if (not tick or *tick > now_ms) {
+            _now = now_ms;
+            break;
+        }
+
+        _now = *tick;
+
+        // cascade from the top down, so timers can fall more than one level in a single tick
+        for (unsigned level = NUM_LEVELS - 1; level > 0; level--) {
+            const unsigned shift = SLOT_BITS * level;
+            if ((_now & ((uint64_t(1) << shift) - 1)) == 0) {
+                _cascade(level, (_now >> shift) & (NUM_SLOTS - 1));
+            }
+        }
+
+        fired += _expire();
+    }
+
+    return fired;
+}
@@ -0,0 +1,110 @@
+#ifndef SPONGE_LIBSPONGE_TIMER_WHEEL_HH
+#define SPONGE_LIBSPONGE_TIMER_WHEEL_HH
+
+#include "inline_function.hh"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+//! A hierarchical timing wheel with millisecond resolution
+class TimerWheel {
+  public:
+    using CallbackT = InlineFunction<void(void)>;  //!< Called when a timer expires
+
+    //! \brief Identifies a scheduled timer.
+    //! \details A TimerId goes stale once its timer has been canceled or (for a one-shot timer) has fired;
+    //! stale ids are ignored by TimerWheel::cancel and TimerWheel::pending.
+    struct TimerId {
+        uint32_t index;       //!< Position in TimerWheel::_nodes
+        uint32_t generation;  //!< Value of Node::generation when the timer was scheduled
+    };
+
+    static constexpr unsigned SLOT_BITS = 6;                //!< log2 of the number of slots per level
+    static constexpr unsigned NUM_SLOTS = 1u << SLOT_BITS;  //!< Slots per level
+    static constexpr unsigned NUM_LEVELS = 4;               //!< Levels (the top level spans 2^24 ms, about 4.7 hours)
+
+  private:
+    static constexpr uint32_t NIL = UINT32_MAX;  //!< Null link
+
+    //! A timer, linked into one slot of one level
+    struct Node {
+        uint64_t deadline = 0;    //!< When the timer should fire
+        uint64_t period = 0;      //!< Interval for periodic timers; zero for one-shot timers
+        CallbackT callback{};     //!< Called when the timer fires
+        uint32_t prev = NIL;      //!< Previous Node in the same slot
+        uint32_t next = NIL;      //!< Next Node in the same slot (or in the free list)
+        uint32_t generation = 0;  //!< Incremented each time the Node is freed
+        uint8_t level = 0;        //!< Level of the slot holding this Node
+        uint8_t slot = 0;         //!< Slot holding this Node
+        bool active = false;      //!< Whether the Node is scheduled (rather than free)
+    };
+
+    uint64_t _now;                                                     //!< Time up to which expiry has been processed
+    std::vector<Node> _nodes{};                                        //!< Node storage
+    uint32_t _free = NIL;                                              //!< Head of the free list
+    size_t _size = 0;                                                  //!< Number of scheduled timers
+    std::array<std::array<uint32_t, NUM_SLOTS>, NUM_LEVELS> _heads{};  //!< First Node in each slot
+    std::array<uint64_t, NUM_LEVELS> _occupied{};                      //!< Bitmap of non-empty slots per level
+
+    //! Link a Node into the slot matching its deadline (relative to TimerWheel::_now)
+    void _insert(const uint32_t index);
+
+    //! Unlink a Node from its slot
+    void _unlink(const uint32_t index);
+
+    //! Move every timer out of a higher-level slot into the level(s) below
+    void _cascade(const unsigned level, const unsigned slot);
+
+    //! Fire every timer in level 0 for the current time; returns the number fired
+    size_t _expire();
+
+    //! Earliest tick at which any slot needs attention (expiry or cascade), if there is one
+    std::optional<uint64_t> _next_tick() const;
+
+  public:
+    //! Construct an empty wheel whose current time is `now_ms`
+    explicit TimerWheel(const uint64_t now_ms = 0);
+
+    //! Schedule `callback` to run at `deadline_ms`, and then every `period_ms` if `period_ms` is nonzero
+    TimerId schedule(const uint64_t deadline_ms, CallbackT callback, const uint64_t period_ms = 0);
+
+    //! Cancel a timer; returns `false` if it had already fired or been canceled
+    bool cancel(const TimerId id);
+
+    //! Whether a timer is still scheduled
+    bool pending(const TimerId id) const;
+
+    //! Advance the current time to `now_ms`, firing each timer whose deadline has been reached
+    size_t advance(const uint64_t now_ms);
+
+    //! A lower bound on the next time advance() will fire a timer, or `nullopt` if none is scheduled
+    std::optional<uint64_t> next_expiry() const;
+
+    //! \name Accessors
+    //!@{
+    uint64_t now() const { return _now; }      //!< \brief the time up to which timers have been fired
+    size_t size() const { return _size; }      //!< \brief number of scheduled timers
+    bool empty() const { return _size == 0; }  //!< \brief whether any timer is scheduled
+    //!@}
+};
+
+//! \class TimerWheel
+//! Timers are kept in #NUM_LEVELS levels of #NUM_SLOTS slots each. A timer due within 64 ms goes in
+//! level 0, with one slot per millisecond; one due within 64^2 ms goes in level 1, with one slot per
+//! 64 ms; and so on. As time advances, each higher-level slot is "cascaded" into the levels below just
+//! as its span begins, so every timer reaches level 0 by its deadline.
+//!
+//! Scheduling and canceling are O(1): Nodes live in a vector with a free list and are linked into
+//! their slot by index. A bitmap of occupied slots per level lets advance() skip directly from one
+//! occupied slot to the next, and lets next_expiry() find the next wakeup without scanning.
+//!
+//! Time is an arbitrary millisecond count (EventLoop uses timestamp_ms()). A timer scheduled for a
+//! time at or before now() fires on the next millisecond tick.
+//!
+//! An exception thrown by a callback propagates out of advance(). A periodic timer whose callback
+//! throws is canceled; the other timers due in the same tick fire on the next call to advance().
+
+#endif  // SPONGE_LIBSPONGE_TIMER_WHEEL_HH
@@ -3,11 +3,17 @@
 #include <array>
 #include <cctype>
 #include <chrono>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 #include <sys/socket.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 using namespace std;
 
 //! \returns the number of milliseconds since the program started
@@ -18,6 +24,12 @@ uint64_t timestamp_ms() {
     return std::chrono::duration_cast<std::chrono::milliseconds>(now - program_start).count();
 }
 
+//! \returns the current value of the steady clock in nanoseconds; only differences are meaningful
+uint64_t timestamp_ns() {
+    const auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
 //! \param[in] attempt is the name of the syscall to try (for error reporting)
 //! \param[in] return_value is the return value of the syscall
 //! \param[in] errno_mask is any errno value that is acceptable, e.g., `EAGAIN` when reading a non-blocking fd
@@ -69,6 +81,191 @@ mt19937 get_random_generator() {
     return mt19937(seed);
 }
 
+//! \brief Fold a one's-complement sum to 16 bits, with end-around carry
+//! \param[in] sum is the sum of 16-bit words
+static uint16_t fold(uint64_t sum) {
+    sum = (sum >> 32) + (sum & 0xffff'ffff);
+    sum = (sum >> 32) + (sum & 0xffff'ffff);
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum = (sum >> 16) + (sum & 0xffff);
+    return static_cast<uint16_t>(sum);
+}
+
+//! \brief Convert the folded sum of native-order words to the sum of big-endian ones
+//! \details The one's-complement sum doesn't depend on byte order (RFC 1071, section 2(B)): summing
+//! the words as loaded and swapping the bytes of the result gives the same sum.
+static uint16_t from_native(const uint16_t folded) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return static_cast<uint16_t>(folded << 8 | folded >> 8);
+#else
+    return folded;
+#endif
+}
+
+// The kernels sum the big-endian 16-bit words in `size` (even) bytes at `data`, returning a value that
+// folds to the same 16 bits. With `copy`, they also copy the bytes to `destination` as they go, so that
+// copy_and_add() reads the data only once.
+
+//! `destination + n` when copying; otherwise `destination` itself, which may be null
+template <bool copy>
+static uint8_t *offset(uint8_t *destination, const size_t n) {
+    if constexpr (copy) {
+        return destination + n;
+    } else {
+        return destination;
+    }
+}
+
+//! The sum of the words in `data`, a byte at a time
+template <bool copy>
+static uint64_t sum_bytewise(const uint8_t *data, const size_t size, uint8_t *destination) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < size; i += 2) {
+        sum += uint16_t(data[i] << 8 | data[i + 1]);
+        if constexpr (copy) {
+            destination[i] = data[i];
+            destination[i + 1] = data[i + 1];
+        }
+    }
+    return sum;
+}
+
+//! The sum of the words in `data`, eight bytes at a time
+template <bool copy>
+static uint64_t sum_words(const uint8_t *data, const size_t size, uint8_t *destination) {
+    uint64_t sum = 0;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        if constexpr (copy) {
+            memcpy(destination + i, &word, sizeof(word));
+        }
+        sum += word;
+        sum += sum < word;  // end-around carry
+    }
+    return from_native(fold(sum)) + sum_bytewise<copy>(data + i, size - i, offset<copy>(destination, i));
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+//! The sum of the words in `data`, sixteen bytes at a time
+template <bool copy>
+__attribute__((target("sse2"))) static uint64_t sum_sse2(const uint8_t *data, const size_t size, uint8_t *destination) {
+    // each iteration adds at most 2 * 0xffff to each 32-bit lane, so flush the lanes before they can overflow
+    static constexpr size_t flush_interval = 16384;
+
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t sum = 0;
+    size_t i = 0;
+    while (i + sizeof(__m128i) <= size) {
+        __m128i lanes = zero;
+        for (size_t n = 0; n < flush_interval and i + sizeof(__m128i) <= size; n++, i += sizeof(__m128i)) {
+            const __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            if constexpr (copy) {
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(destination + i), words);
+            }
+            lanes = _mm_add_epi32(lanes, _mm_unpacklo_epi16(words, zero));
+            lanes = _mm_add_epi32(lanes, _mm_unpackhi_epi16(words, zero));
+        }
+        array<uint32_t, 4> lane_sums{};
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(lane_sums.data()), lanes);
+        for (const uint32_t lane_sum : lane_sums) {
+            sum += lane_sum;
+        }
+    }
+    return from_native(fold(sum)) + sum_words<copy>(data + i, size - i, offset<copy>(destination, i));
+}
+
+//! The sum of the words in `data`, thirty-two bytes at a time
+template <bool copy>
+__attribute__((target("avx2"))) static uint64_t sum_avx2(const uint8_t *data, const size_t size, uint8_t *destination) {
+    static constexpr size_t flush_interval = 16384;
+
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t sum = 0;
+    size_t i = 0;
+    while (i + sizeof(__m256i) <= size) {
+        // (two accumulators, so that consecutive loads don't wait on each other's adds)
+        __m256i lanes_a = zero, lanes_b = zero;
+        for (size_t n = 0; n < flush_interval and i + sizeof(__m256i) <= size; n++, i += sizeof(__m256i)) {
+            const __m256i words = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+            if constexpr (copy) {
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(destination + i), words);
+            }
+            lanes_a = _mm256_add_epi32(lanes_a, _mm256_unpacklo_epi16(words, zero));
+            lanes_b = _mm256_add_epi32(lanes_b, _mm256_unpackhi_epi16(words, zero));
+        }
+        array<uint32_t, 16> lane_sums{};
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(lane_sums.data()), lanes_a);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(lane_sums.data() + 8), lanes_b);
+        for (const uint32_t lane_sum : lane_sums) {
+            sum += lane_sum;
+        }
+    }
+    // (the tail runs legacy SSE code, which stalls on the upper halves of the registers unless they are cleared)
+    _mm256_zeroupper();
+    return from_native(fold(sum)) + sum_sse2<copy>(data + i, size - i, offset<copy>(destination, i));
+}
+#endif
+
+//! \param[in] kernel is the kernel to run
+//! \param[in] data is the bytes to sum
+//! \param[in] size is the number of bytes (even)
+//! \param[out] destination is where to copy them, if `copy`
+//! \returns the sum of their big-endian 16-bit words
+template <bool copy>
+static uint64_t sum_with(const InternetChecksum::Kernel kernel,
+                         const uint8_t *data,
+                         const size_t size,
+                         uint8_t *destination) {
+    using Kernel = InternetChecksum::Kernel;
+    switch (kernel) {
+        case Kernel::Bytewise:
+            return sum_bytewise<copy>(data, size, destination);
+        case Kernel::Word:
+            return sum_words<copy>(data, size, destination);
+#if defined(__x86_64__) || defined(__i386__)
+        case Kernel::SSE2:
+            return sum_sse2<copy>(data, size, destination);
+        case Kernel::AVX2:
+            return sum_avx2<copy>(data, size, destination);
+#endif
+        default:
+            throw runtime_error("InternetChecksum: kernel not supported by this CPU");
+    }
+}
+
+//! \param[in] kernel is the kernel to ask about
+//! \returns whether this CPU can run it
+bool InternetChecksum::supported(const Kernel kernel) {
+    switch (kernel) {
+        case Kernel::Bytewise:
+        case Kernel::Word:
+            return true;
+#if defined(__x86_64__) || defined(__i386__)
+        case Kernel::SSE2:
+            return __builtin_cpu_supports("sse2");
+        case Kernel::AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+//! \returns the fastest kernel this CPU can run (decided once)
+InternetChecksum::Kernel InternetChecksum::fastest_kernel() {
+    static const Kernel fastest = [] {
+        for (const Kernel kernel : {Kernel::AVX2, Kernel::SSE2}) {
+            if (supported(kernel)) {
+                return kernel;
+            }
+        }
+        return Kernel::Word;
+    }();
+    return fastest;
+}
+
 //! \note This class returns the checksum in host byte order.
 //!       See https://commandcenter.blogspot.com/2012/04/byte-order-fallacy.html for rationale
 //! \details This class can be used to either check or compute an Internet checksum
@@ -84,27 +281,109 @@ mt19937 get_random_generator() {
 //!
 //! For more information, see the [Wikipedia page](https://en.wikipedia.org/wiki/IPv4_header_checksum)
 //! on the Internet checksum, and consult the [IP](\ref rfc::rfc791) and [TCP](\ref rfc::rfc793) RFCs.
-InternetChecksum::InternetChecksum(const uint32_t initial_sum) : _sum(initial_sum) {}
+//! \param[in] initial_sum is added to the sum first
+InternetChecksum::InternetChecksum(const uint32_t initial_sum) : _sum(initial_sum), _kernel(fastest_kernel()) {}
+
+//! \param[in] initial_sum is added to the sum first
+//! \param[in] kernel is how to sum the data (see supported())
+InternetChecksum::InternetChecksum(const uint32_t initial_sum, const Kernel kernel)
+    : _sum(initial_sum), _kernel(kernel) {
+    if (not supported(kernel)) {
+        throw runtime_error("InternetChecksum: kernel not supported by this CPU");
+    }
+}
 
-void InternetChecksum::add(std::string_view data) {
-    for (size_t i = 0; i < data.size(); i++) {
-        uint16_t val = uint8_t(data[i]);
-        if (not _parity) {
-            val <<= 8;
+//! \param[in] data is the next piece of the data to checksum
+//! \param[out] destination is where to copy it, or `nullptr` not to
+//! \details The data is summed as big-endian 16-bit words, counting from the first byte ever added, so
+//! a piece of odd length leaves its last byte as the high-order half of a word that the next piece ends.
+void InternetChecksum::_add(std::string_view data, char *destination) {
+    const auto *bytes = reinterpret_cast<const uint8_t *>(data.data());
+    auto *copy = reinterpret_cast<uint8_t *>(destination);
+    size_t size = data.size();
+    if (size == 0) {
+        return;
+    }
+
+    // finish a word left open by an odd-length piece
+    if (_parity) {
+        _sum += bytes[0];
+        if (copy) {
+            *copy++ = bytes[0];
+        }
+        bytes++;
+        size--;
+        _parity = false;
+    }
+
+    const size_t even_size = size & ~size_t{1};
+    _sum += copy ? sum_with<true>(_kernel, bytes, even_size, copy) : sum_with<false>(_kernel, bytes, even_size, copy);
+
+    // start a word that the next piece will finish
+    if (even_size < size) {
+        _sum += uint16_t(bytes[even_size] << 8);
+        if (copy) {
+            copy[even_size] = bytes[even_size];
         }
-        _sum += val;
-        _parity = !_parity;
+        _parity = true;
     }
 }
 
-uint16_t InternetChecksum::value() const {
-    uint32_t ret = _sum;
+//! \param[in] data is the next piece of the data to checksum
+void InternetChecksum::add(std::string_view data) { _add(data, nullptr); }
+
+//! \param[out] destination is where to copy `source` (with room for all of it)
+//! \param[in] source is the next piece of the data to checksum
+//! \details Each byte is read once, so this costs about as much as the copy alone.
+void InternetChecksum::copy_and_add(char *destination, std::string_view source) { _add(source, destination); }
+
+uint16_t InternetChecksum::value() const { return ~fold(_sum); }
 
-    while (ret > 0xffff) {
-        ret = (ret >> 16) + (ret & 0xffff);
+// The updates use equation 3 of RFC 1624, HC' = ~(~HC + ~m + m'), in which (unlike the equations of
+// RFC 1141) a field changing back to its old value gives back the old checksum. The result equals the
+// recomputed checksum, except that 0x0000 and 0xffff (which are the same in one's complement) may trade
+// places when the data sums to zero.
+
+//! \param[in] checksum is the checksum before the change (as value() returned it, in host byte order)
+//! \param[in] old_value is the field's old value (in host byte order)
+//! \param[in] new_value is the field's new value
+//! \returns the checksum after the change
+uint16_t InternetChecksum::update16(const uint16_t checksum, const uint16_t old_value, const uint16_t new_value) {
+    return ~fold(uint64_t{uint16_t(~checksum)} + uint16_t(~old_value) + new_value);
+}
+
+//! \param[in] checksum is the checksum before the change (as value() returned it, in host byte order)
+//! \param[in] old_value is the field's old value (in host byte order)
+//! \param[in] new_value is the field's new value
+//! \returns the checksum after the change
+uint16_t InternetChecksum::update32(const uint16_t checksum, const uint32_t old_value, const uint32_t new_value) {
+    return ~fold(uint64_t{uint16_t(~checksum)} + uint16_t(~(old_value >> 16)) + uint16_t(~old_value) +
+                 (new_value >> 16) + (new_value & 0xffff));
+}
+
+//! \param[in] checksum is the checksum before the change (as value() returned it, in host byte order)
+//! \param[in] old_bytes is the field's old contents
+//! \param[in] new_bytes is the field's new contents (the same length; throws std::runtime_error if not)
+//! \returns the checksum after the change
+uint16_t InternetChecksum::update(const uint16_t checksum, std::string_view old_bytes, std::string_view new_bytes) {
+    if (old_bytes.size() != new_bytes.size()) {
+        throw runtime_error("InternetChecksum::update: the old and new fields differ in length");
     }
 
-    return ~ret;
+    // ~HC is the sum of everything else; take away the old field (add its negation) and add the new one
+    InternetChecksum old_sum, new_sum;
+    old_sum.add(old_bytes);
+    new_sum.add(new_bytes);
+    return ~fold(uint64_t{uint16_t(~checksum)} + old_sum.value() + fold(new_sum._sum));
+}
+
+//! \param[out] destination is where to copy `source`
+//! \param[in] source is the data to copy and checksum
+//! \returns the checksum of `source`
+uint16_t copy_and_checksum(char *destination, std::string_view source) {
+    InternetChecksum checksum;
+    checksum.copy_and_add(destination, source);
+    return checksum.value();
 }
 
 //! \param[in] data is a pointer to the bytes to show
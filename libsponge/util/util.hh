@@ -9,6 +9,7 @@
 #include <ostream>
 #include <random>
 #include <string>
+#include <string_view>
 #include <system_error>
 #include <vector>
 
@@ -51,18 +52,70 @@ std::mt19937 get_random_generator();
 //! Get the time in milliseconds since the program began.
 uint64_t timestamp_ms();
 
+//! Get the time in nanoseconds from a monotonic clock (for measuring intervals).
+uint64_t timestamp_ns();
+
 //! The internet checksum algorithm
 class InternetChecksum {
+  public:
+    //! How add() sums the data
+    enum class Kernel {
+        Bytewise,  //!< A byte at a time (the reference)
+        Word,      //!< Eight bytes at a time, with 64-bit end-around carry
+        SSE2,      //!< Sixteen bytes at a time (x86 only)
+        AVX2,      //!< Thirty-two bytes at a time (x86 only, if the CPU has AVX2)
+    };
+
   private:
-    uint32_t _sum;
-    bool _parity{};
+    uint64_t _sum;   //!< The one's-complement sum so far (not yet folded to 16 bits)
+    bool _parity{};  //!< Whether an odd number of bytes has been added (so the next is a low-order byte)
+    Kernel _kernel;  //!< How add() sums the data
+
+    //! Add `data` to the sum, copying it to `destination` if that isn't null
+    void _add(std::string_view data, char *destination);
 
   public:
+    //! Start with `initial_sum` (e.g., a pseudo-header's sum), summing with the fastest kernel this CPU has
     InternetChecksum(const uint32_t initial_sum = 0);
+
+    //! Start with `initial_sum`, summing with `kernel` (which throws std::runtime_error if the CPU lacks it)
+    InternetChecksum(const uint32_t initial_sum, const Kernel kernel);
+
+    //! Add `data` to the sum (it may continue an odd-length piece added before)
     void add(std::string_view data);
+
+    //! Copy `source` to `destination` and add it to the sum, in one pass over the data
+    void copy_and_add(char *destination, std::string_view source);
+
+    //! The checksum: the one's complement of the folded sum
     uint16_t value() const;
+
+    //! \name Incremental updates, as in RFC 1624
+    //! When a few fields of checksummed data change, these give the new checksum from the old one, without
+    //! reading the rest of the data. A field must start at an even offset in the data (to update a single
+    //! byte, such as the IPv4 TTL, pass the 16-bit word that holds it).
+    //!@{
+
+    //! The checksum of data whose 16-bit field changed from `old_value` to `new_value`
+    static uint16_t update16(const uint16_t checksum, const uint16_t old_value, const uint16_t new_value);
+
+    //! The checksum of data whose 32-bit field (e.g., an IPv4 address) changed from `old_value` to `new_value`
+    static uint16_t update32(const uint16_t checksum, const uint32_t old_value, const uint32_t new_value);
+
+    //! The checksum of data whose field (e.g., an IPv6 address) changed from `old_bytes` to `new_bytes`
+    static uint16_t update(const uint16_t checksum, std::string_view old_bytes, std::string_view new_bytes);
+    //!@}
+
+    //! Whether this CPU can run `kernel`
+    static bool supported(const Kernel kernel);
+
+    //! The fastest kernel this CPU can run
+    static Kernel fastest_kernel();
 };
 
+//! Copy `source` to `destination` (with room for all of it) and return its checksum, in one pass over the data
+uint16_t copy_and_checksum(char *destination, std::string_view source);
+
 //! Hexdump the contents of a packet (or any other sequence of bytes)
 void hexdump(const char *data, const size_t len, const size_t indent = 0);
 
@@ -0,0 +1,142 @@
+#include "address.hh"
+#include "test_err_if.hh"
+
+#include <arpa/inet.h>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+
+using namespace std;
+
+static Address ipv6(const array<uint8_t, 16> &bytes, const uint16_t port, const uint32_t scope = 0) {
+    sockaddr_in6 ipv6_addr{};
+    ipv6_addr.sin6_family = AF_INET6;
+    ipv6_addr.sin6_port = htons(port);
+    ipv6_addr.sin6_scope_id = scope;
+    memcpy(&ipv6_addr.sin6_addr, bytes.data(), bytes.size());
+    return {reinterpret_cast<const sockaddr *>(&ipv6_addr), sizeof(ipv6_addr)};
+}
+
+static Address ipv6(const string &text, const uint16_t port, const uint32_t scope = 0) {
+    array<uint8_t, 16> bytes{};
+    test_check(inet_pton(AF_INET6, text.c_str(), bytes.data()) == 1, "bad IPv6 address in test: " + text);
+    return ipv6(bytes, port, scope);
+}
+
+//! What getnameinfo (which Address used to format with) makes of `address`
+static string reference_ip(const Address &address) {
+    array<char, NI_MAXHOST> host{};
+    test_check(getnameinfo(address, address.size(), host.data(), host.size(), nullptr, 0, NI_NUMERICHOST) == 0,
+               "getnameinfo failed");
+    return host.data();
+}
+
+int main() {
+    try {
+        // IPv4, as before
+        const Address google("8.8.8.8", 53);
+        test_check(google.to_string() == "8.8.8.8:53", "wrong IPv4 text: " + google.to_string());
+        test_check(google.ip_port() == make_pair(string("8.8.8.8"), uint16_t{53}), "wrong ip_port");
+        test_check(Address::from_ipv4_numeric(0).to_string() == "0.0.0.0:0", "wrong zero address");
+        test_check(Address("255.255.255.255", 65535).to_string() == "255.255.255.255:65535", "wrong broadcast address");
+
+        // IPv6, in the canonical form, with the port after the brackets
+        const pair<string, string> canonical[] = {
+            {"::", "::"},
+            {"::1", "::1"},
+            {"2001:DB8:0:0:0:0:2:1", "2001:db8::2:1"},
+            {"2001:db8:0:1:1:1:1:1", "2001:db8:0:1:1:1:1:1"},
+            {"2001:0:0:1:0:0:0:1", "2001:0:0:1::1"},
+            {"2001:db8:0:0:1:0:0:1", "2001:db8::1:0:0:1"},
+            {"fe80::", "fe80::"},
+            {"::ffff:192.0.2.1", "::ffff:192.0.2.1"},
+            {"1:0:0:0:0:0:0:0", "1::"},
+        };
+        for (const auto &[text, expected] : canonical) {
+            const Address address = ipv6(text, 443);
+            test_check(address.ip() == expected, "wrong IPv6 text for " + text + ": " + address.ip());
+            test_check(address.to_string() == "[" + expected + "]:443", "wrong IPv6 to_string: " + address.to_string());
+            test_check(address.port() == 443, "wrong IPv6 port");
+        }
+        test_check(ipv6("fe80::1", 1, 7).to_string() == "[fe80::1%7]:1", "wrong IPv6 scope");
+
+        // random addresses (with plenty of zero groups) are formatted as getnameinfo formats them
+        mt19937 generator{12345};
+        for (unsigned i = 0; i < 100000; i++) {
+            array<uint8_t, 16> bytes{};
+            for (size_t group = 0; group < 8; group++) {
+                if (generator() % 2) {
+                    const auto value = generator() % 3 ? generator() : generator() % 16;
+                    bytes[2 * group] = static_cast<uint8_t>(value >> 8);
+                    bytes[2 * group + 1] = static_cast<uint8_t>(value);
+                }
+            }
+            if (i % 10 == 0) {
+                bytes[10] = bytes[11] = 0xff;
+                memset(bytes.data(), 0, 10);
+            }
+            const Address address = ipv6(bytes, 0);
+            test_check(address.ip() == reference_ip(address),
+                       "IPv6 mismatch: " + address.ip() + " vs " + reference_ip(address));
+
+            const Address v4 = Address::from_ipv4_numeric(generator());
+            test_check(v4.ip() == reference_ip(v4), "IPv4 mismatch: " + v4.ip() + " vs " + reference_ip(v4));
+        }
+
+        // formatting into a caller's buffer
+        const Address longest = ipv6("0:0:0:0:0:ffff:255.255.255.255", 65535, 4294967295);
+        array<char, Address::max_formatted_size> buffer{};
+        const size_t length = longest.format(buffer.data(), buffer.size());
+        test_check(string(buffer.data(), length) == "[::ffff:255.255.255.255%4294967295]:65535", "wrong longest text");
+        test_check(google.format(buffer.data(), 10) == 10, "wrong length");
+        test_check(string(buffer.data(), 10) == "8.8.8.8:53", "wrong text in small buffer");
+        test_check(google.format_ip(buffer.data(), 7) == 7 and string(buffer.data(), 7) == "8.8.8.8",
+                   "wrong format_ip");
+        bool threw = false;
+        try {
+            google.format(buffer.data(), 9);
+        } catch (const runtime_error &) {
+            threw = true;
+        }
+        test_check(threw, "expected an exception for a short buffer");
+
+        // equality, hashing, and ordering
+        test_check(Address("10.0.0.1", 80) != Address::from_ipv4_numeric(0x0a000001), "port ignored");
+        test_check(ipv6("::1", 80) == ipv6("::1", 80) and ipv6("::1", 80) != ipv6("::1", 81), "wrong IPv6 equality");
+        test_check(ipv6("fe80::1", 80, 1) != ipv6("fe80::1", 80, 2), "scope ignored");
+        test_check(hash<Address>{}(ipv6("::1", 80)) == ipv6("::1", 80).hash(), "std::hash disagrees with hash()");
+
+        unordered_set<Address> seen;
+        for (uint32_t i = 0; i < 1000; i++) {
+            seen.insert(Address::from_ipv4_numeric(0x0a000000 + i));
+            seen.insert(Address::from_ipv4_numeric(0x0a000000 + i));
+        }
+        test_check(seen.size() == 1000, "wrong number of distinct addresses");
+        test_check(seen.count(Address("10.0.1.0", 0)) == 1 and seen.count(Address("10.0.4.0", 0)) == 0, "wrong lookup");
+
+        map<Address, int> ordered;
+        ordered[Address("10.0.0.2", 1)] = 3;
+        ordered[Address("10.0.0.1", 2)] = 2;
+        ordered[Address("10.0.0.1", 1)] = 1;
+        ordered[Address("9.255.255.255", 65535)] = 0;
+        ordered[ipv6("::", 0)] = 4;
+        int expected = 0;
+        for (const auto &[address, value] : ordered) {
+            test_check(value == expected++, "wrong order at " + address.to_string());
+        }
+        test_check(Address("1.2.3.4", 5) <= Address("1.2.3.4", 5) and Address("1.2.3.4", 6) > Address("1.2.3.4", 5),
+                   "wrong comparison operators");
+    } catch (const exception &e) {
+        cerr << "Exception: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
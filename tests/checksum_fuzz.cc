@@ -0,0 +1,150 @@
+#include "util.hh"
+
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A differential fuzz target for InternetChecksum: every kernel must agree with a reference
+// implementation, however the data is split between add() calls and wherever it sits in memory.
+//
+// Built as is, it is a test: with no arguments it runs on random inputs, and otherwise it runs on the
+// files named (e.g., a crash that a fuzzer found). Built with -DSPONGE_FUZZER_ENGINE and a fuzzing
+// engine (e.g., clang++ -fsanitize=fuzzer), the engine supplies the inputs instead.
+
+using namespace std;
+
+using Kernel = InternetChecksum::Kernel;
+
+[[noreturn]] static void fail(const string &what) {
+    cerr << "Mismatch: " << what << endl;
+    abort();
+}
+
+//! The checksum of `data`, straight from RFC 1071
+static uint16_t reference(string_view data, const uint32_t initial_sum) {
+    uint64_t sum = initial_sum;
+    for (size_t i = 0; i < data.size(); i++) {
+        sum += i % 2 ? uint8_t(data[i]) : uint8_t(data[i]) << 8;
+    }
+    while (sum > 0xffff) {
+        sum = (sum >> 16) + (sum & 0xffff);
+    }
+    return ~sum;
+}
+
+//! Whether two checksums are the same number in one's complement (where 0x0000 and 0xffff are both zero)
+static bool same(const uint16_t a, const uint16_t b) { return a == b or (a % 0xffff == 0 and b % 0xffff == 0); }
+
+//! \brief Check one input
+//! \details The first bytes choose the alignment, the initial sum, and the split points; the rest is the data.
+static void run(string_view input) {
+    const auto take = [&input]() -> uint8_t {
+        if (input.empty()) {
+            return 0;
+        }
+        const uint8_t byte = input.front();
+        input.remove_prefix(1);
+        return byte;
+    };
+    const auto take16 = [&take] {
+        const uint16_t high = take();
+        return uint16_t(high << 8 | take());
+    };
+    const size_t alignment = take() % 64;
+    const uint32_t initial_sum = take16();
+    vector<size_t> splits(take() % 8);
+    for (auto &split : splits) {
+        split = take16();
+    }
+    const string_view data = input;
+    for (auto &split : splits) {
+        split = data.empty() ? 0 : split % data.size();
+    }
+    sort(splits.begin(), splits.end());
+
+    const uint16_t expected = reference(data, initial_sum);
+    string source(alignment + data.size(), '\0'), copy(alignment + data.size() + 1, '\0');
+    copy_n(data.begin(), data.size(), source.begin() + alignment);
+    const string_view aligned = string_view(source).substr(alignment);
+
+    for (const Kernel kernel : {Kernel::Bytewise, Kernel::Word, Kernel::SSE2, Kernel::AVX2}) {
+        if (not InternetChecksum::supported(kernel)) {
+            continue;
+        }
+        InternetChecksum sum{initial_sum, kernel}, copy_sum{initial_sum, kernel};
+        copy.back() = '!';
+        size_t start = 0;
+        for (size_t i = 0; i <= splits.size(); i++) {
+            const size_t end = i < splits.size() ? splits[i] : data.size();
+            sum.add(aligned.substr(start, end - start));
+            copy_sum.copy_and_add(copy.data() + alignment + start, aligned.substr(start, end - start));
+            start = end;
+        }
+
+        const string name = "kernel " + to_string(int(kernel)) + " on " + to_string(data.size()) + " bytes";
+        if (sum.value() != expected) {
+            fail(name + ": add() gave " + to_string(sum.value()) + ", not " + to_string(expected));
+        }
+        if (copy_sum.value() != expected) {
+            fail(name + ": copy_and_add() gave " + to_string(copy_sum.value()) + ", not " + to_string(expected));
+        }
+        if (string_view(copy).substr(alignment, data.size()) != data or copy.back() != '!') {
+            fail(name + ": copy_and_add() copied the wrong bytes");
+        }
+    }
+
+    // rewriting the field between the first two split points (from an even offset)
+    if (splits.size() >= 2) {
+        const size_t field_start = splits[0] & ~size_t{1};
+        const size_t field_size = splits[1] - field_start;
+        string rewritten(data);
+        reverse(rewritten.begin() + field_start, rewritten.begin() + field_start + field_size);
+        const uint16_t updated = InternetChecksum::update(
+            expected, data.substr(field_start, field_size), string_view(rewritten).substr(field_start, field_size));
+        if (not same(updated, reference(rewritten, initial_sum))) {
+            fail("update() gave " + to_string(updated) + ", not " + to_string(reference(rewritten, initial_sum)));
+        }
+    }
+}
+
+//! The entry point for a fuzzing engine
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    run(string_view(reinterpret_cast<const char *>(data), size));
+    return 0;
+}
+
+#ifndef SPONGE_FUZZER_ENGINE
+int main(int argc, char *argv[]) {
+    try {
+        if (argc > 1) {
+            for (int i = 1; i < argc; i++) {
+                ifstream file{argv[i], ios::binary};
+                if (not file) {
+                    throw runtime_error(string("can't read ") + argv[i]);
+                }
+                run(string(istreambuf_iterator<char>(file), {}));
+            }
+            return EXIT_SUCCESS;
+        }
+
+        auto rd = get_random_generator();
+        for (unsigned trial = 0; trial < 20000; trial++) {
+            string input(20 + (trial % 50 == 0 ? rd() % 70000 : rd() % 3000), '\0');
+            generate(input.begin(), input.end(), [&] { return trial % 9 == 0 ? '\xff' : char(rd()); });
+            run(input);
+        }
+    } catch (const exception &e) {
+        cerr << "Exception: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+#endif
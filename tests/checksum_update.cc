@@ -0,0 +1,112 @@
+#include "test_err_if.hh"
+#include "util.hh"
+
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+static uint16_t checksum(const string &data) {
+    InternetChecksum sum;
+    sum.add(data);
+    return sum.value();
+}
+
+//! Whether two checksums are the same number in one's complement (where 0x0000 and 0xffff are both zero)
+static bool same(const uint16_t a, const uint16_t b) { return a == b or (a % 0xffff == 0 and b % 0xffff == 0); }
+
+static uint32_t read_field(const string &data, const size_t offset, const size_t size) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < size; i++) {
+        value = value << 8 | uint8_t(data[offset + i]);
+    }
+    return value;
+}
+
+static void write_field(string &data, const size_t offset, const size_t size, uint32_t value) {
+    for (size_t i = size; i > 0; i--) {
+        data[offset + i - 1] = char(value & 0xff);
+        value >>= 8;
+    }
+}
+
+int main() {
+    try {
+        // the example from RFC 1624, section 4: HC' = ~(~0xdd2f + ~0x5555 + 0x3285)
+        test_check(InternetChecksum::update16(0xdd2f, 0x5555, 0x3285) == 0x0000,
+                   "wrong result for the RFC 1624 example");
+
+        // decrementing the TTL of an IPv4 header
+        string header{'\x45', '\x00', '\x00', '\x54', '\x12', '\x34', '\x40', '\x00', '\x40', '\x01',
+                      '\x00', '\x00', '\x0a', '\x00', '\x00', '\x01', '\x0a', '\x00', '\x00', '\x02'};
+        const uint16_t header_checksum = checksum(header);
+        header[8]--;
+        test_check(InternetChecksum::update16(header_checksum, 0x4001, 0x3f01) == checksum(header), "wrong TTL update");
+
+        // random packets with random fields rewritten, against recomputing from scratch
+        auto rd = get_random_generator();
+        for (unsigned trial = 0; trial < 100000; trial++) {
+            string packet(2 * (2 + rd() % 750) + rd() % 2, '\0');
+            generate(packet.begin(), packet.end(), [&] { return trial % 5 == 0 ? '\xff' : char(rd()); });
+            uint16_t expected = checksum(packet);
+
+            for (unsigned change = 0, changes = 1 + rd() % 4; change < changes; change++) {
+                uint16_t updated = 0;
+                switch (rd() % 3) {
+                    case 0: {
+                        const size_t offset = 2 * (rd() % (packet.size() / 2));
+                        const uint32_t old_value = read_field(packet, offset, 2);
+                        const uint32_t new_value = rd() % 4 ? rd() & 0xffff : old_value;
+                        write_field(packet, offset, 2, new_value);
+                        updated = InternetChecksum::update16(expected, old_value, new_value);
+                        break;
+                    }
+                    case 1: {
+                        const size_t offset = 2 * (rd() % (packet.size() / 2 - 1));
+                        const uint32_t old_value = read_field(packet, offset, 4);
+                        const uint32_t new_value = rd();
+                        write_field(packet, offset, 4, new_value);
+                        updated = InternetChecksum::update32(expected, old_value, new_value);
+                        break;
+                    }
+                    default: {
+                        // (possibly running to an odd end of the packet)
+                        const size_t offset = 2 * (rd() % (packet.size() / 2));
+                        const size_t size = min(size_t{1} + rd() % 40, packet.size() - offset);
+                        const string old_bytes = packet.substr(offset, size);
+                        string new_bytes(size, '\0');
+                        generate(new_bytes.begin(), new_bytes.end(), [&] { return char(rd()); });
+                        packet.replace(offset, size, new_bytes);
+                        updated = InternetChecksum::update(expected, old_bytes, new_bytes);
+                        break;
+                    }
+                }
+                expected = checksum(packet);
+                test_check(same(updated, expected),
+                           "update gave " + to_string(updated) + ", not " + to_string(expected));
+                expected = updated;  // (later updates build on this one, as a forwarding path's would)
+            }
+        }
+
+        // changing a field back gives back the original checksum
+        const uint16_t changed = InternetChecksum::update16(0x1234, 0xabcd, 0x0f0f);
+        test_check(InternetChecksum::update16(changed, 0x0f0f, 0xabcd) == 0x1234, "round trip changed the checksum");
+
+        bool threw = false;
+        try {
+            InternetChecksum::update(0, "ab", "abc");
+        } catch (const runtime_error &) {
+            threw = true;
+        }
+        test_check(threw, "expected fields of different lengths to be rejected");
+    } catch (const exception &e) {
+        cerr << "Exception: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
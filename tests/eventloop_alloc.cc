@@ -0,0 +1,130 @@
+#include "eventloop.hh"
+#include "inline_function.hh"
+#include "socket.hh"
+#include "test_err_if.hh"
+
+#include <array>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <sys/socket.h>
+#include <vector>
+
+using namespace std;
+
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+    allocations++;
+    if (void *ptr = malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+
+static pair<LocalStreamSocket, LocalStreamSocket> socket_pair() {
+    int fds[2];
+    SystemCall("socketpair", ::socketpair(AF_UNIX, SOCK_STREAM, 0, static_cast<int *>(fds)));
+    return {LocalStreamSocket(FileDescriptor(fds[0])), LocalStreamSocket(FileDescriptor(fds[1]))};
+}
+
+static void run_tests(const EventLoop::Backend backend) {
+    // once warmed up, adding, pausing, resuming, and canceling rules does not allocate
+    {
+        EventLoop loop{backend};
+        auto [a, b] = socket_pair();
+        vector<EventLoop::RuleHandle> handles(200);
+        unsigned cancels = 0;
+        bool interested = false;
+        bool as_expected = true;  // (checked afterwards, since check's message is itself allocated)
+
+        const auto churn = [&] {
+            for (size_t i = 0; i < handles.size(); i++) {
+                // a callback capturing a few references and values, as a connection's would
+                const auto callback = [&a, &b, &cancels, i] {
+                    if (a.closed() or b.closed()) {
+                        cancels += i;
+                    }
+                };
+                if (i % 2) {
+                    handles[i] = loop.add_rule(
+                        b, Direction::In, callback, [&interested] { return interested; }, [&cancels] { cancels++; });
+                } else {
+                    handles[i] = loop.add_rule(
+                        b, Direction::Out, callback, {}, [&cancels] { cancels++; });
+                    handles[i].pause();
+                }
+            }
+            as_expected = as_expected and loop.wait_next_event(0) == EventLoop::Result::Exit;
+            for (size_t i = 0; i < handles.size(); i += 4) {
+                handles[i].resume();
+                handles[i].pause();
+                handles[i].set_direction(Direction::In);
+            }
+            for (auto &handle : handles) {
+                as_expected = as_expected and handle.cancel();
+            }
+            as_expected = as_expected and loop.wait_next_event(0) == EventLoop::Result::Exit;
+        };
+
+        churn();  // grow the EventLoop's storage
+        const size_t before = allocations;
+        for (unsigned round = 0; round < 10; round++) {
+            churn();
+        }
+        const size_t after = allocations;
+        test_check(after == before, "rule churn allocated " + to_string(after - before) + " times in steady state");
+        test_check(as_expected, "expected Exit from each wait, and every cancel to succeed");
+        test_check(cancels == 11 * handles.size(), "cancel callbacks were not called");
+    }
+}
+
+int main() {
+    try {
+        // InlineFunction stores small callables in place, and falls back to the heap for large ones
+        {
+            int calls = 0;
+            const auto small = [&calls] { calls++; };
+            const array<char, 128> big{};
+            const auto large = [&calls, big] { calls += big.size(); };
+            static_assert(InlineFunction<void()>::stored_inline<decltype(small)>);
+            static_assert(not InlineFunction<void()>::stored_inline<decltype(large)>);
+
+            size_t before = allocations;
+            InlineFunction<void()> f{small};
+            InlineFunction<void()> g{move(f)};
+            g();
+            size_t after = allocations;  // (check's message is itself allocated)
+            test_check(after == before and calls == 1 and not f and g, "small callable allocated or misbehaved");
+
+            before = allocations;
+            InlineFunction<void()> h{large};
+            after = allocations;
+            test_check(after == before + 1, "large callable was not allocated");
+            g = move(h);
+            g();
+            test_check(calls == 129 and not h, "large callable misbehaved");
+
+            // move-only callables, and values passed through
+            InlineFunction<int(int)> add{[offset = make_unique<int>(5)](const int x) { return x + *offset; }};
+            test_check(add(2) == 7, "move-only callable misbehaved");
+            add = nullptr;
+            test_check(not add, "assigning nullptr did not empty the InlineFunction");
+        }
+
+        run_tests(EventLoop::Backend::Poll);
+        run_tests(EventLoop::Backend::Epoll);
+    } catch (const exception &e) {
+        cerr << "Exception: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
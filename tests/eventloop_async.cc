@@ -0,0 +1,178 @@
+#include "async.hh"
+#include "eventloop.hh"
+#include "socket.hh"
+#include "test_err_if.hh"
+
+#include <cerrno>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+
+using namespace std;
+
+static Task<> echo(EventLoop &loop, TCPSocket connection) {
+    while (true) {
+        string data = co_await async_read(loop, connection);
+        if (data.empty()) {
+            co_return;
+        }
+        co_await async_write(loop, connection, move(data));
+    }
+}
+
+static Task<> serve(EventLoop &loop, TCPSocket &listener, const unsigned sessions) {
+    for (unsigned i = 0; i < sessions; i++) {
+        spawn(loop, echo(loop, co_await async_accept(loop, listener)));
+    }
+}
+
+static Task<> client(EventLoop &loop, const Address address, const unsigned id, unsigned &completed) {
+    TCPSocket socket;
+    socket.set_blocking(false);
+    co_await async_connect(loop, socket, address);
+
+    for (unsigned round = 0; round < 3; round++) {
+        const string message = "session " + to_string(id) + " round " + to_string(round) + string(id * 10, '.');
+        co_await async_write(loop, socket, message);
+        string reply;
+        while (reply.size() < message.size()) {
+            reply += co_await async_read(loop, socket);
+            test_check(not socket.eof(), "unexpected EOF from echo server");
+        }
+        test_check(reply == message, "wrong reply to session " + to_string(id));
+    }
+
+    socket.shutdown(SHUT_WR);
+    test_check((co_await async_read(loop, socket)).empty() and socket.eof(), "expected EOF after shutdown");
+    completed++;
+}
+
+static Task<int> add_later(EventLoop &loop, const int a, const int b) {
+    co_await sleep_for(loop, 5);
+    co_return a + b;
+}
+
+static Task<int> fail_later(EventLoop &loop) {
+    co_await sleep_for(loop, 1);
+    throw runtime_error("failed later");
+}
+
+static void run_tests(const EventLoop::Backend backend) {
+    // many concurrent echo sessions on one thread, each written as straight-line code
+    {
+        EventLoop loop{backend};
+        TCPSocket listener;
+        listener.set_blocking(false);
+        listener.bind(Address("127.0.0.1", 0));
+        listener.listen(256);
+
+        const unsigned sessions = 200;
+        unsigned completed = 0;
+        spawn(loop, serve(loop, listener, sessions));
+        for (unsigned i = 0; i < sessions; i++) {
+            spawn(loop, client(loop, listener.local_address(), i, completed));
+        }
+        while (loop.wait_next_event(5000) == EventLoop::Result::Success) {
+        }
+        test_check(completed == sessions, "only " + to_string(completed) + " sessions completed");
+    }
+
+    // awaiting a Task yields its value or rethrows its exception; sleeps finish in deadline order
+    {
+        EventLoop loop{backend};
+        string order;
+        int sum = 0;
+        bool caught = false;
+        // (coroutine lambdas take arguments rather than capturing, since the closure dies before they finish)
+        spawn(loop, [](EventLoop &l, int &total, bool &failed) -> Task<> {
+            total = co_await add_later(l, 2, 3);
+            try {
+                co_await fail_later(l);
+            } catch (const runtime_error &e) {
+                failed = string(e.what()) == "failed later";
+            }
+        }(loop, sum, caught));
+        for (const auto &[name, delay] : {pair{'c', 30}, pair{'a', 10}, pair{'b', 20}}) {
+            spawn(loop, [](EventLoop &l, string &out, const char c, const int ms) -> Task<> {
+                co_await sleep_for(l, ms);
+                out += c;
+            }(loop, order, name, delay));
+        }
+        while (loop.wait_next_event(1000) == EventLoop::Result::Success) {
+        }
+        test_check(sum == 5 and caught, "awaited Task misbehaved");
+        test_check(order == "abc", "sleeps finished out of order: " + order);
+    }
+
+    // failures: a refused connection throws, and so does closing a descriptor being awaited
+    {
+        EventLoop loop{backend};
+        Address closed_port{"127.0.0.1"};
+        {
+            TCPSocket unused;
+            unused.bind(Address("127.0.0.1", 0));
+            closed_port = unused.local_address();
+        }
+        int connect_error = 0;
+        spawn(loop, [](EventLoop &l, const Address address, int &error) -> Task<> {
+            TCPSocket socket;
+            socket.set_blocking(false);
+            try {
+                co_await async_connect(l, socket, address);
+            } catch (const unix_error &e) {
+                error = e.code().value();
+            }
+        }(loop, closed_port, connect_error));
+
+        TCPSocket listener;
+        listener.set_blocking(false);
+        listener.bind(Address("127.0.0.1", 0));
+        listener.listen();
+        bool closed_while_awaiting = false;
+        spawn(loop, [](EventLoop &l, TCPSocket &socket, bool &closed) -> Task<> {
+            try {
+                co_await async_accept(l, socket);
+            } catch (const runtime_error &) {
+                closed = true;
+            }
+        }(loop, listener, closed_while_awaiting));
+        listener.close();
+
+        while (loop.wait_next_event(1000) == EventLoop::Result::Success) {
+        }
+        test_check(connect_error == ECONNREFUSED, "expected ECONNREFUSED, got " + to_string(connect_error));
+        test_check(closed_while_awaiting, "closing an awaited descriptor did not fail the operation");
+    }
+
+    // an exception escaping a detached Task is rethrown from wait_next_event
+    {
+        EventLoop loop{backend};
+        spawn(loop, [](EventLoop &l) -> Task<> {
+            co_await sleep_for(l, 1);
+            throw runtime_error("escaped");
+        }(loop));
+        bool rethrown = false;
+        try {
+            while (loop.wait_next_event(1000) != EventLoop::Result::Exit) {
+            }
+        } catch (const runtime_error &e) {
+            rethrown = string(e.what()) == "escaped";
+        }
+        test_check(rethrown, "exception from a detached Task was lost");
+    }
+}
+
+int main() {
+    try {
+        run_tests(EventLoop::Backend::Poll);
+        run_tests(EventLoop::Backend::Epoll);
+    } catch (const exception &e) {
+        cerr << "Exception: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
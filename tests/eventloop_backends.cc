@@ -0,0 +1,330 @@
+#include "eventloop.hh"
+#include "socket.hh"
+#include "test_err_if.hh"
+
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+
+using namespace std;
+
+static pair<LocalStreamSocket, LocalStreamSocket> socket_pair() {
+    int fds[2];
+    SystemCall("socketpair", ::socketpair(AF_UNIX, SOCK_STREAM, 0, static_cast<int *>(fds)));
+    return {LocalStreamSocket(FileDescriptor(fds[0])), LocalStreamSocket(FileDescriptor(fds[1]))};
+}
+
+static void run_tests(const EventLoop::Backend backend) {
+    // read until EOF, then the rule is canceled and the loop exits
+    {
+        EventLoop loop{backend};
+        auto [a, b] = socket_pair();
+        string received;
+        bool canceled = false;
+        loop.add_rule(
+            b, Direction::In, [&] { received += b.read(); }, [] { return true; }, [&] { canceled = true; });
+
+        a.write("hello");
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Success, "expected Success");
+        test_check(received == "hello", "wrong data received");
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Timeout, "expected Timeout");
+
+        a.close();
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Success, "expected Success at EOF");
+        test_check(b.eof(), "expected EOF");
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Exit, "expected Exit");
+        test_check(canceled, "cancel callback was not called");
+    }
+
+    // interest is re-evaluated on each call, and two rules can share a descriptor
+    {
+        EventLoop loop{backend};
+        auto [a, b] = socket_pair();
+        bool want_write = false;
+        unsigned reads = 0, writes = 0;
+        loop.add_rule(b, Direction::In, [&] {
+            b.read();
+            reads++;
+        });
+        loop.add_rule(
+            b,
+            Direction::Out,
+            [&] {
+                b.write("x");
+                writes++;
+                want_write = false;
+            },
+            [&] { return want_write; });
+
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Timeout, "expected Timeout with no interest");
+        want_write = true;
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Success, "expected Success");
+        test_check(writes == 1 and reads == 0, "expected one write");
+        test_check(a.read() == "x", "wrong data written");
+
+        a.write("y");
+        want_write = true;
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Success, "expected Success");
+        test_check(writes == 2 and reads == 1, "expected a read and a write");
+    }
+
+    // a callback that doesn't service its descriptor is a busy wait
+    {
+        EventLoop loop{backend};
+        auto [a, b] = socket_pair();
+        loop.add_rule(b, Direction::In, [] {});
+        a.write("z");
+        bool threw = false;
+        try {
+            loop.wait_next_event(0);
+        } catch (const runtime_error &) {
+            threw = true;
+        }
+        test_check(threw, "busy wait was not detected");
+    }
+
+    // rule handles: pause, resume, redirect, and cancel
+    {
+        EventLoop loop{backend};
+        auto [a, b] = socket_pair();
+        string received;
+        unsigned cancels = 0;
+        auto handle = loop.add_rule(
+            b, Direction::In, [&] { received += b.read(); }, {}, [&] { cancels++; });
+
+        a.write("1");
+        handle.pause();
+        test_check(handle.paused(), "expected paused");
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Exit, "expected Exit with the only rule paused");
+        handle.resume();
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Success, "expected Success after resume");
+        test_check(received == "1", "wrong data received");
+
+        // poll for writability instead; the callback is unchanged, so it must now write
+        unsigned writes = 0;
+        auto writer = loop.add_rule(b, Direction::Out, [&] {
+            b.write("w");
+            writes++;
+        });
+        writer.pause();
+        handle.set_direction(Direction::Out);
+        handle.pause();
+        writer.resume();
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Success, "expected Success for writer");
+        test_check(writes == 1, "expected one write");
+        test_check(a.read() == "w", "wrong data written");
+
+        test_check(writer.cancel(), "cancel failed");
+        test_check(not writer.cancel(), "second cancel succeeded");
+        test_check(not writer.active(), "canceled handle still active");
+        test_check(handle.cancel() and cancels == 1, "cancel callback was not called");
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Exit, "expected Exit after cancel");
+
+        // a stale handle does nothing, even after its slot is reused
+        auto reused = loop.add_rule(b, Direction::In, [&] { received += b.read(); });
+        handle.resume();
+        handle.set_direction(Direction::Out);
+        test_check(not handle.paused() and reused.active(), "stale handle affected a new rule");
+        reused.pause();
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Exit, "expected Exit with the new rule paused");
+    }
+
+    // a callback can cancel its own rule, and closing a watched descriptor elsewhere cancels its rules
+    {
+        EventLoop loop{backend};
+        auto [a, b] = socket_pair();
+        auto [c, d] = socket_pair();
+        bool d_canceled = false;
+        EventLoop::RuleHandle self;
+        self = loop.add_rule(b, Direction::In, [&] {
+            b.read();
+            self.cancel();
+        });
+        loop.add_rule(
+            d, Direction::In, [&] { d.read(); }, {}, [&] { d_canceled = true; });
+
+        a.write("x");
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Success, "expected Success");
+        test_check(not self.active(), "rule did not cancel itself");
+
+        d.close();
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Exit, "expected Exit after close");
+        test_check(d_canceled, "closing a watched descriptor did not cancel its rule");
+    }
+
+    // edge-triggered: the callback runs until the descriptor is drained, without a busy-wait check
+    {
+        EventLoop loop{backend};
+        auto [a, b] = socket_pair();
+        b.set_blocking(false);
+        string received, chunk;
+        unsigned calls = 0;
+        EventLoop::RuleOptions options;
+        options.edge_triggered = true;
+        options.call_budget = 0;
+        loop.add_rule(
+            b,
+            Direction::In,
+            [&] {
+                calls++;
+                if (b.try_read(chunk, 1000)) {
+                    received += chunk;
+                }
+            },
+            {},
+            [] {},
+            options);
+
+        a.write(string(10000, 'x'));
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Success, "expected Success");
+        test_check(received.size() == 10000, "edge-triggered rule did not drain the descriptor");
+        test_check(calls == 11, "expected ten reads and one EAGAIN, got " + to_string(calls) + " calls");
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Timeout, "drained descriptor reported ready again");
+
+        // a callback that doesn't touch the descriptor is not a busy wait
+        EventLoop loop2{backend};
+        auto [c, d] = socket_pair();
+        loop2.add_rule(
+            d, Direction::In, [] {}, {}, [] {}, options);
+        c.write("z");
+        test_check(loop2.wait_next_event(0) == EventLoop::Result::Success, "expected Success without busy-wait error");
+    }
+
+    // budgets: a bulk rule is requeued, and a quiet rule on the same loop is served on every wait
+    {
+        EventLoop loop{backend};
+        auto [bulk_in, bulk] = socket_pair();
+        auto [quiet_in, quiet] = socket_pair();
+        bulk.set_blocking(false);
+        string chunk;
+        size_t bulk_received = 0;
+        unsigned quiet_reads = 0;
+
+        EventLoop::RuleOptions options;
+        options.edge_triggered = true;
+        options.byte_budget = 4096;
+        auto bulk_rule = loop.add_rule(
+            bulk,
+            Direction::In,
+            [&] {
+                if (bulk.try_read(chunk, 1024)) {
+                    bulk_received += chunk.size();
+                }
+            },
+            {},
+            [] {},
+            options);
+        loop.add_rule(quiet, Direction::In, [&] {
+            quiet.read();
+            quiet_reads++;
+        });
+
+        bulk_in.write(string(40000, 'b'));
+        for (unsigned i = 1; i <= 5; i++) {
+            quiet_in.write("q");
+            test_check(loop.wait_next_event(-1) == EventLoop::Result::Success, "expected Success");
+            test_check(bulk_received == 4096 * i, "bulk rule exceeded its budget: " + to_string(bulk_received));
+            test_check(quiet_reads == i, "quiet rule was not served");
+        }
+
+        // pausing stops the requeued rule; resuming picks up where it left off
+        bulk_rule.pause();
+        quiet_in.write("q");
+        test_check(loop.wait_next_event(-1) == EventLoop::Result::Success, "expected Success");
+        test_check(bulk_received == 4096 * 5, "paused rule was dispatched");
+        bulk_rule.resume();
+        while (bulk_received < 40000) {
+            test_check(loop.wait_next_event(-1) == EventLoop::Result::Success, "expected Success while draining");
+        }
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Timeout, "expected Timeout once drained");
+    }
+
+    // priorities: ready rules are dispatched High first, whatever order they were added in
+    {
+        EventLoop loop{backend};
+        auto [low_in, low] = socket_pair();
+        auto [normal_in, normal] = socket_pair();
+        auto [high_in, high] = socket_pair();
+        string order;
+
+        EventLoop::RuleOptions options;
+        options.priority = EventLoop::Priority::Low;
+        loop.add_rule(
+            low, Direction::In, [&] { order += low.read(1); }, {}, {}, options);
+        loop.add_rule(normal, Direction::In, [&] { order += normal.read(1); });
+        options.priority = EventLoop::Priority::High;
+        loop.add_rule(
+            high, Direction::In, [&] { order += high.read(1); }, {}, {}, options);
+
+        low_in.write("L");
+        normal_in.write("N");
+        high_in.write("H");
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Success, "expected Success");
+        test_check(order == "HNL", "expected dispatch in priority order, got " + order);
+
+        // with a dispatch limit, a passed-over rule is promoted ahead of High after two waits
+        order.clear();
+        loop.set_dispatch_limit(1, 2);
+        low_in.write(string(10, 'L'));
+        high_in.write(string(10, 'H'));
+        for (unsigned i = 0; i < 6; i++) {
+            test_check(loop.wait_next_event(0) == EventLoop::Result::Success, "expected Success");
+        }
+        test_check(order == "HHLHHL", "expected the low-priority rule to be promoted, got " + order);
+
+        // without promotion, the low-priority rule waits until the high-priority one is done
+        order.clear();
+        loop.set_dispatch_limit(1, 0);
+        while (loop.wait_next_event(0) == EventLoop::Result::Success) {
+        }
+        test_check(order == "HHHHHHLLLLLLLL", "expected strict priority order, got " + order);
+    }
+
+    // a cancel callback that cancels another rule, whose slot is then reused within the same wait
+    {
+        EventLoop loop{backend};
+        auto [ready_in, ready] = socket_pair();
+        auto [closing_in, closing] = socket_pair();
+        auto [adding_in, adding] = socket_pair();
+        auto [idle_in, idle] = socket_pair();
+
+        auto other = loop.add_rule(ready, Direction::In, [&] { ready.read(); });
+        loop.add_rule(
+            closing, Direction::In, [&] { closing.read(); }, {}, [&] { other.cancel(); });
+        bool idle_called = false;
+        EventLoop::RuleOptions options;
+        options.priority = EventLoop::Priority::High;
+        loop.add_rule(
+            adding,
+            Direction::In,
+            [&] {
+                adding.read();
+                loop.add_rule(idle, Direction::In, [&] { idle_called = true; });
+            },
+            {},
+            {},
+            options);
+
+        ready_in.write("r");
+        adding_in.write("a");
+        closing.close();
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Success, "expected Success");
+        test_check(not other.active(), "expected the other rule to be canceled");
+        test_check(not idle_called, "a new rule was dispatched with a canceled rule's events");
+    }
+}
+
+int main() {
+    try {
+        run_tests(EventLoop::Backend::Poll);
+        run_tests(EventLoop::Backend::Epoll);
+    } catch (const exception &e) {
+        cerr << "Exception: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
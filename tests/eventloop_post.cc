@@ -0,0 +1,113 @@
+#include "eventloop.hh"
+#include "socket.hh"
+#include "test_err_if.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static void run_tests(const EventLoop::Backend backend) {
+    // tasks posted from the loop's own thread run on the next call, in order
+    {
+        EventLoop loop{backend};
+        vector<int> order;
+        for (int i = 0; i < 10; i++) {
+            loop.post([&, i] { order.push_back(i); });
+        }
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Success, "expected Success");
+        test_check(order.size() == 10, "not every task ran");
+        for (int i = 0; i < 10; i++) {
+            test_check(order[i] == i, "tasks ran out of order");
+        }
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Exit, "expected Exit with nothing left to do");
+    }
+
+    // a task that throws leaves the tasks after it for the next call, which doesn't need another post
+    {
+        EventLoop loop{backend};
+        bool second_ran = false;
+        loop.post([] { throw runtime_error("first task failed"); });
+        loop.post([&] { second_ran = true; });
+        bool threw = false;
+        try {
+            loop.wait_next_event(0);
+        } catch (const runtime_error &) {
+            threw = true;
+        }
+        test_check(threw and not second_ran, "expected the first task's exception");
+        test_check(loop.wait_next_event(1000) == EventLoop::Result::Success, "the second task was not woken");
+        test_check(second_ran, "the second task did not run");
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Exit, "expected Exit with nothing left to do");
+    }
+
+    // many producers, each of whose tasks run in the order posted
+    {
+        constexpr unsigned PRODUCERS = 4;
+        constexpr unsigned TASKS = 20000;
+        EventLoop loop{backend};
+        vector<unsigned> next(PRODUCERS, 0);
+        unsigned total = 0;
+        bool in_order = true;
+
+        // keep the loop running with an idle rule while the producers work
+        int fds[2];
+        SystemCall("socketpair", ::socketpair(AF_UNIX, SOCK_STREAM, 0, static_cast<int *>(fds)));
+        LocalStreamSocket a{FileDescriptor(fds[0])}, b{FileDescriptor(fds[1])};
+        auto idle = loop.add_rule(b, Direction::In, [&] { b.read(); });
+
+        vector<thread> producers;
+        for (unsigned p = 0; p < PRODUCERS; p++) {
+            producers.emplace_back([&, p] {
+                for (unsigned i = 0; i < TASKS; i++) {
+                    loop.post([&, p, i] {
+                        in_order = in_order and next[p] == i;
+                        next[p] = i + 1;
+                        total++;
+                    });
+                }
+            });
+        }
+
+        while (total < PRODUCERS * TASKS) {
+            test_check(loop.wait_next_event(5000) == EventLoop::Result::Success, "loop stalled waiting for tasks");
+        }
+        for (auto &producer : producers) {
+            producer.join();
+        }
+        test_check(in_order, "a producer's tasks ran out of order");
+
+        // a loop blocked with no timeout is woken by a post from another thread
+        atomic<bool> woken{false};
+        thread late_poster{[&] {
+            this_thread::sleep_for(chrono::milliseconds(20));
+            loop.post([&] { woken = true; });
+        }};
+        test_check(loop.wait_next_event(-1) == EventLoop::Result::Success, "expected Success");
+        late_poster.join();
+        test_check(woken, "post did not wake the loop");
+
+        idle.cancel();
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Exit, "expected Exit after cancel");
+    }
+}
+
+int main() {
+    try {
+        run_tests(EventLoop::Backend::Poll);
+        run_tests(EventLoop::Backend::Epoll);
+    } catch (const exception &e) {
+        cerr << "Exception: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,104 @@
+#include "eventloop.hh"
+#include "test_err_if.hh"
+#include "util.hh"
+
+#include <csignal>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+static bool blocked(const int signum) {
+    sigset_t mask;
+    pthread_sigmask(SIG_BLOCK, nullptr, &mask);
+    return sigismember(&mask, signum);
+}
+
+static void run_tests(const EventLoop::Backend backend) {
+    // signals are delivered as ordinary events, and the signal handler rule doesn't keep the loop running
+    {
+        EventLoop loop{backend};
+        unsigned hups = 0, usr1s = 0;
+        loop.add_signal_handler(SIGHUP, [&](const signalfd_siginfo &info) {
+            test_check(info.ssi_signo == SIGHUP, "wrong signal number");
+            hups++;
+        });
+        loop.add_signal_handler(SIGUSR1, [&](const signalfd_siginfo &) { usr1s++; });
+        test_check(blocked(SIGHUP) and blocked(SIGUSR1), "handled signals were not blocked");
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Exit, "expected Exit with only signal handlers");
+
+        auto keepalive = loop.add_timer(timestamp_ms() + 60000, [] {});
+        raise(SIGHUP);
+        raise(SIGUSR1);
+        test_check(loop.wait_next_event(1000) == EventLoop::Result::Success, "expected Success after signals");
+        test_check(hups == 1 and usr1s == 1, "signal handlers were not called");
+
+        // a handler can remove itself; the signal is unblocked again
+        loop.add_signal_handler(SIGUSR1, [&](const signalfd_siginfo &) {
+            usr1s += 10;
+            loop.remove_signal_handler(SIGUSR1);
+        });
+        raise(SIGUSR1);
+        test_check(loop.wait_next_event(1000) == EventLoop::Result::Success, "expected Success after signal");
+        test_check(usr1s == 11, "replacement signal handler was not called");
+        test_check(not blocked(SIGUSR1) and blocked(SIGHUP), "removing a handler did not unblock its signal");
+        keepalive.cancel();
+    }
+    test_check(not blocked(SIGHUP), "destroying the EventLoop did not unblock its signals");
+
+    // a caught signal that interrupts the wait is not an Exit
+    {
+        EventLoop loop{backend};
+        auto keepalive = loop.add_timer(timestamp_ms() + 60000, [] {});
+
+        struct sigaction action {};
+        action.sa_handler = [](int) {};
+        sigemptyset(&action.sa_mask);
+        SystemCall("sigaction", ::sigaction(SIGALRM, &action, nullptr));
+        itimerval timer{};
+        timer.it_value.tv_usec = 20000;
+        SystemCall("setitimer", ::setitimer(ITIMER_REAL, &timer, nullptr));
+
+        test_check(loop.wait_next_event(5000) == EventLoop::Result::Timeout, "expected Timeout when interrupted");
+        keepalive.cancel();
+    }
+
+    // child processes are reaped through a pidfd
+    {
+        EventLoop loop{backend};
+        const pid_t pid = SystemCall("fork", ::fork());
+        if (pid == 0) {
+            _exit(7);
+        }
+
+        int status = -1;
+        auto child = loop.add_child(pid, [&](const siginfo_t &info) {
+            test_check(info.si_pid == pid and info.si_code == CLD_EXITED, "wrong child status");
+            status = info.si_status;
+        });
+        while (status < 0) {
+            test_check(loop.wait_next_event(5000) == EventLoop::Result::Success,
+                       "expected Success when the child exits");
+        }
+        test_check(status == 7, "wrong exit status " + to_string(status));
+        test_check(not child.active(), "child rule was not finished");
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Exit, "expected Exit once the child was reaped");
+    }
+}
+
+int main() {
+    try {
+        run_tests(EventLoop::Backend::Poll);
+        run_tests(EventLoop::Backend::Epoll);
+    } catch (const exception &e) {
+        cerr << "Exception: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
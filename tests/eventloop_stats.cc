@@ -0,0 +1,104 @@
+#include "eventloop.hh"
+#include "socket.hh"
+#include "test_err_if.hh"
+
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <vector>
+
+using namespace std;
+
+static pair<LocalStreamSocket, LocalStreamSocket> socket_pair() {
+    int fds[2];
+    SystemCall("socketpair", ::socketpair(AF_UNIX, SOCK_STREAM, 0, static_cast<int *>(fds)));
+    return {LocalStreamSocket(FileDescriptor(fds[0])), LocalStreamSocket(FileDescriptor(fds[1]))};
+}
+
+static void run_tests(const EventLoop::Backend backend) {
+    // nothing is collected while instrumentation is disabled
+    {
+        EventLoop loop{backend};
+        auto [a, b] = socket_pair();
+        auto rule = loop.add_rule(b, Direction::In, [&] { b.read(); });
+        a.write("x");
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Success, "expected Success");
+        test_check(loop.stats().iterations == 0 and loop.stats().poll_ns.count() == 0,
+                   "stats collected while disabled");
+        test_check(rule.stats().calls == 0, "rule stats collected while disabled");
+    }
+
+    // per-iteration and per-rule stats, slow callbacks, and the stats callback
+    {
+        EventLoop loop{backend};
+        loop.set_instrumentation(true);
+        auto [a, b] = socket_pair();
+        auto [c, d] = socket_pair();
+        // the slow rule is added (and made ready) first, so it is dispatched first
+        auto slow = loop.add_rule(d, Direction::In, [&] {
+            d.read();
+            const uint64_t start = timestamp_ns();
+            while (timestamp_ns() - start < 2'000'000) {
+            }
+        });
+        auto fast = loop.add_rule(b, Direction::In, [&] { b.read(); });
+
+        vector<EventLoop::SlowCallback> slow_callbacks;
+        loop.set_slow_callback_threshold(1'000'000, [&](const auto &info) { slow_callbacks.push_back(info); });
+        unsigned reports = 0;
+        string last_report;
+        loop.set_stats_callback(1, [&](const EventLoop &l) {
+            reports++;
+            last_report = l.stats_json();
+        });
+
+        c.write("y");
+        a.write("x");
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Success, "expected Success");
+
+        const auto &stats = loop.stats();
+        test_check(stats.iterations == 1, "expected one iteration");
+        test_check(stats.poll_ns.count() == 1, "expected one poll sample");
+        test_check(stats.ready.max_ns() == 2, "expected two ready rules");
+        test_check(stats.lag_ns.count() == 2, "expected a lag sample per dispatched rule");
+        test_check(stats.lag_ns.max_ns() >= 2'000'000, "fast rule's lag should include the slow callback");
+        test_check(stats.callback_ns.max_ns() >= 2'000'000, "callback time too short");
+        test_check(fast.stats().calls == 1 and slow.stats().calls == 1, "expected one call per rule");
+        test_check(slow.stats().max_ns >= 2'000'000, "slow rule's duration too short");
+        test_check(stats.slow_callbacks == 1 and slow_callbacks.size() == 1, "expected one slow callback");
+        test_check(slow_callbacks.front().fd == d.fd_num(), "slow callback reported on the wrong fd");
+
+        const string json = loop.stats_json();
+        test_check(json.find("\"iterations\":1") != string::npos, "stats_json missing iterations: " + json);
+        test_check(json.find("\"ready\":{\"count\":1,\"mean_rules\":2") != string::npos,
+                   "stats_json bad ready: " + json);
+        test_check(json.find("\"fd\":" + to_string(d.fd_num())) != string::npos, "stats_json missing rule: " + json);
+
+        // the stats timer runs, but doesn't keep the loop alive
+        const uint64_t start = timestamp_ms();
+        while (reports == 0 and timestamp_ms() - start < 1000) {
+            loop.wait_next_event(10);
+        }
+        test_check(reports > 0 and not last_report.empty(), "stats callback was not called");
+        fast.cancel();
+        slow.cancel();
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Exit, "stats timer kept the loop running");
+
+        loop.reset_stats();
+        test_check(loop.stats().iterations == 0 and loop.stats().slow_callbacks == 0, "reset_stats did not reset");
+    }
+}
+
+int main() {
+    try {
+        run_tests(EventLoop::Backend::Poll);
+        run_tests(EventLoop::Backend::Epoll);
+    } catch (const exception &e) {
+        cerr << "Exception: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
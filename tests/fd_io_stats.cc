@@ -0,0 +1,140 @@
+#include "file_descriptor.hh"
+#include "test_err_if.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <exception>
+#include <fcntl.h>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+static pair<FileDescriptor, FileDescriptor> make_pipe() {
+    int fds[2];
+    SystemCall("pipe2", ::pipe2(static_cast<int *>(fds), O_CLOEXEC));
+    return {FileDescriptor(fds[0]), FileDescriptor(fds[1])};
+}
+
+//! The live_io_stats() entry for `fd_num`, if there is one
+static optional<FileDescriptor::IOStats> live_stats(const int fd_num) {
+    for (const auto &stats : FileDescriptor::live_io_stats()) {
+        if (stats.fd == fd_num) {
+            return stats;
+        }
+    }
+    return {};
+}
+
+int main() {
+    try {
+        // bytes and calls are counted on each side
+        {
+            auto [read_end, write_end] = make_pipe();
+            write_end.write("hello");
+            write_end.write(string("world"));
+            test_check(write_end.write_count() == 2 and write_end.bytes_written() == 10, "wrong write accounting");
+            test_check(read_end.read() == "helloworld", "wrong data");
+            test_check(read_end.read_count() == 1 and read_end.bytes_read() == 10, "wrong read accounting");
+            test_check(write_end.eagain_count() == 0 and write_end.short_write_count() == 0, "unexpected failures");
+
+            // an empty non-blocking pipe is an EAGAIN on the read side
+            read_end.set_blocking(false);
+            int error = 0;
+            try {
+                read_end.read();
+            } catch (const unix_error &e) {
+                error = e.code().value();
+            }
+            test_check(error == EAGAIN, "expected EAGAIN from an empty pipe");
+            test_check(read_end.eagain_count() == 1 and read_end.read_count() == 1, "wrong EAGAIN accounting");
+        }
+
+        // filling a non-blocking pipe: a write that doesn't fit is short, and the next is an EAGAIN
+        {
+            auto [read_end, write_end] = make_pipe();
+            write_end.set_blocking(false);
+            const string chunk(10000, 'x');
+            uint64_t writes = 0, short_writes = 0, total = 0;
+            int error = 0;
+            try {
+                while (true) {
+                    const size_t written = write_end.write(chunk, false);
+                    writes++;
+                    short_writes += written < chunk.size();
+                    total += written;
+                }
+            } catch (const unix_error &e) {
+                error = e.code().value();
+            }
+            test_check(error == EAGAIN, "expected EAGAIN from a full pipe");
+            test_check(short_writes <= 1, "expected at most one short write");
+            test_check(write_end.write_count() == writes and write_end.bytes_written() == total,
+                       "wrong write accounting when full");
+            test_check(write_end.short_write_count() == short_writes, "wrong short-write count");
+            test_check(write_end.eagain_count() == 1, "expected exactly one EAGAIN");
+
+            const FileDescriptor::IOStats stats = write_end.io_stats();
+            test_check(stats.fd == write_end.fd_num() and stats.writes == writes and stats.bytes_written == total and
+                           stats.eagain_count == 1 and stats.short_writes == short_writes,
+                       "wrong io_stats()");
+
+            // the registry lists both ends with the same counts, and dump_io_stats shows them
+            const auto live = live_stats(write_end.fd_num());
+            test_check(live.has_value() and live->bytes_written == total and live->eagain_count == 1,
+                       "write end missing from live_io_stats()");
+            test_check(live_stats(read_end.fd_num()).has_value(), "read end missing from live_io_stats()");
+            ostringstream dump;
+            FileDescriptor::dump_io_stats(dump);
+            test_check(dump.str().find(stats.to_json()) != string::npos, "dump_io_stats() is missing the write end");
+
+            const int fd_num = write_end.fd_num();
+            {
+                const FileDescriptor closing = move(write_end);
+            }
+            test_check(not live_stats(fd_num).has_value(), "a closed descriptor is still live");
+        }
+
+        // descriptors opened on other threads are listed too, even after the thread has exited
+        {
+            vector<pair<FileDescriptor, FileDescriptor>> pipes;
+            thread opener{[&] {
+                for (unsigned i = 0; i < 4; i++) {
+                    pipes.push_back(make_pipe());
+                    pipes.back().second.write(string(i + 1, 'x'));
+                }
+            }};
+            opener.join();
+
+            const auto live = FileDescriptor::live_io_stats();
+            test_check(is_sorted(live.begin(), live.end(), [](const auto &a, const auto &b) { return a.fd < b.fd; }),
+                       "live_io_stats() is not sorted");
+            for (unsigned i = 0; i < pipes.size(); i++) {
+                const auto stats = live_stats(pipes[i].second.fd_num());
+                test_check(stats.has_value() and stats->bytes_written == i + 1, "missing another thread's descriptor");
+            }
+
+            // a descriptor can be closed on another thread, and later threads' descriptors are listed as usual
+            const int fd_num = pipes.front().first.fd_num();
+            thread closer{[&] { pipes.erase(pipes.begin()); }};
+            closer.join();
+            test_check(not live_stats(fd_num).has_value(), "a descriptor closed on another thread is still live");
+            pipes.clear();
+            thread opener_again{[&] { pipes.push_back(make_pipe()); }};
+            opener_again.join();
+            test_check(live_stats(pipes.front().first.fd_num()).has_value(), "missing a later thread's descriptor");
+        }
+    } catch (const exception &e) {
+        cerr << "Exception: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,128 @@
+#include "buffer.hh"
+#include "test_err_if.hh"
+#include "util.hh"
+
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+using Kernel = InternetChecksum::Kernel;
+
+//! The checksum of `data`, straight from RFC 1071
+static uint16_t reference(const string &data, const uint32_t initial_sum = 0) {
+    uint64_t sum = initial_sum;
+    for (size_t i = 0; i < data.size(); i++) {
+        sum += i % 2 ? uint8_t(data[i]) : uint8_t(data[i]) << 8;
+    }
+    while (sum > 0xffff) {
+        sum = (sum >> 16) + (sum & 0xffff);
+    }
+    return ~sum;
+}
+
+static uint16_t checksum(const Kernel kernel, const string &data, const vector<size_t> &splits) {
+    InternetChecksum sum{0, kernel};
+    size_t start = 0;
+    for (const size_t split : splits) {
+        sum.add(string_view(data).substr(start, split - start));
+        start = split;
+    }
+    sum.add(string_view(data).substr(start));
+    return sum.value();
+}
+
+//! Checksum `data` while copying it, checking the copy
+static uint16_t checksum_while_copying(const Kernel kernel, const string &data, const vector<size_t> &splits) {
+    InternetChecksum sum{0, kernel};
+    string copy(data.size() + 1, '!');
+    size_t start = 0;
+    for (const size_t split : splits) {
+        sum.copy_and_add(copy.data() + start, string_view(data).substr(start, split - start));
+        start = split;
+    }
+    sum.copy_and_add(copy.data() + start, string_view(data).substr(start));
+    test_check(copy.substr(0, data.size()) == data and copy.back() == '!', "wrong copy");
+    return sum.value();
+}
+
+int main() {
+    try {
+        vector<Kernel> kernels;
+        for (const Kernel kernel : {Kernel::Bytewise, Kernel::Word, Kernel::SSE2, Kernel::AVX2}) {
+            if (InternetChecksum::supported(kernel)) {
+                kernels.push_back(kernel);
+            }
+        }
+        test_check(InternetChecksum::supported(InternetChecksum::fastest_kernel()), "fastest kernel is unsupported");
+
+        // the example from RFC 1071, section 3
+        const string example{'\x00', '\x01', '\xf2', '\x03', '\xf4', '\xf5', '\xf6', '\xf7'};
+        for (const Kernel kernel : kernels) {
+            test_check(checksum(kernel, example, {}) == 0x220d, "wrong checksum for the RFC 1071 example");
+            test_check(checksum(kernel, example, {1, 2, 5}) == 0x220d, "wrong checksum for the split RFC 1071 example");
+            test_check(checksum(kernel, "", {}) == 0xffff, "wrong checksum of nothing");
+        }
+
+        // random data, split at random points (including odd ones), at random alignments
+        // (checksum_fuzz covers more inputs; these stay small so that the test runs quickly)
+        auto rd = get_random_generator();
+        for (unsigned trial = 0; trial < 2000; trial++) {
+            const size_t size = trial % 100 == 0 ? rd() % (1 << 18) : rd() % 2048;
+            const size_t offset = rd() % 64;
+            string buffer(offset + size, '\0');
+            generate(buffer.begin(), buffer.end(), [&] { return trial % 7 == 0 ? '\xff' : char(rd()); });
+            const string data = buffer.substr(offset);
+
+            vector<size_t> splits;
+            for (size_t count = rd() % 5, i = 0; i < count and size > 0; i++) {
+                splits.push_back(rd() % size);
+            }
+            sort(splits.begin(), splits.end());
+
+            const uint16_t expected = reference(data);
+            for (const Kernel kernel : kernels) {
+                test_check(checksum(kernel, data, splits) == expected,
+                           "kernel " + to_string(int(kernel)) + " differs on " + to_string(size) + " bytes");
+                test_check(checksum_while_copying(kernel, data, splits) == expected,
+                           "kernel " + to_string(int(kernel)) + " differs when copying " + to_string(size) + " bytes");
+            }
+
+            // a discontiguous payload, in one pass
+            BufferList segments;
+            size_t start = 0;
+            for (const size_t split : splits) {
+                segments.append(BufferList{data.substr(start, split - start)});
+                start = split;
+            }
+            segments.append(BufferList{data.substr(start)});
+            InternetChecksum list_sum{0xabcd};
+            test_check(segments.concatenate(list_sum) == data and list_sum.value() == reference(data, 0xabcd),
+                       "wrong BufferList copy and checksum");
+
+            BufferViewList views{segments};
+            const size_t skip = size > 0 ? rd() % size : 0;
+            views.remove_prefix(skip);
+            string copy(views.size(), '\0');
+            InternetChecksum view_sum;
+            test_check(views.copy_and_checksum(copy.data(), view_sum) == size - skip, "wrong BufferViewList copy size");
+            test_check(copy == data.substr(skip) and view_sum.value() == reference(copy), "wrong BufferViewList copy");
+            test_check(copy_and_checksum(copy.data(), data.substr(skip)) == reference(copy), "wrong copy_and_checksum");
+
+            // (and the default kernel, after a pseudo-header)
+            const uint32_t initial_sum = rd() % 0x40000;
+            InternetChecksum sum{initial_sum};
+            sum.add(data);
+            test_check(sum.value() == reference(data, initial_sum), "wrong checksum with an initial sum");
+        }
+    } catch (const exception &e) {
+        cerr << "Exception: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
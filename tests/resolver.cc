@@ -0,0 +1,137 @@
+#include "eventloop.hh"
+#include "resolver.hh"
+#include "test_err_if.hh"
+
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+static bool throws(const Resolver::Answer &answer) {
+    try {
+        answer.address();
+    } catch (const exception &) {
+        return true;
+    }
+    return false;
+}
+
+int main() {
+    try {
+        const Address localhost{"127.0.0.1", 80};
+
+        // repeated lookups are answered from the cache until the answer expires
+        {
+            Resolver::Options options;
+            options.ttl_ms = 50;
+            Resolver resolver{options};
+            test_check(resolver.resolve("localhost", "80") == localhost, "wrong address for localhost");
+            test_check(resolver.resolve("localhost", "80") == localhost, "wrong cached address for localhost");
+            test_check(resolver.resolve("localhost", "http") == localhost, "wrong address for the http service");
+            test_check(resolver.hits() == 1 and resolver.misses() == 2, "expected one hit and two misses");
+            test_check(resolver.size() == 2, "expected two cached answers");
+
+            this_thread::sleep_for(chrono::milliseconds(60));
+            test_check(resolver.resolve("localhost", "80") == localhost, "wrong address after expiry");
+            test_check(resolver.hits() == 1 and resolver.misses() == 3, "an expired answer was used");
+
+            // failures are cached, too, and rethrown each time
+            for (unsigned i = 0; i < 2; i++) {
+                bool threw = false;
+                try {
+                    resolver.resolve("localhost", "no-such-service");
+                } catch (const tagged_error &) {
+                    threw = true;
+                }
+                test_check(threw, "a failed lookup did not throw");
+            }
+            test_check(resolver.hits() == 2 and resolver.misses() == 4, "the failure was not cached");
+        }
+
+        // a full cache makes room
+        {
+            Resolver::Options options;
+            options.max_entries = 2;
+            Resolver resolver{options};
+            for (const auto &port : {"1", "2", "3", "1"}) {
+                resolver.resolve("127.0.0.1", port);
+            }
+            test_check(resolver.size() == 2, "cache grew past its limit");
+        }
+
+        // asynchronous lookups: concurrent ones share a resolution, and cached ones are answered at once
+        {
+            EventLoop loop;
+            Resolver resolver;
+            unsigned answered = 0;
+            for (unsigned i = 0; i < 3; i++) {
+                resolver.resolve_async(loop, "localhost", "80", [&](const Resolver::Answer &answer) {
+                    test_check(answer.ok() and answer.address() == localhost, "wrong asynchronous answer");
+                    answered++;
+                });
+            }
+            bool failed = false;
+            resolver.resolve_async(loop, "localhost", "no-such-service", [&](const Resolver::Answer &answer) {
+                failed = not answer.ok() and throws(answer);
+            });
+            test_check(answered == 0, "an uncached lookup was answered at once");
+
+            // the EventLoop keeps running until every lookup is answered
+            while (loop.wait_next_event(5000) == EventLoop::Result::Success) {
+            }
+            test_check(answered == 3 and failed, "asynchronous lookups were not all answered");
+            test_check(resolver.misses() == 4 and resolver.hits() == 0, "concurrent lookups were not shared");
+
+            resolver.resolve_async(loop, "localhost", "80", [&](const Resolver::Answer &) { answered++; });
+            test_check(answered == 4 and resolver.hits() == 1, "a cached lookup was not answered at once");
+
+            EventLoop other;
+            bool threw = false;
+            try {
+                resolver.resolve_async(other, "localhost", "81", [](const Resolver::Answer &) {});
+            } catch (const runtime_error &) {
+                threw = true;
+            }
+            test_check(threw, "a second EventLoop was accepted");
+        }
+
+        // a callback that throws doesn't keep the other answers (or the other callbacks) from being delivered
+        {
+            EventLoop loop;
+            Resolver resolver;
+            unsigned answered = 0;
+            resolver.resolve_async(loop, "localhost", "82", [](const Resolver::Answer &) {
+                throw runtime_error("callback failed");
+            });
+            resolver.resolve_async(loop, "localhost", "82", [&](const Resolver::Answer &) { answered++; });
+            resolver.resolve_async(loop, "localhost", "83", [&](const Resolver::Answer &) { answered++; });
+
+            unsigned thrown = 0;
+            while (true) {
+                try {
+                    if (loop.wait_next_event(5000) != EventLoop::Result::Success) {
+                        break;
+                    }
+                } catch (const runtime_error &) {
+                    thrown++;
+                }
+            }
+            test_check(thrown == 1, "expected the callback's exception once");
+            test_check(answered == 2, "a throwing callback kept the others from running");
+
+            resolver.resolve_async(loop, "localhost", "82", [&](const Resolver::Answer &) { answered++; });
+            resolver.resolve_async(loop, "localhost", "83", [&](const Resolver::Answer &) { answered++; });
+            test_check(answered == 4 and resolver.hits() == 2, "answers delivered with a throwing callback were lost");
+        }
+    } catch (const exception &e) {
+        cerr << "Exception: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,158 @@
+#include "sharded_runtime.hh"
+#include "socket.hh"
+#include "test_err_if.hh"
+
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+int main() {
+    try {
+        constexpr size_t SHARDS = 4;
+        constexpr size_t CONNECTIONS = 200;
+
+        // each shard answers a request with its own index, then waits for the client to hang up
+        ShardedRuntime runtime{
+            Address{"127.0.0.1", 0},
+            [](ShardedRuntime::Shard &shard, TCPSocket &&connection) {
+                auto socket = make_shared<TCPSocket>(move(connection));
+                shard.loop().add_rule(*socket, Direction::In, [socket, &shard] {
+                    if (not socket->read().empty()) {
+                        socket->write(to_string(shard.index()));
+                    }
+                });
+            },
+            SHARDS};
+        test_check(runtime.shard_count() == SHARDS, "wrong number of shards");
+        test_check(runtime.address().port() != 0, "listeners were not given a port");
+
+        vector<size_t> served_by(SHARDS, 0);
+        for (size_t i = 0; i < CONNECTIONS; i++) {
+            TCPSocket client;
+            client.connect(runtime.address());
+            client.write("hello");
+            const size_t shard = stoul(client.read());
+            test_check(shard < SHARDS, "reply from an unknown shard");
+            served_by[shard]++;
+        }
+
+        uint64_t accepted = 0;
+        size_t busy_shards = 0;
+        for (size_t i = 0; i < SHARDS; i++) {
+            accepted += runtime.accepted_count(i);
+            busy_shards += served_by[i] > 0;
+        }
+        test_check(accepted == CONNECTIONS, "accepted " + to_string(accepted) + " connections");
+        test_check(busy_shards > 1, "every connection went to the same shard");
+
+        // a connection still open at stop() keeps its shard running until the client hangs up
+        TCPSocket lingering;
+        lingering.connect(runtime.address());
+        runtime.stop();
+        lingering.write("still there?");
+        test_check(not lingering.read().empty(), "open connection was not served after stop()");
+        lingering.close();
+
+        runtime.wait();
+
+        TCPSocket refused;
+        bool connected = true;
+        try {
+            refused.connect(runtime.address());
+        } catch (const unix_error &) {
+            connected = false;
+        }
+        test_check(not connected, "listener still open after stop()");
+
+        // the listeners take the address's family, so a runtime can listen on IPv6 (dual-stack for "::")
+        {
+            ShardedRuntime ipv6{
+                Address{"::", 0},
+                [](ShardedRuntime::Shard &shard, TCPSocket &&connection) {
+                    auto socket = make_shared<TCPSocket>(move(connection));
+                    shard.loop().add_rule(*socket, Direction::In, [socket] {
+                        if (not socket->read().empty()) {
+                            socket->write(to_string(socket->domain()));
+                        }
+                    });
+                },
+                2,
+                false};
+            test_check(ipv6.address().family() == AF_INET6, "expected IPv6 listeners");
+
+            TCPSocket ipv6_client{AF_INET6};
+            ipv6_client.connect(Address{"::1", ipv6.address().port()});
+            ipv6_client.write("hello");
+            test_check(ipv6_client.read() == to_string(AF_INET6), "IPv6 connection was not served");
+
+            TCPSocket ipv4_client;
+            ipv4_client.connect(Address{"127.0.0.1", ipv6.address().port()});
+            ipv4_client.write("hello");
+            test_check(ipv4_client.read() == to_string(AF_INET6), "IPv4 connection was not served");
+
+            ipv6.stop();
+            ipv6_client.close();
+            ipv4_client.close();
+            ipv6.wait();
+        }
+
+        // a shard that runs out of descriptors stops accepting for a while, and then carries on
+        {
+            constexpr size_t WAITING = 5;
+            vector<TCPSocket> served;
+            ShardedRuntime starved{
+                Address{"127.0.0.1", 0},
+                [&](ShardedRuntime::Shard &, TCPSocket &&connection) { served.push_back(move(connection)); },
+                1,
+                false};
+            vector<TCPSocket> clients(WAITING);
+
+            // lower the limit to the lowest free descriptor, and fill any gaps below it
+            rlimit original{};
+            SystemCall("getrlimit", ::getrlimit(RLIMIT_NOFILE, &original));
+            const int lowest_free = SystemCall("dup", ::dup(clients.front().fd_num()));
+            SystemCall("close", ::close(lowest_free));
+            rlimit lowered = original;
+            lowered.rlim_cur = lowest_free;
+            SystemCall("setrlimit", ::setrlimit(RLIMIT_NOFILE, &lowered));
+            vector<int> fillers;
+            for (int fd; (fd = ::dup(clients.front().fd_num())) >= 0;) {
+                fillers.push_back(fd);
+            }
+
+            // the connections complete in the backlog, but the shard can't accept them yet
+            for (auto &client : clients) {
+                client.connect(starved.address());
+            }
+            this_thread::sleep_for(chrono::milliseconds(3 * ShardedRuntime::Shard::ACCEPT_RETRY_MS));
+            test_check(starved.accepted_count(0) == 0, "accepted without a free descriptor");
+
+            for (const int fd : fillers) {
+                SystemCall("close", ::close(fd));
+            }
+            SystemCall("setrlimit", ::setrlimit(RLIMIT_NOFILE, &original));
+            const auto deadline = chrono::steady_clock::now() + chrono::seconds(5);
+            while (starved.accepted_count(0) < WAITING and chrono::steady_clock::now() < deadline) {
+                this_thread::sleep_for(chrono::milliseconds(10));
+            }
+            test_check(starved.accepted_count(0) == WAITING, "shard did not resume accepting");
+
+            starved.stop();
+            starved.wait();
+        }
+    } catch (const exception &e) {
+        cerr << "Exception: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,187 @@
+#include "socket.hh"
+#include "test_err_if.hh"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+static void check_addresses() {
+    test_check(sizeof(Address) <= 32, "Address is not compact: " + to_string(sizeof(Address)) + " bytes");
+
+    const Address loopback("::1", 80);
+    test_check(loopback.family() == AF_INET6 and loopback.to_string() == "[::1]:80", "wrong IPv6 loopback");
+    test_check(Address("127.0.0.1", 80).family() == AF_INET, "wrong IPv4 family");
+    test_check(Address("::1", "80", AF_INET6) == loopback, "wrong resolved IPv6 address");
+
+    // numeric accessors
+    Address::ipv6_bytes bytes{};
+    bytes[0] = 0xfe;
+    bytes[1] = 0x80;
+    bytes[15] = 1;
+    const Address link_local = Address::from_ipv6_numeric(bytes, 3);
+    test_check(link_local.ip() == "fe80::1%3", "wrong link-local address: " + link_local.ip());
+    test_check(link_local.ipv6_numeric() == bytes and link_local.ipv6_scope_id() == 3, "wrong IPv6 numeric fields");
+    test_check(Address::from_ipv6_numeric(loopback.ipv6_numeric()) == Address("::1"), "IPv6 numeric round trip failed");
+    bool threw = false;
+    try {
+        loopback.ipv4_numeric();
+    } catch (const runtime_error &) {
+        threw = true;
+    }
+    test_check(threw, "expected ipv4_numeric to reject an IPv6 address");
+
+    // IPv4-mapped addresses
+    const Address ipv4("192.0.2.1", 53);
+    const Address mapped = ipv4.ipv4_mapped();
+    test_check(mapped.to_string() == "[::ffff:192.0.2.1]:53" and mapped.is_ipv4_mapped(), "wrong mapped address");
+    test_check(mapped.unmapped() == ipv4 and not ipv4.is_ipv4_mapped(), "wrong unmapped address");
+    test_check(loopback.unmapped() == loopback and loopback.ipv4_mapped() == loopback, "IPv6 address was changed");
+}
+
+static void check_tcp() {
+    // over IPv6
+    {
+        TCPSocket listener{AF_INET6};
+        listener.bind(Address("::1", 0));
+        listener.listen();
+        const Address server_address = listener.local_address();
+        TCPSocket client{server_address.family()};
+        client.connect(server_address);
+        TCPSocket server = listener.accept();
+        test_check(server.domain() == AF_INET6 and server.peer_address() == client.local_address(), "wrong IPv6 peer");
+        client.write("over IPv6");
+        test_check(server.read() == "over IPv6", "wrong IPv6 data");
+    }
+
+    // a dual-stack listener accepts IPv4 connections, and an IPv6 socket can connect to an IPv4 address
+    {
+        TCPSocket listener{AF_INET6};
+        listener.bind(Address("::", 0));
+        listener.listen();
+        const Address ipv4_address("127.0.0.1", listener.local_address().port());
+
+        TCPSocket ipv4_client;
+        ipv4_client.connect(ipv4_address);
+        TCPSocket server = listener.accept();
+        test_check(server.domain() == AF_INET6, "an IPv4 connection to an IPv6 listener is an IPv6 socket");
+        test_check(server.peer_address().is_ipv4_mapped(), "expected an IPv4-mapped peer");
+        test_check(server.peer_address().unmapped() == ipv4_client.local_address(), "wrong IPv4 peer");
+
+        TCPSocket dual_client{AF_INET6};
+        dual_client.connect(ipv4_address);
+        TCPSocket dual_server = listener.accept();
+        dual_client.write("over IPv4");
+        test_check(dual_server.read() == "over IPv4", "wrong IPv4 data");
+
+        // so is a batch of them
+        TCPSocket batch_client;
+        batch_client.connect(ipv4_address);
+        listener.set_blocking(false);
+        vector<TCPSocket> accepted;
+        test_check(listener.accept_batch(accepted) == 1 and accepted.front().domain() == AF_INET6,
+                   "expected an IPv6 socket from accept_batch");
+        test_check(accepted.front().peer_address().unmapped() == batch_client.local_address(), "wrong batch peer");
+    }
+
+    // unless it is IPv6-only
+    {
+        TCPSocket listener{AF_INET6};
+        listener.set_ipv6_only(true);
+        listener.bind(Address("::", 0));
+        listener.listen();
+        TCPSocket ipv4_client;
+        try {
+            ipv4_client.connect(Address("127.0.0.1", listener.local_address().port()));
+            throw runtime_error("an IPv6-only listener accepted an IPv4 connection");
+        } catch (const unix_error &e) {
+            test_check(e.code().value() == ECONNREFUSED, "expected the IPv4 connection to be refused");
+        }
+    }
+}
+
+static void check_udp() {
+    UDPSocket receiver{AF_INET6};
+    receiver.bind(Address("::", 0));
+    const uint16_t port = receiver.local_address().port();
+
+    UDPSocket ipv6_sender{AF_INET6};
+    ipv6_sender.bind(Address("::1", 0));
+    ipv6_sender.sendto(Address("::1", port), "from IPv6");
+    auto datagram = receiver.recv();
+    test_check(datagram.payload == "from IPv6" and datagram.source_address == ipv6_sender.local_address(),
+               "wrong IPv6 datagram");
+
+    UDPSocket ipv4_sender;
+    ipv4_sender.bind(Address("127.0.0.1", 0));
+    ipv4_sender.sendto(Address("127.0.0.1", port), "from IPv4");
+    datagram = receiver.recv();
+    test_check(datagram.payload == "from IPv4", "wrong IPv4 datagram");
+    test_check(datagram.source_address.unmapped() == ipv4_sender.local_address(), "wrong IPv4 source");
+
+    // a dual-stack socket replies to either kind of address
+    receiver.sendto(datagram.source_address, "reply");
+    test_check(ipv4_sender.recv().payload == "reply", "wrong reply to IPv4");
+    receiver.sendto(ipv6_sender.local_address(), "reply");
+    test_check(ipv6_sender.recv().payload == "reply", "wrong reply to IPv6");
+}
+
+// an address too large to keep inline, e.g. a named Unix socket's
+static void check_unix() {
+    char directory[] = "/tmp/socket_ipv6.XXXXXX";
+    test_check(::mkdtemp(static_cast<char *>(directory)) != nullptr, "mkdtemp failed");
+    const string path = string(static_cast<char *>(directory)) + "/a_reasonably_named_socket.sock";
+    sockaddr_un raw{};
+    raw.sun_family = AF_UNIX;
+    path.copy(static_cast<char *>(raw.sun_path), sizeof(raw.sun_path) - 1);
+    const Address address{reinterpret_cast<const sockaddr *>(&raw), offsetof(sockaddr_un, sun_path) + path.size() + 1};
+
+    try {
+        LocalStreamSocket listener{FileDescriptor(SystemCall("socket", ::socket(AF_UNIX, SOCK_STREAM, 0)))};
+        listener.bind(address);
+        SystemCall("listen", ::listen(listener.fd_num(), 1));
+        LocalStreamSocket client{FileDescriptor(SystemCall("socket", ::socket(AF_UNIX, SOCK_STREAM, 0)))};
+        client.connect(address);
+        LocalStreamSocket server{FileDescriptor(SystemCall("accept", ::accept(listener.fd_num(), nullptr, nullptr)))};
+
+        test_check(listener.local_address() == address and client.peer_address() == address, "wrong Unix address");
+        test_check(server.local_address() == address and server.local_address().family() == AF_UNIX,
+                   "wrong Unix family");
+
+        // copies and moves keep their own storage
+        Address copy = client.peer_address();
+        const Address moved = move(copy);
+        copy = moved;
+        test_check(copy == address and moved == address and copy.hash() == address.hash(),
+                   "wrong copy of a Unix address");
+        test_check(not(copy < address) and address < Address("127.0.0.1"), "wrong ordering of a Unix address");
+    } catch (...) {
+        ::unlink(path.c_str());
+        ::rmdir(static_cast<char *>(directory));
+        throw;
+    }
+    ::unlink(path.c_str());
+    ::rmdir(static_cast<char *>(directory));
+}
+
+int main() {
+    try {
+        check_addresses();
+        check_tcp();
+        check_udp();
+        check_unix();
+    } catch (const exception &e) {
+        cerr << "Exception: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,122 @@
+#include "eventloop.hh"
+#include "socket.hh"
+#include "test_err_if.hh"
+
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static uint64_t realtime_ns() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static void check_between(const Socket::packet_timestamp &timestamp, const uint64_t start, const string &what) {
+    test_check(timestamp.software_ns >= start and timestamp.software_ns <= realtime_ns(),
+               what + ": software timestamp " + to_string(timestamp.software_ns) + " out of range");
+    test_check(timestamp.hardware_ns == 0, what + ": unexpected hardware timestamp over loopback");
+}
+
+//! Wait until `socket` has reported `count` transmit timestamps
+static vector<Socket::transmit_timestamp> transmit_timestamps(Socket &socket, const size_t count) {
+    EventLoop loop;
+    vector<Socket::transmit_timestamp> timestamps;
+    loop.add_rule(
+        socket,
+        Direction::Error,
+        [&] { socket.read_transmit_timestamps(timestamps); },
+        [&] { return timestamps.size() < count; });
+    while (loop.wait_next_event(5000) == EventLoop::Result::Success) {
+    }
+    test_check(timestamps.size() == count, "expected " + to_string(count) + " transmit timestamps");
+    return timestamps;
+}
+
+int main() {
+    try {
+        const uint64_t start = realtime_ns();
+
+        // received datagrams carry the time the kernel received them, by either receive path
+        UDPSocket receiver;
+        receiver.bind(Address("127.0.0.1", 0));
+        receiver.set_timestamping(true, false);
+        UDPSocket sender;
+
+        // (if no other socket was timestamping received packets, the kernel takes a moment to start)
+        for (unsigned tries = 0;; tries++) {
+            sender.sendto(receiver.local_address(), "warmup");
+            if (receiver.recv().timestamp.software_ns != 0) {
+                break;
+            }
+            test_check(tries < 1000, "received datagrams were never timestamped");
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+
+        sender.set_timestamping(false, true);
+        for (unsigned i = 0; i < 3; i++) {
+            sender.sendto(receiver.local_address(), "datagram " + to_string(i));
+        }
+
+        const auto datagram = receiver.recv();
+        test_check(datagram.payload == "datagram 0", "wrong payload");
+        check_between(datagram.timestamp, start, "recv");
+        UDPSocket::ReceiveBatch batch;
+        test_check(receiver.recv_batch(batch) == 2, "expected two more datagrams");
+        for (const auto &received : batch.datagrams()) {
+            check_between(received.timestamp, datagram.timestamp.software_ns, "recv_batch");
+        }
+
+        // each sent datagram is timestamped once it is handed to the device, numbered in the order sent
+        const auto sent = transmit_timestamps(sender, 3);
+        for (uint32_t i = 0; i < 3; i++) {
+            test_check(sent[i].id == i and sent[i].stage == Socket::TransmitStage::Sent, "wrong datagram timestamp id");
+            check_between(sent[i].timestamp, start, "datagram transmit");
+        }
+        test_check(sent[0].timestamp.software_ns <= datagram.timestamp.software_ns,
+                   "datagram arrived before it was sent");
+
+        // without timestamping, there is no timestamp
+        receiver.set_timestamping(false, false);
+        sender.sendto(receiver.local_address(), "untimed");
+        test_check(receiver.recv().timestamp.software_ns == 0, "timestamp reported after timestamping was stopped");
+
+        // a TCP send is also timestamped once it is acknowledged; its id is the offset of its last byte
+        TCPSocket listener;
+        listener.bind(Address("127.0.0.1", 0));
+        listener.listen();
+        TCPSocket client;
+        client.connect(listener.local_address());
+        TCPSocket server = listener.accept();
+        client.set_timestamping(false, true);
+        client.write(string(100, 'a'));
+        test_check(server.read() == string(100, 'a'), "wrong data");
+        client.write(string(50, 'b'));
+        test_check(server.read() == string(50, 'b'), "wrong data");
+
+        const auto tcp = transmit_timestamps(client, 4);
+        vector<uint32_t> sent_ids, acknowledged_ids;
+        uint64_t sent_ns = 0;
+        for (const auto &timestamp : tcp) {
+            check_between(timestamp.timestamp, start, "TCP transmit");
+            if (timestamp.stage == Socket::TransmitStage::Sent) {
+                sent_ids.push_back(timestamp.id);
+                sent_ns = timestamp.timestamp.software_ns;
+            } else {
+                acknowledged_ids.push_back(timestamp.id);
+                test_check(timestamp.timestamp.software_ns >= sent_ns, "send acknowledged before it was sent");
+            }
+        }
+        test_check(sent_ids == (vector<uint32_t>{99, 149}), "wrong TCP sent ids");
+        test_check(acknowledged_ids == (vector<uint32_t>{99, 149}), "wrong TCP acknowledged ids");
+    } catch (const exception &e) {
+        cerr << "Exception: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,79 @@
+#include "socket.hh"
+#include "test_err_if.hh"
+
+#include <cerrno>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+int main() {
+    try {
+        TCPSocket listener;
+        listener.bind(Address("127.0.0.1", 0));
+        listener.listen();
+        listener.set_blocking(false);
+        TCPSocket client;
+        client.connect(listener.local_address());
+        vector<TCPSocket> accepted;
+        test_check(listener.accept_batch(accepted) == 1, "expected one connection");
+        TCPSocket &server = accepted.back();
+
+        // each option reads back as set (buffers are doubled by the kernel)
+        client.set_nodelay(true);
+        test_check(client.nodelay(), "TCP_NODELAY was not set");
+        client.set_nodelay(false);
+        test_check(not client.nodelay(), "TCP_NODELAY was not cleared");
+        client.set_cork(true);
+        test_check(client.cork(), "TCP_CORK was not set");
+        client.set_cork(false);
+        client.set_notsent_lowat(8192);
+        test_check(client.notsent_lowat() == 8192, "TCP_NOTSENT_LOWAT was not set");
+        client.set_send_buffer(65536);
+        test_check(client.send_buffer() == 2 * 65536, "unexpected SO_SNDBUF " + to_string(client.send_buffer()));
+        server.set_receive_buffer(32768);
+        test_check(server.receive_buffer() == 2 * 32768, "unexpected SO_RCVBUF " + to_string(server.receive_buffer()));
+
+        // raising SO_BUSY_POLL may need privileges
+        try {
+            client.set_busy_poll(50);
+            test_check(client.busy_poll() == 50, "SO_BUSY_POLL was not set");
+        } catch (const unix_error &e) {
+            test_check(e.code().value() == EPERM, "unexpected error setting SO_BUSY_POLL");
+        }
+
+        // profiles apply coherent settings, and leave the rest alone
+        server.tune(TCPSocket::Tuning::low_latency());
+        test_check(server.nodelay() and not server.cork(), "low-latency profile did not disable coalescing");
+        test_check(server.notsent_lowat() == 16384, "low-latency profile did not limit unsent data");
+        test_check(server.receive_buffer() == 2 * 32768, "low-latency profile changed the receive buffer");
+
+        const int send_buffer_before = client.send_buffer();
+        client.tune(TCPSocket::Tuning::bulk());
+        test_check(not client.nodelay() and not client.cork(), "bulk profile misconfigured coalescing");
+        test_check(client.send_buffer() >= send_buffer_before, "bulk profile shrank the send buffer");
+        test_check(client.notsent_lowat() == 8192, "bulk profile changed TCP_NOTSENT_LOWAT");
+
+        // the connection still works
+        client.write("tuned");
+        server.set_blocking(true);
+        string received;
+        while (received.size() < 5) {
+            received += server.read();
+        }
+        test_check(received == "tuned", "tuned connection does not work");
+
+        // UDP sockets share the buffer options
+        UDPSocket udp;
+        udp.set_receive_buffer(16384);
+        test_check(udp.receive_buffer() == 2 * 16384, "UDP SO_RCVBUF was not set");
+    } catch (const exception &e) {
+        cerr << "Exception: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
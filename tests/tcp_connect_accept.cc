@@ -0,0 +1,104 @@
+#include "eventloop.hh"
+#include "socket.hh"
+#include "test_err_if.hh"
+
+#include <cerrno>
+#include <cstdlib>
+#include <exception>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static void run_tests(const EventLoop::Backend backend) {
+    TCPSocket listener;
+    listener.bind(Address("127.0.0.1", 0));
+    listener.listen(64);
+    listener.set_blocking(false);
+
+    // a non-blocking connect completes through the EventLoop
+    {
+        EventLoop loop{backend};
+        TCPSocket client;
+        bool connected = false;
+        auto connecting = loop.add_connect(client, listener.local_address(), [&] {
+            client.finish_connect();
+            connected = true;
+        });
+        while (not connected) {
+            test_check(loop.wait_next_event(1000) == EventLoop::Result::Success, "expected Success while connecting");
+        }
+        test_check(not connecting.active(), "connect rule was not finished");
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Exit, "expected Exit once connected");
+        test_check(client.peer_address() == listener.local_address(), "connected to the wrong peer");
+
+        vector<TCPSocket> accepted;
+        test_check(listener.accept_batch(accepted) == 1, "expected one connection");
+        client.write("hi");
+        test_check(accepted.back().read() == "hi", "connection does not work");
+
+        // the finished attempt leaves nothing behind that is ready, so the loop blocks on an idle descriptor
+        loop.add_rule(accepted.back(), EventLoop::Direction::In, [&] { accepted.back().read(); });
+        unsigned waits = 0;
+        for (const uint64_t start = timestamp_ms(); timestamp_ms() - start < 200; waits++) {
+            test_check(loop.wait_next_event(50) == EventLoop::Result::Timeout,
+                       "expected a Timeout on an idle descriptor");
+        }
+        test_check(waits < 20, "the EventLoop spun " + to_string(waits) + " times after connecting");
+    }
+
+    // a refused connection is reported to the callback, not thrown from the EventLoop
+    {
+        EventLoop loop{backend};
+        Address closed_port{"127.0.0.1"};
+        {
+            TCPSocket unused;
+            unused.bind(Address("127.0.0.1", 0));
+            closed_port = unused.local_address();
+        }
+        TCPSocket client;
+        int error = 0;
+        loop.add_connect(client, closed_port, [&] {
+            try {
+                client.finish_connect();
+            } catch (const unix_error &e) {
+                error = e.code().value();
+            }
+        });
+        while (loop.wait_next_event(1000) == EventLoop::Result::Success) {
+        }
+        test_check(error == ECONNREFUSED, "expected ECONNREFUSED, got " + to_string(error));
+    }
+
+    // accept_batch drains the backlog, handing out non-blocking, close-on-exec connections
+    {
+        vector<TCPSocket> clients(20);
+        for (auto &client : clients) {
+            client.connect(listener.local_address());
+        }
+
+        vector<TCPSocket> accepted;
+        test_check(listener.accept_batch(accepted, 5) == 5, "expected a batch of five");
+        test_check(listener.accept_batch(accepted) == 15, "expected the rest of the backlog");
+        test_check(listener.accept_batch(accepted) == 0, "expected an empty backlog");
+        for (const auto &connection : accepted) {
+            test_check(SystemCall("fcntl", ::fcntl(connection.fd_num(), F_GETFL)) & O_NONBLOCK, "blocking connection");
+            test_check(SystemCall("fcntl", ::fcntl(connection.fd_num(), F_GETFD)) & FD_CLOEXEC,
+                       "inheritable connection");
+        }
+    }
+}
+
+int main() {
+    try {
+        run_tests(EventLoop::Backend::Poll);
+        run_tests(EventLoop::Backend::Epoll);
+    } catch (const exception &e) {
+        cerr << "Exception: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
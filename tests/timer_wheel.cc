@@ -0,0 +1,156 @@
+#include "eventloop.hh"
+#include "test_err_if.hh"
+#include "timer_wheel.hh"
+#include "util.hh"
+
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+int main() {
+    try {
+        auto rd = get_random_generator();
+
+        // many random timers fire exactly once, at their deadline, however time advances
+        {
+            constexpr size_t N = 20000;
+            TimerWheel wheel{1000};
+            vector<uint64_t> deadlines(N), fired_at(N, 0);
+            vector<TimerWheel::TimerId> ids;
+            vector<bool> canceled(N, false);
+
+            for (size_t i = 0; i < N; i++) {
+                // mostly near deadlines, some far beyond the top level's span
+                const uint64_t delay = i % 100 == 0 ? rd() % (uint64_t(1) << 26) : rd() % 300000;
+                deadlines[i] = 1000 + 1 + delay;
+                ids.push_back(wheel.schedule(deadlines[i], [&, i] {
+                    test_check(fired_at[i] == 0, "timer fired twice");
+                    fired_at[i] = wheel.now();
+                }));
+            }
+            for (size_t i = 0; i < N; i += 7) {
+                test_check(wheel.cancel(ids[i]), "cancel failed");
+                test_check(not wheel.cancel(ids[i]), "second cancel succeeded");
+                canceled[i] = true;
+            }
+
+            while (not wheel.empty()) {
+                const auto next = wheel.next_expiry();
+                test_check(next.has_value() and *next > wheel.now(), "bad next_expiry");
+                // sometimes step exactly to the next expiry, sometimes overshoot it
+                wheel.advance(rd() % 2 ? *next : *next + rd() % 5000);
+            }
+
+            for (size_t i = 0; i < N; i++) {
+                if (canceled[i]) {
+                    test_check(fired_at[i] == 0, "canceled timer fired");
+                } else {
+                    test_check(fired_at[i] >= deadlines[i], "timer fired early");
+                }
+            }
+        }
+
+        // stepping one millisecond at a time, every timer fires exactly on its deadline
+        {
+            TimerWheel wheel{0};
+            vector<uint64_t> deadlines, fired_at;
+            for (size_t i = 0; i < 2000; i++) {
+                deadlines.push_back(1 + rd() % 20000);
+                fired_at.push_back(0);
+                wheel.schedule(deadlines.back(), [&, i] { fired_at[i] = wheel.now(); });
+            }
+            for (uint64_t t = 1; t <= 20000; t++) {
+                wheel.advance(t);
+            }
+            test_check(wheel.empty(), "timers left over");
+            test_check(fired_at == deadlines, "timer fired at the wrong time");
+        }
+
+        // periodic timers, and callbacks that cancel or schedule timers
+        {
+            TimerWheel wheel{0};
+            unsigned ticks = 0;
+            TimerWheel::TimerId periodic{};
+            periodic = wheel.schedule(
+                10,
+                [&] {
+                    if (++ticks == 5) {
+                        wheel.cancel(periodic);
+                    }
+                },
+                10);
+            bool chained = false;
+            wheel.schedule(3, [&] { wheel.schedule(wheel.now(), [&] { chained = true; }); });
+
+            wheel.advance(3);
+            test_check(not chained, "timer scheduled in the past ran too soon");
+            wheel.advance(4);
+            test_check(chained, "timer scheduled in the past did not run");
+            wheel.advance(1000);
+            test_check(ticks == 5, "periodic timer ran " + to_string(ticks) + " times");
+            test_check(wheel.empty(), "canceled periodic timer still scheduled");
+        }
+
+        // a periodic timer whose callback throws is canceled, and the rest of its tick runs next time
+        {
+            TimerWheel wheel{0};
+            unsigned ticks = 0;
+            const auto periodic = wheel.schedule(
+                10,
+                [&] {
+                    if (++ticks == 2) {
+                        throw runtime_error("periodic timer failed");
+                    }
+                },
+                10);
+            bool other_fired = false;
+            wheel.schedule(20, [&] { other_fired = true; });
+
+            bool threw = false;
+            try {
+                wheel.advance(100);
+            } catch (const runtime_error &) {
+                threw = true;
+            }
+            test_check(threw and ticks == 2, "expected the periodic timer's exception");
+            test_check(not wheel.pending(periodic), "periodic timer still scheduled after throwing");
+            test_check(wheel.next_expiry() == wheel.now(), "expected the rest of the tick to be due now");
+
+            wheel.advance(wheel.now());
+            test_check(other_fired and wheel.empty(), "the rest of the tick did not run");
+            wheel.advance(1000);
+            test_check(ticks == 2, "periodic timer ran again after throwing");
+        }
+
+        // EventLoop runs timers without any rules, and exits once they are done
+        {
+            EventLoop loop;
+            const uint64_t start = timestamp_ms();
+            uint64_t fired = 0;
+            unsigned periodic_count = 0;
+            loop.add_timer(start + 20, [&] { fired = timestamp_ms(); });
+            auto periodic = loop.add_periodic(5, [&] { periodic_count++; });
+            auto canceled = loop.add_timer(start + 10, [] { throw runtime_error("canceled timer ran"); });
+            test_check(canceled.cancel(), "cancel failed");
+
+            while (fired == 0) {
+                loop.wait_next_event(-1);
+            }
+            test_check(fired >= start + 20, "EventLoop timer fired early");
+            test_check(periodic_count >= 2, "periodic timer did not repeat");
+            periodic.cancel();
+            test_check(loop.wait_next_event(0) == EventLoop::Result::Exit, "expected Exit with no timers left");
+        }
+    } catch (const exception &e) {
+        cerr << "Exception: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
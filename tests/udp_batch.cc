@@ -0,0 +1,174 @@
+#include "buffer.hh"
+#include "socket.hh"
+#include "test_err_if.hh"
+
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+static string payload(const size_t n) { return "datagram " + to_string(n) + string(n % 500, '.'); }
+
+int main() {
+    try {
+        // a pooled string is reused once every Buffer sharing it is gone
+        {
+            BufferPool pool{2};
+            Buffer first = pool.make("first");
+            {
+                const Buffer second = pool.make("second");
+                test_check(pool.size() == 2 and second.str() == "second", "pool did not grow");
+            }
+            const Buffer third = pool.make("third");
+            test_check(pool.size() == 2 and third.str() == "third", "free string was not reused");
+            const Buffer fourth = pool.make("fourth");
+            test_check(pool.size() == 2 and fourth.str() == "fourth", "full pool misbehaved");
+            test_check(first.str() == "first", "a string in use was overwritten");
+        }
+
+        // storage acquired from a pool is filled in place, and becomes a Buffer of the bytes filled
+        {
+            BufferPool pool{1};
+            auto storage = pool.acquire(100);
+            test_check(storage->size() >= 100, "acquired storage is too small");
+            storage->replace(0, 5, "hello");
+            const char *const data = storage->data();
+            Buffer filled = pool.make(move(storage), 5);
+            test_check(filled.str() == "hello" and filled.str().data() == data, "payload was copied");
+            filled.remove_prefix(5);
+            test_check(pool.acquire(10)->data() == data, "storage was not recycled");
+        }
+
+        UDPSocket receiver;
+        receiver.bind(Address("127.0.0.1", 0));
+        receiver.set_blocking(false);
+        UDPSocket sender;
+        sender.bind(Address("127.0.0.1", 0));
+        const Address destination = receiver.local_address();
+
+        UDPSocket::ReceiveBatch batch;
+        test_check(receiver.recv_batch(batch) == 0 and batch.datagrams().empty(), "expected no datagrams");
+
+        // datagrams arrive in order, with their source, however the batches split them
+        // (each round fits in the default receive buffer, so none are dropped)
+        vector<string> payloads;
+        vector<UDPSocket::outgoing_datagram> outgoing;
+        size_t next_expected = 0;
+        size_t pool_size_after_warmup = 0;
+        for (size_t round = 0; round < 60; round++) {
+            payloads.clear();
+            outgoing.clear();
+            for (size_t i = 0; i < 50; i++) {
+                payloads.push_back(payload(round * 50 + i));
+            }
+            for (const auto &data : payloads) {
+                outgoing.push_back({destination, data});
+            }
+            test_check(sender.send_batch(outgoing) == outgoing.size(), "send_batch did not send every datagram");
+
+            size_t received_this_round = 0;
+            while (received_this_round < payloads.size()) {
+                const size_t received = receiver.recv_batch(batch, 64, 2048);
+                test_check(received == batch.datagrams().size(), "recv_batch count disagrees with its datagrams");
+                for (const auto &datagram : batch.datagrams()) {
+                    test_check(datagram.payload.str() == payload(next_expected), "wrong payload");
+                    test_check(datagram.source_address == sender.local_address(), "wrong source address");
+                    next_expected++;
+                }
+                received_this_round += received;
+            }
+
+            if (round == 1) {
+                pool_size_after_warmup = batch.pool().size();
+            }
+        }
+        test_check(next_expected == 3000, "expected 3000 datagrams, got " + to_string(next_expected));
+        test_check(batch.pool().size() == pool_size_after_warmup, "payload storage was not recycled");
+
+        // a payload the caller keeps is not overwritten by later batches
+        {
+            sender.sendto(destination, "kept");
+            while (receiver.recv_batch(batch) == 0) {
+            }
+            const Buffer kept = batch.datagrams().front().payload;
+            for (size_t i = 0; i < 3; i++) {
+                sender.sendto(destination, "later " + to_string(i));
+                while (receiver.recv_batch(batch) == 0) {
+                }
+            }
+            test_check(kept.str() == "kept", "a kept payload was overwritten");
+        }
+
+        // GSO splits one send into many datagrams; with GRO, they may be coalesced again, and are split into views
+        {
+            UDPSocket gro_receiver;
+            gro_receiver.bind(Address("127.0.0.1", 0));
+            gro_receiver.set_gro(true);
+            const Address gro_destination = gro_receiver.local_address();
+
+            const auto receive_segments = [&](const size_t expected) {
+                string received;
+                size_t segments = 0;
+                while (segments < expected) {
+                    gro_receiver.recv_batch(batch);
+                    for (const auto &datagram : batch.datagrams()) {
+                        for (size_t i = 0; i < datagram.segments(); i++) {
+                            received += datagram.segment(i);
+                            segments++;
+                        }
+                    }
+                }
+                test_check(segments == expected, "expected " + to_string(expected) + " segments");
+                return received;
+            };
+
+            const string bulk = payload(1) + string(10500 - payload(1).size(), 'g');
+            test_check(sender.send_batch({{gro_destination, bulk, 1000}}) == 1, "GSO send failed");
+            test_check(receive_segments(11) == bulk, "GSO/GRO mangled the payload");
+
+            UDPSocket gso_sender;
+            gso_sender.set_segment_size(500);
+            gso_sender.sendto(gro_destination, string(2000, 's'));
+            test_check(receive_segments(4) == string(2000, 's'), "socket-wide GSO mangled the payload");
+        }
+
+        // a datagram that fails after others were sent ends the batch early; sending the rest reports why
+        {
+            const Address bad_destination{"::1", 9};  // an IPv6 address, for an IPv4 socket
+            const vector<UDPSocket::outgoing_datagram> mixed{
+                {destination, "sent"}, {bad_destination, "failed"}, {destination, "never sent"}};
+            test_check(sender.send_batch(mixed) == 1, "expected the batch to stop at the failed datagram");
+            bool threw = false;
+            try {
+                sender.send_batch(mixed.data() + 1, 2);
+            } catch (const unix_error &) {
+                threw = true;
+            }
+            test_check(threw, "sending the rest did not report the error");
+            while (receiver.recv_batch(batch) == 0) {
+            }
+            test_check(batch.datagrams().size() == 1 and batch.datagrams().front().payload.str() == "sent",
+                       "expected just the first datagram");
+        }
+
+        // an oversized datagram is an error, as with recv()
+        sender.sendto(destination, string(100, 'x'));
+        bool threw = false;
+        try {
+            receiver.recv_batch(batch, 8, 50);
+        } catch (const runtime_error &) {
+            threw = true;
+        }
+        test_check(threw, "oversized datagram was not detected");
+    } catch (const exception &e) {
+        cerr << "Exception: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
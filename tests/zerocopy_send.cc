@@ -0,0 +1,103 @@
+#include "buffer.hh"
+#include "eventloop.hh"
+#include "socket.hh"
+#include "test_err_if.hh"
+
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+
+using namespace std;
+
+static string chunk(const size_t n) { return "chunk " + to_string(n) + string(65536, static_cast<char>('a' + n % 26)); }
+
+static void run_tests(const EventLoop::Backend backend) {
+    // a bulk transfer: the pool can't reuse a payload's storage until the kernel is done with it
+    {
+        EventLoop loop{backend};
+        TCPSocket listener;
+        listener.bind(Address("127.0.0.1", 0));
+        listener.listen();
+        TCPSocket client;
+        client.connect(listener.local_address());
+        TCPSocket server = listener.accept();
+        client.set_blocking(false);
+
+        ZeroCopySender sender{client};
+        BufferPool pool{2};
+        const size_t chunks = 64;
+        size_t next_chunk = 0;
+        Buffer current;
+        string expected, received;
+
+        loop.add_zerocopy(sender);
+        // (the writer shares the socket with the zero-copy Rule, so completions must not look like errors to it)
+        loop.add_rule(
+            client,
+            Direction::Out,
+            [&] {
+                if (current.size() == 0) {
+                    current = pool.make(chunk(next_chunk));
+                    expected += chunk(next_chunk++);
+                }
+                current.remove_prefix(sender.write(current));
+                if (next_chunk == chunks and current.size() == 0) {
+                    client.shutdown(SHUT_WR);
+                }
+            },
+            [&] { return next_chunk < chunks or current.size() > 0; });
+        loop.add_rule(server, Direction::In, [&] { received += server.read(); });
+
+        while (loop.wait_next_event(5000) == EventLoop::Result::Success) {
+        }
+        test_check(received == expected, "payload was changed before the kernel was done with it");
+        test_check(sender.pending() == 0, "payloads are still pinned: " + to_string(sender.pending()));
+        // (over loopback, the kernel copies the payloads when it delivers them)
+        test_check(sender.copied() > 0, "expected the kernel to report copying over loopback");
+
+        // small payloads are copied, so nothing is pinned
+        TCPSocket small_client;
+        small_client.connect(listener.local_address());
+        TCPSocket small_server = listener.accept();
+        ZeroCopySender small_sender{small_client};
+        test_check(small_sender.write(Buffer(string(100, 's'))) == 100, "small write was short");
+        test_check(small_sender.pending() == 0, "a small payload was pinned");
+        test_check(small_server.read() == string(100, 's'), "wrong small payload");
+    }
+
+    // a datagram stays pinned until its completion is processed
+    {
+        EventLoop loop{backend};
+        UDPSocket receiver;
+        receiver.bind(Address("127.0.0.1", 0));
+        UDPSocket udp;
+        ZeroCopySender sender{udp};
+
+        const string payload(30000, 'u');
+        test_check(sender.sendto(receiver.local_address(), Buffer(string(payload))) == payload.size(),
+                   "short datagram");
+        test_check(sender.pending() == 1, "expected the datagram to be pinned");
+        test_check(receiver.recv().payload == payload, "wrong datagram");
+
+        auto completions = loop.add_zerocopy(sender);
+        while (sender.pending() > 0) {
+            test_check(loop.wait_next_event(5000) == EventLoop::Result::Success, "expected a completion");
+        }
+        test_check(loop.wait_next_event(0) == EventLoop::Result::Exit, "expected Exit with nothing pinned");
+        test_check(completions.active(), "completion Rule was canceled");
+    }
+}
+
+int main() {
+    try {
+        run_tests(EventLoop::Backend::Poll);
+        run_tests(EventLoop::Backend::Epoll);
+    } catch (const exception &e) {
+        cerr << "Exception: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}